@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "BranchPredictor.h"
+#include "config.h"
+#include "log2i.h"
+
+// Reads an optional integer parameter, falling back to def if it is missing
+static int getIntegerOr(const char *name, const char *key, int def)
+{
+  GError *error = NULL;
+  if(!g_key_file_has_key(config->keyfile, name, key, NULL)) return def;
+  int ret = g_key_file_get_integer(config->keyfile, name, key, &error);
+  if(error != NULL) g_error (error->message);
+  return ret;
+}
+
+// Moves a 2-bit saturating counter towards the outcome
+static void updateCounter(uint8_t &ctr, bool taken)
+{
+  if(taken && ctr < 3) ctr++;
+  if(!taken && ctr > 0) ctr--;
+}
+
+// BimodalPredictor
+
+BimodalPredictor::BimodalPredictor(uint32_t tableBits)
+  : table(1u << tableBits, 1)
+  ,indexMask((1u << tableBits) - 1)
+{
+}
+
+bool BimodalPredictor::predict(uint32_t pc)
+{
+  return table[(pc >> 2) & indexMask] >= 2;
+}
+
+void BimodalPredictor::update(uint32_t pc, bool taken)
+{
+  updateCounter(table[(pc >> 2) & indexMask], taken);
+}
+
+std::string BimodalPredictor::toString() const
+{
+  return "direction predictor = bimodal\ncounters = " + std::to_string(table.size()) + "\n";
+}
+
+// GsharePredictor
+
+GsharePredictor::GsharePredictor(uint32_t tableBits, uint32_t h)
+  : table(1u << tableBits, 1)
+  ,indexMask((1u << tableBits) - 1)
+  ,historyBits(h)
+  ,history(0)
+{
+  assert(historyBits > 0 && historyBits <= 32);
+}
+
+bool GsharePredictor::predict(uint32_t pc)
+{
+  return table[calcIndex(pc)] >= 2;
+}
+
+void GsharePredictor::update(uint32_t pc, bool taken)
+{
+  updateCounter(table[calcIndex(pc)], taken);
+  history = (history << 1) | (taken ? 1 : 0);
+}
+
+std::string GsharePredictor::toString() const
+{
+  std::string ret;
+  ret += "direction predictor = gshare\n";
+  ret += "counters = " + std::to_string(table.size()) + "\n";
+  ret += "history bits = " + std::to_string(historyBits) + "\n";
+  return ret;
+}
+
+// TagePredictor
+
+void TagePredictor::FoldedHistory::update(const std::vector<uint8_t> &ghist, uint32_t ptr)
+{
+  comp = (comp << 1) | ghist[ptr];
+  comp ^= ghist[(ptr + origLength) % ghist.size()] << outPoint;
+  comp ^= comp >> compLength;
+  comp &= (1u << compLength) - 1;
+}
+
+TagePredictor::TagePredictor(uint32_t n, uint32_t bits, uint32_t minHist, uint32_t maxHist)
+  : base(bits + 2)
+  ,numTables(n)
+  ,tableBits(bits)
+  ,tagBits(9)
+  ,ghist(maxHist + 1, 0)
+  ,ghistPtr(0)
+  ,pathHist(0)
+  ,branchCount(0)
+  ,indices(n)
+  ,tags(n)
+  ,provider(-1)
+  ,altProvider(-1)
+  ,providerPred(false)
+  ,altPred(false)
+  ,basePred(false)
+{
+  assert(numTables >= 2);
+  assert(minHist >= 1 && minHist < maxHist);
+
+  TageEntry empty = {false, 0, 0, 0};
+  for(uint32_t t = 0; t < numTables; t++) {
+    // Geometric series of history lengths from minHist to maxHist
+    double ratio = pow((double)maxHist / minHist, (double)t / (numTables - 1));
+    uint32_t len = (uint32_t)(minHist * ratio + 0.5);
+    histLengths.push_back(len);
+    tables.push_back(std::vector<TageEntry>(1u << tableBits, empty));
+
+    FoldedHistory fh;
+    fh.init(len, tableBits);
+    indexHist.push_back(fh);
+    fh.init(len, tagBits);
+    tagHist[0].push_back(fh);
+    fh.init(len, tagBits - 1);
+    tagHist[1].push_back(fh);
+  }
+}
+
+uint32_t TagePredictor::calcIndex(uint32_t pc, uint32_t t) const
+{
+  uint32_t p = pc >> 2;
+  return (p ^ (p >> tableBits) ^ indexHist[t].comp ^ (pathHist >> t)) & ((1u << tableBits) - 1);
+}
+
+uint16_t TagePredictor::calcTag(uint32_t pc, uint32_t t) const
+{
+  return ((pc >> 2) ^ tagHist[0][t].comp ^ (tagHist[1][t].comp << 1)) & ((1u << tagBits) - 1);
+}
+
+bool TagePredictor::predict(uint32_t pc)
+{
+  for(uint32_t t = 0; t < numTables; t++) {
+    indices[t] = calcIndex(pc, t);
+    tags[t] = calcTag(pc, t);
+  }
+
+  // Find the longest matching table and the next longest one
+  provider = altProvider = -1;
+  for(int t = numTables - 1; t >= 0; t--) {
+    if(tables[t][indices[t]].valid && tables[t][indices[t]].tag == tags[t]) {
+      if(provider < 0) {
+        provider = t;
+      } else {
+        altProvider = t;
+        break;
+      }
+    }
+  }
+
+  basePred = base.predict(pc);
+  altPred = altProvider >= 0 ? tables[altProvider][indices[altProvider]].ctr >= 0 : basePred;
+  if(provider < 0) return basePred;
+  providerPred = tables[provider][indices[provider]].ctr >= 0;
+  return providerPred;
+}
+
+void TagePredictor::update(uint32_t pc, bool taken)
+{
+  bool pred = provider >= 0 ? providerPred : basePred;
+
+  // On a misprediction, try to allocate an entry with a longer history
+  if(pred != taken && provider < (int)numTables - 1) {
+    bool allocated = false;
+    for(uint32_t t = provider + 1; t < numTables; t++) {
+      TageEntry &e = tables[t][indices[t]];
+      if(e.u == 0) {
+        e.valid = true;
+        e.ctr = taken ? 0 : -1;
+        e.tag = tags[t];
+        allocated = true;
+        break;
+      }
+    }
+    if(!allocated) {
+      for(uint32_t t = provider + 1; t < numTables; t++) {
+        TageEntry &e = tables[t][indices[t]];
+        if(e.u > 0) e.u--;
+      }
+    }
+  }
+
+  if(provider >= 0) {
+    TageEntry &e = tables[provider][indices[provider]];
+    if(taken && e.ctr < 3) e.ctr++;
+    if(!taken && e.ctr > -4) e.ctr--;
+    if(providerPred != altPred) {
+      if(providerPred == taken && e.u < 3) e.u++;
+      if(providerPred != taken && e.u > 0) e.u--;
+    }
+  } else {
+    base.update(pc, taken);
+  }
+
+  // Gracefully age the useful bits so stale entries can be replaced
+  branchCount++;
+  if((branchCount & ((1u << 18) - 1)) == 0) {
+    for(uint32_t t = 0; t < numTables; t++) {
+      for(size_t i = 0; i < tables[t].size(); i++) {
+        tables[t][i].u >>= 1;
+      }
+    }
+  }
+
+  // Shift the outcome into the global and folded histories
+  ghistPtr = (ghistPtr + ghist.size() - 1) % ghist.size();
+  ghist[ghistPtr] = taken ? 1 : 0;
+  pathHist = (pathHist << 1) | ((pc >> 2) & 1);
+  for(uint32_t t = 0; t < numTables; t++) {
+    indexHist[t].update(ghist, ghistPtr);
+    tagHist[0][t].update(ghist, ghistPtr);
+    tagHist[1][t].update(ghist, ghistPtr);
+  }
+}
+
+std::string TagePredictor::toString() const
+{
+  std::string ret;
+  ret += "direction predictor = tage\n";
+  ret += "tagged tables = " + std::to_string(numTables) + " x " + std::to_string(1u << tableBits) + "\n";
+  ret += "history lengths =";
+  for(uint32_t t = 0; t < numTables; t++) {
+    ret += " " + std::to_string(histLengths[t]);
+  }
+  ret += "\n";
+  return ret;
+}
+
+// BTB
+
+BTB::BTB(uint32_t numEntries, uint32_t a)
+  : assoc(a)
+{
+  assert(assoc > 0 && numEntries % assoc == 0);
+  numSets = numEntries / assoc;
+  assert((numSets & (numSets - 1)) == 0);
+  BTBEntry empty = {false, 0, 0, 0};
+  entries.assign(numEntries, empty);
+}
+
+bool BTB::lookup(uint32_t pc, uint32_t *target)
+{
+  uint32_t set = (pc >> 2) & (numSets - 1);
+  uint32_t tag = (pc >> 2) >> log2i(numSets);
+  bool hit = false;
+
+  for(uint32_t i = set * assoc; i < (set + 1) * assoc; i++) {
+    entries[i].age++;
+    if(entries[i].valid && entries[i].tag == tag) {
+      entries[i].age = 0;
+      *target = entries[i].target;
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+void BTB::update(uint32_t pc, uint32_t target)
+{
+  uint32_t set = (pc >> 2) & (numSets - 1);
+  uint32_t tag = (pc >> 2) >> log2i(numSets);
+  BTBEntry *victim = NULL;
+
+  for(uint32_t i = set * assoc; i < (set + 1) * assoc; i++) {
+    BTBEntry &e = entries[i];
+    if(e.valid && e.tag == tag) {
+      e.target = target;
+      return;
+    }
+    // Prefer invalid entries, then the oldest
+    if(!victim || (victim->valid && (!e.valid || e.age > victim->age))) {
+      victim = &e;
+    }
+  }
+  victim->valid = true;
+  victim->tag = tag;
+  victim->target = target;
+  victim->age = 0;
+}
+
+// RAS
+
+RAS::RAS(uint32_t numEntries)
+  : stack(numEntries, 0)
+  ,top(0)
+{
+  assert(numEntries > 0);
+}
+
+void RAS::push(uint32_t addr)
+{
+  top = (top + 1) % stack.size();
+  stack[top] = addr;
+}
+
+uint32_t RAS::pop()
+{
+  uint32_t addr = stack[top];
+  top = (top + stack.size() - 1) % stack.size();
+  return addr;
+}
+
+// BranchUnit
+
+BranchUnit::BranchUnit(const char *s)
+  : name(s)
+  ,condBranches("condBranches")
+  ,condMispredicts("condMispredicts")
+  ,jumps("jumps")
+  ,returns("returns")
+  ,returnMispredicts("returnMispredicts")
+  ,indirects("indirects")
+  ,indirectMispredicts("indirectMispredicts")
+  ,btbMisses("btbMisses")
+  ,wrongPathFetches("wrongPathFetches")
+{
+  GError *error = NULL;
+
+  assert(config && config->keyfile);
+
+  gchar *type = g_key_file_get_string(config->keyfile, s, "type", &error);
+  if(error != NULL) g_error (error->message);
+
+  int tableBits = getIntegerOr(s, "tableBits", 12);
+  assert(tableBits > 0 && tableBits < 31);
+  if(strcasecmp(type, "bimodal") == 0) {
+    dirPred = new BimodalPredictor(tableBits);
+  } else if(strcasecmp(type, "gshare") == 0) {
+    dirPred = new GsharePredictor(tableBits, getIntegerOr(s, "historyBits", tableBits));
+  } else if(strcasecmp(type, "tage") == 0) {
+    // The tagged tables have a quarter of the base predictor's counters
+    assert(tableBits > 2);
+    dirPred = new TagePredictor(getIntegerOr(s, "tageTables", 4), tableBits - 2,
+                                getIntegerOr(s, "tageMinHist", 4), getIntegerOr(s, "tageMaxHist", 64));
+  } else {
+    assert(0);
+  }
+  g_free(type);
+
+  btb = new BTB(getIntegerOr(s, "btbEntries", 512), getIntegerOr(s, "btbAssoc", 4));
+  ras = new RAS(getIntegerOr(s, "rasEntries", 16));
+  decodePenalty = getIntegerOr(s, "decodePenalty", 1);
+  executePenalty = getIntegerOr(s, "executePenalty", 2);
+  callDistance = getIntegerOr(s, "callDistance", 256);
+
+  wrongPathFetch = true;
+  if(g_key_file_has_key(config->keyfile, s, "wrongPathFetch", NULL)) {
+    wrongPathFetch = g_key_file_get_boolean(config->keyfile, s, "wrongPathFetch", NULL);
+  }
+}
+
+BranchUnit::~BranchUnit()
+{
+  delete dirPred;
+  delete btb;
+  delete ras;
+}
+
+BranchOutcome BranchUnit::predictAndUpdate(uint32_t pc, BranchKind kind, bool taken, uint32_t target, uint32_t *predPC)
+{
+  uint32_t btbTarget = 0;
+  bool btbHit = btb->lookup(pc, &btbTarget);
+  BranchOutcome outcome = BranchCorrect;
+
+  *predPC = pc + 4;
+  switch(kind) {
+    case BranchCond: {
+      condBranches.inc();
+      bool predTaken = dirPred->predict(pc);
+      dirPred->update(pc, taken);
+      if(predTaken != taken) condMispredicts.inc();
+      // A branch predicted taken can only redirect fetch if it hits in the BTB
+      if(predTaken && btbHit) *predPC = btbTarget;
+      if(taken) {
+        if(!predTaken) {
+          outcome = BranchExecuteRedirect;
+        } else if(!btbHit || btbTarget != target) {
+          btbMisses.inc();
+          outcome = BranchDecodeRedirect;
+        }
+        btb->update(pc, target);
+      } else if(predTaken && btbHit) {
+        outcome = BranchExecuteRedirect;
+      }
+      break;
+    }
+    case BranchJump:
+      jumps.inc();
+      if(btbHit) *predPC = btbTarget;
+      if(!btbHit || btbTarget != target) {
+        btbMisses.inc();
+        outcome = BranchDecodeRedirect;
+      }
+      btb->update(pc, target);
+      if(target > pc + callDistance || target + callDistance < pc) {
+        ras->push(pc + 4);
+      }
+      break;
+    case BranchReturn:
+      returns.inc();
+      *predPC = ras->pop();
+      if(*predPC != target) {
+        returnMispredicts.inc();
+        outcome = BranchExecuteRedirect;
+      }
+      break;
+    case BranchIndirect:
+      indirects.inc();
+      if(btbHit) *predPC = btbTarget;
+      if(!btbHit || btbTarget != target) {
+        indirectMispredicts.inc();
+        outcome = BranchExecuteRedirect;
+      }
+      btb->update(pc, target);
+      break;
+    default:
+      assert(0);
+  }
+  return outcome;
+}
+
+// Get string that describes the branch unit
+std::string BranchUnit::toString() const
+{
+  std::string ret;
+  ret += "[" + name + "]\n";
+  ret += dirPred->toString();
+  ret += "btb = " + std::to_string(btb->getNumEntries()) + " entries, " + std::to_string(btb->getAssoc()) + "-way\n";
+  ret += "ras = " + std::to_string(ras->getNumEntries()) + " entries\n";
+  ret += "decode redirect penalty = " + std::to_string(decodePenalty) + "\n";
+  ret += "execute redirect penalty = " + std::to_string(executePenalty) + "\n";
+  ret += std::string("wrong path fetch = ") + (wrongPathFetch ? "true" : "false") + "\n";
+  return ret;
+}
+
+// Get string that summarizes prediction statistics
+std::string BranchUnit::getStatString() const
+{
+  std::string ret;
+  ret += name + ":";
+  ret += condBranches.toString() + ":";
+  ret += condMispredicts.toString() + ":";
+  ret += jumps.toString() + ":";
+  ret += btbMisses.toString() + ":";
+  ret += returns.toString() + ":";
+  ret += returnMispredicts.toString() + ":";
+  ret += indirects.toString() + ":";
+  ret += indirectMispredicts.toString() + ":";
+  ret += wrongPathFetches.toString();
+  return ret;
+}
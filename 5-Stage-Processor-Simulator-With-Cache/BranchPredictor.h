@@ -0,0 +1,273 @@
+#ifndef BRANCHPREDICTOR_H
+#define BRANCHPREDICTOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Counter.h"
+
+/** The kinds of control transfer seen by the branch unit. */
+enum BranchKind {
+  BranchCond = 0,   // ti_BRANCH: conditional, direct target
+  BranchJump,       // ti_JTYPE: unconditional, direct target
+  BranchReturn,     // ti_JRTYPE through $ra: predicted by the RAS
+  BranchIndirect    // other ti_JRTYPE: predicted by the BTB
+};
+
+/** Where, if anywhere, the front end had to be redirected. */
+enum BranchOutcome {
+  BranchCorrect = 0,    // fetch continued down the right path
+  BranchDecodeRedirect, // direct target unknown to the BTB, fixed in ID
+  BranchExecuteRedirect // wrong direction or indirect target, fixed in EX
+};
+
+/** @brief A conditional branch direction predictor.
+ *
+ * Provides only abstract interfaces for predict and update so can't be
+ * instantiated.  Children classes BimodalPredictor, GsharePredictor, and
+ * TagePredictor implement them respectively.  predict is always called
+ * before update for the same branch.
+ */
+class DirectionPredictor {
+  public:
+    virtual ~DirectionPredictor() {}
+
+    /** Returns true if the branch at pc is predicted taken. */
+    virtual bool predict(uint32_t pc) = 0;
+    /** Trains the predictor with the actual direction of the branch at pc
+     * and shifts the outcome into any global history. */
+    virtual void update(uint32_t pc, bool taken) = 0;
+    /** Returns a string that describes the predictor */
+    virtual std::string toString() const = 0;
+};
+
+/** @brief A table of 2-bit saturating counters indexed by PC. */
+class BimodalPredictor : public DirectionPredictor {
+  protected:
+    std::vector<uint8_t> table;
+    uint32_t indexMask;
+
+  public:
+    /** @param tableBits - log2 of the number of counters */
+    BimodalPredictor(uint32_t tableBits);
+
+    bool predict(uint32_t pc);
+    void update(uint32_t pc, bool taken);
+    std::string toString() const;
+};
+
+/** @brief A table of 2-bit saturating counters indexed by PC XOR global
+ * history. */
+class GsharePredictor : public DirectionPredictor {
+  protected:
+    std::vector<uint8_t> table;
+    uint32_t indexMask;
+    uint32_t historyBits;
+    uint32_t history;
+
+    uint32_t calcIndex(uint32_t pc) const {
+      // Shift in 64 bits so that historyBits = 32 keeps the whole history
+      return ((pc >> 2) ^ (history & (uint32_t)((1ull << historyBits) - 1))) & indexMask;
+    }
+
+  public:
+    /** @param tableBits - log2 of the number of counters
+     *  @param historyBits - number of global history bits (at most 32) */
+    GsharePredictor(uint32_t tableBits, uint32_t historyBits);
+
+    bool predict(uint32_t pc);
+    void update(uint32_t pc, bool taken);
+    std::string toString() const;
+};
+
+/** @brief A small TAGE: a bimodal base predictor backed by tagged tables
+ * indexed with geometrically increasing global history lengths.
+ *
+ * The longest matching table provides the prediction.  On a misprediction
+ * a new entry is allocated in a longer table whose useful bits are clear.
+ * Long histories are folded into index and tag widths incrementally as in
+ * Seznec's reference implementation.
+ */
+class TagePredictor : public DirectionPredictor {
+  protected:
+    /** A history of origLength bits folded down to compLength bits */
+    struct FoldedHistory {
+      uint32_t comp;
+      uint32_t compLength;
+      uint32_t origLength;
+      uint32_t outPoint;
+
+      void init(uint32_t orig, uint32_t length) {
+        comp = 0;
+        origLength = orig;
+        compLength = length;
+        outPoint = orig % length;
+      }
+      void update(const std::vector<uint8_t> &ghist, uint32_t ptr);
+    };
+
+    struct TageEntry {
+      bool valid;    // set once the entry is allocated
+      int8_t ctr;    // 3-bit signed counter, taken if >= 0
+      uint16_t tag;
+      uint8_t u;     // 2-bit useful counter
+    };
+
+    BimodalPredictor base;
+    uint32_t numTables;
+    uint32_t tableBits;
+    uint32_t tagBits;
+    std::vector<uint32_t> histLengths;
+    std::vector<std::vector<TageEntry> > tables;
+    std::vector<FoldedHistory> indexHist;
+    std::vector<FoldedHistory> tagHist[2];
+
+    /** Circular global history buffer, newest bit at ghistPtr */
+    std::vector<uint8_t> ghist;
+    uint32_t ghistPtr;
+    uint32_t pathHist;
+    uint32_t branchCount;
+
+    // Lookup results carried from predict to update
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> tags;
+    int provider;
+    int altProvider;
+    bool providerPred;
+    bool altPred;
+    bool basePred;
+
+    uint32_t calcIndex(uint32_t pc, uint32_t table) const;
+    uint16_t calcTag(uint32_t pc, uint32_t table) const;
+
+  public:
+    /** @param numTables - number of tagged tables
+     *  @param tableBits - log2 of the entries in each table
+     *  @param minHist - history length of the shortest tagged table
+     *  @param maxHist - history length of the longest tagged table */
+    TagePredictor(uint32_t numTables, uint32_t tableBits, uint32_t minHist, uint32_t maxHist);
+
+    bool predict(uint32_t pc);
+    void update(uint32_t pc, bool taken);
+    std::string toString() const;
+};
+
+/** @brief A set-associative branch target buffer with LRU replacement. */
+class BTB {
+  protected:
+    struct BTBEntry {
+      bool valid;
+      uint32_t tag;
+      uint32_t target;
+      uint32_t age;
+    };
+
+    std::vector<BTBEntry> entries;
+    uint32_t assoc;
+    uint32_t numSets;
+
+  public:
+    /** @param numEntries - total entries (a power of 2)
+     *  @param assoc - entries per set */
+    BTB(uint32_t numEntries, uint32_t assoc);
+
+    /** Returns true and sets *target if pc hits in the BTB. */
+    bool lookup(uint32_t pc, uint32_t *target);
+    /** Installs or refreshes the target for pc. */
+    void update(uint32_t pc, uint32_t target);
+
+    uint32_t getNumEntries() const { return entries.size(); }
+    uint32_t getAssoc() const { return assoc; }
+};
+
+/** @brief A circular return address stack.  Overflow overwrites the
+ * oldest entry and underflow returns whatever is left in the slot. */
+class RAS {
+  protected:
+    std::vector<uint32_t> stack;
+    uint32_t top;
+
+  public:
+    /** @param numEntries - depth of the stack */
+    RAS(uint32_t numEntries);
+
+    void push(uint32_t addr);
+    uint32_t pop();
+
+    uint32_t getNumEntries() const { return stack.size(); }
+};
+
+/** @brief The front end branch unit for the pipeline.
+ *
+ * Combines a direction predictor, a BTB and a RAS.  It is configured from a
+ * named section of the config file, the same way memory objects are.  The
+ * [pipeline] section names it with the branchPredictor key.
+ */
+class BranchUnit {
+  protected:
+    /** The name of the branch unit on the config file */
+    std::string name;
+    DirectionPredictor *dirPred;
+    BTB *btb;
+    RAS *ras;
+
+    /** Bubbles for a redirect from ID (direct target missing in the BTB) */
+    uint32_t decodePenalty;
+    /** Bubbles for a redirect from EX (wrong direction or indirect target) */
+    uint32_t executePenalty;
+    /** Whether the bubbles fetch down the wrong path (polluting the IL1) */
+    bool wrongPathFetch;
+    /** Jumps further than this many bytes are treated as calls (pushed on
+     * the RAS), since the trace does not tell j from jal */
+    uint32_t callDistance;
+
+    // BEGIN Statistics
+    Counter condBranches;
+    Counter condMispredicts;
+    Counter jumps;
+    Counter returns;
+    Counter returnMispredicts;
+    Counter indirects;
+    Counter indirectMispredicts;
+    Counter btbMisses;
+    Counter wrongPathFetches;
+    // END Statistics
+
+  public:
+    /** Constructor.  Reads in the predictor type and the BTB, RAS and
+     * penalty parameters from the named section of the config file.
+     *
+     * @param name - The name of the branch unit on the config file.
+     */
+    BranchUnit(const char *name);
+    ~BranchUnit();
+
+    /** Predicts the control transfer at pc as the fetch unit would, then
+     * trains every structure with the actual outcome.
+     *
+     * @param pc - The PC of the branch or jump
+     * @param kind - The kind of control transfer
+     * @param taken - Whether it was actually taken
+     * @param target - The actual target
+     * @param predPC - Set to the PC fetch would have continued at
+     *
+     * @return Where the front end had to be redirected, if anywhere
+     */
+    BranchOutcome predictAndUpdate(uint32_t pc, BranchKind kind, bool taken, uint32_t target, uint32_t *predPC);
+
+    /** Returns the number of bubbles for the given outcome */
+    uint32_t getPenalty(BranchOutcome outcome) const {
+      return outcome == BranchDecodeRedirect ? decodePenalty :
+             outcome == BranchExecuteRedirect ? executePenalty : 0;
+    }
+
+    bool isWrongPathFetch() const { return wrongPathFetch; }
+    void addWrongPathFetches(int n) { wrongPathFetches.add(n); }
+
+    /** Returns a string that describes the branch unit */
+    std::string toString() const;
+    /** Returns a string that summarizes prediction statistics */
+    std::string getStatString() const;
+};
+
+#endif // BRANCHPREDICTOR_H
@@ -14,11 +14,17 @@
 unsigned int cycle_number = 0;
 unsigned int inst_number = 0;
 unsigned int mem_stall_cycles = 0;
+unsigned int branch_stall_cycles = 0;
 
-std::deque<dynamic_inst> IF, ID, WB;
+Latch<dynamic_inst, MAX_WIDTH> IF, ID, WB;
 dynamic_inst EX_ALU = {0}, MEM_ALU = {0};
 dynamic_inst EX_lwsw = {0}, MEM_lwsw = {0};
 
+/* CPI stack.  Issue charges its empty slots to why it stopped; when it ran out
+ * of instructions in ID, that is why fetch did not supply more. */
+unsigned long long lost_slots[NUM_STALL_CAUSES];
+static stall_cause fetch_cause = STALL_DRAIN, decode_cause = STALL_DRAIN;
+
 bool is_ALU(dynamic_inst dinst) {
   instruction inst = dinst.inst;
   return inst.type != ti_NOP && inst.type != ti_LOAD && inst.type != ti_STORE;
@@ -62,9 +68,11 @@ void handle_memory_access(dynamic_inst dinst, bool isDataAccess)
       assert(MEM_lwsw.inst.type == ti_STORE);
       mreq = new MemRequest(dinst.inst.Addr, MemWrite);
     }
+    mreq->setPC(dinst.inst.PC);
     config->dataSource->access(mreq);
   } else {
     mreq = new MemRequest(dinst.inst.PC, MemRead);
+    mreq->setPC(dinst.inst.PC);
     config->instSource->access(mreq);
   }
   assert(mreq->getLatency() > 0);
@@ -80,6 +88,18 @@ void handle_memory_access(dynamic_inst dinst, bool isDataAccess)
     // One cycle delay is already accounted for.  So subtract that.
     stall_cycles = mreq->getLatency() - 1;
   }
+  // Charge the stall to the memory objects on the request's path, each for
+  // the latency it added.  The first cycle of the first one is not a stall.
+  if (stall_cycles > 0) {
+    uint32_t charged = 0;
+    for (int i = 0; i < mreq->getPathLength(); i++) {
+      uint32_t lat = mreq->getPathLatency(i) - (i == 0);
+      mreq->getPathObj(i)->addStallCycles(lat);
+      charged += lat;
+    }
+    assert(charged == (uint32_t)stall_cycles);
+  }
+
   // Delete memory request.  Remember C++ does not have garbage collection!
   delete mreq;
 
@@ -94,6 +114,71 @@ void handle_memory_access(dynamic_inst dinst, bool isDataAccess)
   mem_stall_cycles += stall_cycles;
 }
 
+bool is_control(dynamic_inst dinst) {
+  instruction inst = dinst.inst;
+  return inst.type == ti_BRANCH || inst.type == ti_JTYPE || inst.type == ti_JRTYPE;
+}
+
+/* Runs a fetched branch or jump through the branch unit and inserts the
+ * bubbles for a front end redirect, if there is one.  While the bubbles
+ * drain, fetch continues down the predicted (wrong) path.  Those accesses
+ * still go through the instruction cache and may displace blocks, but their
+ * latency overlaps with the bubbles since they are squashed on the redirect.
+ * Returns the number of bubbles inserted. */
+int handle_branch(dynamic_inst dinst)
+{
+  instruction inst = dinst.inst;
+  BranchKind kind;
+  bool taken = true;
+
+  switch (inst.type) {
+    case ti_BRANCH:
+      kind = BranchCond;
+      taken = inst.Addr != inst.PC + 4;
+      break;
+    case ti_JTYPE:
+      kind = BranchJump;
+      break;
+    case ti_JRTYPE:
+      kind = inst.sReg_a == 31 ? BranchReturn : BranchIndirect;
+      break;
+    default:
+      assert(0);
+      return 0;
+  }
+
+  uint32_t predPC;
+  BranchOutcome outcome = config->branchUnit->predictAndUpdate(inst.PC, kind, taken, taken ? inst.Addr : inst.PC + 4, &predPC);
+  int bubbles = config->branchUnit->getPenalty(outcome);
+  if (bubbles == 0) return 0;
+
+  if (verbose) {
+    printf("[BP CYCLE: %d] %s redirected from %s\n", cycle_number, get_instruction_string(dinst, ADDR_ONLY),
+           outcome == BranchDecodeRedirect ? "ID" : "EX");
+  }
+
+  if (config->branchUnit->isWrongPathFetch()) {
+    int n = bubbles * config->pipelineWidth;
+    for (int i = 0; i < n; i++) {
+      MemRequest *mreq = new MemRequest(predPC + 4 * i, MemRead);
+      mreq->setPC(predPC + 4 * i);
+      config->instSource->access(mreq);
+      delete mreq;
+    }
+    config->branchUnit->addWrongPathFetches(n);
+  }
+
+  if (verbose) {
+    printf("CYCLE: %d -> %d\n", cycle_number, cycle_number + bubbles);
+  }
+
+  fetch_cause = outcome == BranchDecodeRedirect ? STALL_BTB_MISS : STALL_MISPREDICT;
+  lost_slots[fetch_cause] += (unsigned long long)bubbles * config->pipelineWidth;
+  cycle_number += bubbles;
+  branch_stall_cycles += bubbles;
+  return bubbles;
+}
+
 bool is_finished()
 {
   /* Finished when pipeline is completely empty */
@@ -147,15 +232,18 @@ int issue()
 {
   /* in-order issue */
   int insts = 0;
+  stall_cause cause = decode_cause;
   while (ID.size() > 0) {
     if (is_ALU(ID.front())) {
       if (!is_NOP(EX_ALU)) {
+        cause = STALL_UNITS;
         break;;
       }
       EX_ALU = ID.front();
       ID.pop_front();
     } else if (is_lwsw(ID.front())) {
       if (!is_NOP(EX_lwsw)) {
+        cause = STALL_UNITS;
         break;;
       }
       EX_lwsw = ID.front();
@@ -165,6 +253,7 @@ int issue()
     }
     insts++;
   }
+  lost_slots[cause] += config->pipelineWidth - insts;
   return insts;
 }
 
@@ -176,6 +265,9 @@ int decode()
     IF.pop_front();
     insts++;
   }
+  if ((int)ID.size() < config->pipelineWidth) {
+    decode_cause = fetch_cause;
+  }
   return insts;
 }
 
@@ -196,7 +288,13 @@ int fetch()
       insts++;
       /* Insert instruction fetch stalls */
       handle_memory_access(dinst, false);
+      /* Insert control hazard stalls.  Nothing more is fetched this cycle
+       * after a redirect. */
+      if (config->branchUnit && is_control(dinst) && handle_branch(dinst) > 0) {
+        break;
+      }
     } else {
+      fetch_cause = STALL_DRAIN;
       break;
     }
   }
@@ -266,3 +364,29 @@ void print_pipeline()
   printf("=================================================================================\n");
 }
 
+/* Prints the CPI, split into the base CPI of a full-width pipeline, the share
+ * of each cause of lost issue slots, and the share of each memory object */
+void print_cpi_stack()
+{
+  static const char *names[NUM_STALL_CAUSES] = {
+    "Pipeline fill/drain",
+    "Structural: EX units",
+    "Control: BTB miss",
+    "Control: mispredict",
+  };
+  double slots = (double)config->pipelineWidth * inst_number;
+
+  if (inst_number == 0) return;
+  printf("+ CPI stack (%d issue slots per cycle) :\n", config->pipelineWidth);
+  printf("+   %-28s : %0.4f\n", "Base", inst_number / slots);
+  for (int i = 0; i < NUM_STALL_CAUSES; i++) {
+    printf("+   %-28s : %0.4f (%llu slots)\n", names[i], lost_slots[i] / slots, lost_slots[i]);
+  }
+  std::vector<MemObj*> objs = MemObj::getAll();
+  for (size_t i = 0; i < objs.size(); i++) {
+    unsigned long long lost = objs[i]->getStallCycles() * config->pipelineWidth;
+    std::string name = "Memory: " + objs[i]->getName();
+    printf("+   %-28s : %0.4f (%llu slots)\n", name.c_str(), lost / slots, lost);
+  }
+  printf("+   %-28s : %0.4f\n", "Total", (float)cycle_number / (float)inst_number);
+}
@@ -1,8 +1,8 @@
 #ifndef CPU_H
 #define CPU_H
 
-#include <deque>
 #include "config.h"
+#include "Latch.h"
 
 enum opcode {
 	ti_NOP = 0,
@@ -33,8 +33,24 @@ typedef struct {
 extern unsigned int cycle_number;
 extern unsigned int inst_number;
 extern unsigned int mem_stall_cycles;
+extern unsigned int branch_stall_cycles;
 
-extern std::deque<dynamic_inst> IF, ID, WB;
+/* Causes that an issue slot can be lost to, for the CPI stack.  Every cycle
+ * has pipelineWidth issue slots and each one not filled with an instruction
+ * is charged to exactly one cause.  Cycles the pipeline stalls on memory are
+ * charged to the memory objects that added the latency instead (see
+ * MemObj::getStallCycles). */
+typedef enum {
+  STALL_DRAIN = 0,      // filling the pipeline at the start, draining at the end
+  STALL_UNITS,          // the ALU or load/store unit is already taken
+  STALL_BTB_MISS,       // front end redirected in ID, direct target not in BTB
+  STALL_MISPREDICT,     // front end redirected in EX, wrong direction or target
+  NUM_STALL_CAUSES
+} stall_cause;
+
+extern unsigned long long lost_slots[NUM_STALL_CAUSES];
+
+extern Latch<dynamic_inst, MAX_WIDTH> IF, ID, WB;
 extern dynamic_inst EX_ALU, MEM_ALU;
 extern dynamic_inst EX_lwsw, MEM_lwsw;
 
@@ -50,5 +66,6 @@ int fetch();
 
 /* Output related functions */
 void print_pipeline();
+void print_cpi_stack();
 
 #endif /* #define CPU_H */
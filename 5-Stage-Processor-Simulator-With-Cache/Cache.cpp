@@ -35,19 +35,54 @@ Cache::Cache(const char *name)
   assert(bsize > 0);
   assert(pStr != NULL);
 
-  cacheCore = new CacheCore(size, assoc, bsize, pStr);
+  cacheCore = CacheCore::create(size, assoc, bsize, pStr);
 
   g_free(pStr);
+
+  // Miss profiling is enabled by a [missProfile] section.  It applies to the
+  // caches it lists, or to all caches if it has no caches key.
+  pcProfile = NULL;
+  regionProfile = NULL;
+  if(g_key_file_has_group(config->keyfile, "missProfile")) {
+    bool profiled = true;
+    gchar **caches = g_key_file_get_string_list(config->keyfile, "missProfile", "caches", NULL, NULL);
+    if(caches != NULL) {
+      profiled = false;
+      for(int i = 0; caches[i] != NULL; i++) {
+        if(!strcmp(g_strstrip(caches[i]), name)) profiled = true;
+      }
+      g_strfreev(caches);
+    }
+    if(profiled) {
+      int capacity = 64, topN = 10, bits = 12;
+      if(g_key_file_has_key(config->keyfile, "missProfile", "capacity", NULL))
+        capacity = g_key_file_get_integer(config->keyfile, "missProfile", "capacity", NULL);
+      if(g_key_file_has_key(config->keyfile, "missProfile", "topN", NULL))
+        topN = g_key_file_get_integer(config->keyfile, "missProfile", "topN", NULL);
+      if(g_key_file_has_key(config->keyfile, "missProfile", "regionBits", NULL))
+        bits = g_key_file_get_integer(config->keyfile, "missProfile", "regionBits", NULL);
+      assert(capacity > 0);
+      assert(topN > 0);
+      assert(bits >= 0 && bits < 32);
+
+      pcProfile = new SpaceSaving((getName() + " misses by PC").c_str(), capacity);
+      regionProfile = new SpaceSaving((getName() + " misses by " + std::to_string(1u << bits) + "B region").c_str(), capacity);
+      regionBits = bits;
+      profileTopN = topN;
+    }
+  }
 }
 
 Cache::~Cache()
 {
   delete cacheCore;
+  delete pcProfile;
+  delete regionProfile;
 }
 
 void Cache::access(MemRequest *mreq)
 {
-  mreq->addLatency(hitDelay);
+  mreq->addLatency(hitDelay, this);
 
   if(verbose) {
     const char *memOp;
@@ -111,6 +146,16 @@ std::string Cache::getContentString() const
   return ret;
 }
 
+// Get string that reports the top PCs and regions by miss count
+std::string Cache::getProfileString() const
+{
+  if(!pcProfile) return "";
+  std::string ret;
+  ret += pcProfile->toString(profileTopN, "PC");
+  ret += regionProfile->toString(profileTopN, "region", 1u << regionBits);
+  return ret;
+}
+
 // WBCache: Write back cache.  Allocates a dirty block on write miss.
 
 WBCache::WBCache(const char *name)
@@ -137,10 +182,10 @@ void WBCache::read( MemRequest *mreq)
   else
   {
     readMisses.inc();
+    recordMiss(mreq);
     getLowerLevelMemObj()->access(mreq); 
     l = allocateLine(mreq->getAddr());
-    if ( !l || !l->isValid() )
-      __assert_fail("l && l->isValid()", "Cache.cpp", 0x95u, "virtual void WBCache::read(MemRequest*)");
+    assert(l && l->isValid());
   }
 }
 
@@ -161,11 +206,11 @@ void WBCache::write(MemRequest *mreq)
   else
   {
     writeMisses.inc();
+    recordMiss(mreq);
     mreq->mutateWriteToRead(); 
     getLowerLevelMemObj()->access(mreq); 
     la = allocateLine(mreq->getAddr());
-    if ( !la || !la->isValid() )
-      __assert_fail("l && l->isValid()", "Cache.cpp", 0xA6u, "virtual void WBCache::write(MemRequest*)");
+    assert(la && la->isValid());
     la->makeDirty();
   }
 }
@@ -183,8 +228,7 @@ void WBCache::writeBack(MemRequest *mreq)
   l = cacheCore->accessLine( Addr);
   if ( l )
   {
-    if ( !l->isValid() )
-      __assert_fail("l->isValid()", "Cache.cpp", 0xB4u, "virtual void WBCache::writeBack(MemRequest*)");
+    assert(l->isValid());
     l->makeDirty();
   }
   else
@@ -222,11 +266,11 @@ void WTCache::read(MemRequest *mreq)
   else
   {
     readMisses.inc();
+    recordMiss(mreq);
     getLowerLevelMemObj()->access(mreq); //! DEFAULT
     rplcAddr = 0;
     l = cacheCore->allocateLine(mreq->getAddr(), &rplcAddr);
-    if ( !l || !l->isValid() || rplcAddr )
-      __assert_fail("l && l->isValid() && rplcAddr == 0", "Cache.cpp", 0xD4u, "virtual void WTCache::read(MemRequest*)");
+    assert(l && l->isValid() && rplcAddr == 0);
   }
 }
 
@@ -236,8 +280,10 @@ void WTCache::write(MemRequest *mreq)
 {
   if (cacheCore->accessLine(mreq->getAddr()))
     writeHits.inc();
-  else
-    writeMisses.inc(); 
+  else {
+    writeMisses.inc();
+    recordMiss(mreq);
+  }
   getLowerLevelMemObj()->access(mreq);
 }
 
@@ -254,8 +300,7 @@ CacheLine* WBCache::allocateLine(unsigned int addr){ //add to header!
   MemRequest *mreq;
 
   l = cacheCore->allocateLine(addr, &rplcAddr);
-  if (!l || !l->isValid())
-    __assert_fail("l && l->isValid()", "Cache.cpp", 0x80u, "CacheLine* WBCache::allocateLine(uint32_t)");
+  assert(l && l->isValid());
   if (rplcAddr)
   {
     writeBacks.inc();
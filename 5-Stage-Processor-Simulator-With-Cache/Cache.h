@@ -5,6 +5,7 @@
 
 #include "CacheCore.h"
 #include "Counter.h"
+#include "SpaceSaving.h"
 #include "MemObj.h"
 #include "MemRequest.h"
 
@@ -30,6 +31,29 @@ class Cache: public MemObj
     Counter writeBacks;
     // END Statistics
 
+    // BEGIN Miss profiles (NULL unless listed in the [missProfile] section)
+    /** Misses keyed by the PC of the instruction that caused them */
+    SpaceSaving *pcProfile;
+    /** Misses keyed by address region */
+    SpaceSaving *regionProfile;
+    /** log2 of the region size */
+    uint32_t regionBits;
+    /** Number of entries to report from each profile */
+    uint32_t profileTopN;
+    // END Miss profiles
+
+    /** Attributes a read or write miss to its PC and address region if
+     * this cache is being profiled.
+     *
+     * @param mreq - The memory request that missed
+     */
+    void recordMiss(MemRequest *mreq) {
+      if(pcProfile) {
+        pcProfile->add(mreq->getPC());
+        regionProfile->add(mreq->getAddr() >> regionBits);
+      }
+    }
+
     /** Handler for read memory requests.
      *
      * @param mreq - The memory request
@@ -61,6 +85,13 @@ class Cache: public MemObj
     /** Returns the write policy, either "WB" or "WT" */
     virtual std::string getWritePolicy() const = 0;
 
+    /** Returns the associativity of the cache block array */
+    uint32_t getAssoc() const { return cacheCore->getNumWays(); }
+    /** Returns the mask of ways new blocks may be allocated in */
+    uint32_t getWayMask() const { return cacheCore->getWayMask(); }
+    /** Restricts block allocation to the ways set in mask */
+    void setWayMask(uint32_t mask) { cacheCore->setWayMask(mask); }
+
     /** Accesses memory object with memory request.  Adds the hitDelay to
      * the memory request latency and calls read, write, or writeBack
      * depending on the memory request type.
@@ -74,8 +105,9 @@ class Cache: public MemObj
     std::string getStatString() const;
     /** Returns a string that dumps all valid lines in cache */
     std::string getContentString() const;
+    /** Returns a string with the top PCs and regions by miss count */
+    std::string getProfileString() const;
 
-    
 };
 
 /** @brief <B>TODO</B>: A write back cache.
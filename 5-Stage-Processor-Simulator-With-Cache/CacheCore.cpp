@@ -11,6 +11,11 @@ CacheCore::CacheCore(uint32_t s, uint32_t a, uint32_t b, const char *pStr)
   ,lineSize(b)
   ,assoc(a)
   ,numLines(s/b)
+  ,lineBits(log2i(b))
+  ,rowBits(log2i(s/b/a))
+  ,assocBits(log2i(a))
+  ,rowMask(s/b/a - 1)
+  ,wayMask(~0u)
 {
   if (strcasecmp(pStr, "RANDOM") == 0)
     policy = RANDOM;
@@ -34,14 +39,12 @@ CacheCore::~CacheCore() {
 // TODO: Implement
 CacheLine *CacheCore::accessLine(uint32_t addr)
 {
-  CacheLine *l;
-  uint32_t tag;
-  uint32_t i;
+  uint32_t tag = calcTag4Addr(addr);
+  uint32_t index = calcIndex4Addr(addr);
   CacheLine *lineHit = NULL;
 
-  tag = calcTag4Addr(addr);
-  for(i = calcIndex4Addr(addr); i < assoc+calcIndex4Addr(addr); i++) {
-    l = &content[i];
+  for(uint32_t i = index; i < index + assoc; i++) {
+    CacheLine *l = &content[i];
     l->incAge();
     if (l->isValid() && l->getTag() == tag){
       lineHit = l;
@@ -51,53 +54,39 @@ CacheLine *CacheCore::accessLine(uint32_t addr)
   return lineHit;
 }
 
-
-
-
 // TODO: Implement
 CacheLine *CacheCore::allocateLine(uint32_t addr, uint32_t *rplcAddr)
 {
-  uint32_t Age; // ebx
-  CacheLine *l_0; // [rsp+20h] [rbp-40h]
-  CacheLine *l; // [rsp+28h] [rbp-38h]
-  uint32_t tag; // [rsp+34h] [rbp-2Ch]
-  uint32_t i_0; // [rsp+38h] [rbp-28h]
-  uint32_t indexOldest; // [rsp+3Ch] [rbp-24h]
-  CacheLine *lineOldest; // [rsp+40h] [rbp-20h]
-  uint32_t i; // [rsp+4Ch] [rbp-14h]
+  uint32_t tag = calcTag4Addr(addr);
+  uint32_t index = calcIndex4Addr(addr);
 
-  tag = calcTag4Addr(addr);
-  for ( i = calcIndex4Addr(addr); assoc + calcIndex4Addr(addr) > i; ++i )
-  {
-    l = &content[i];
-    if ( !l->isValid() )
-    {
+  // Use the first invalid block if there is one
+  for(uint32_t i = index; i < index + assoc; i++) {
+    CacheLine *l = &content[i];
+    if (isWayAllowed(index2Column(i)) && !l->isValid()) {
       l->initialize();
       l->validate();
       l->setTag(tag);
       return l;
     }
   }
-  lineOldest = 0LL;
-  indexOldest = 0;
-  for ( i_0 = calcIndex4Addr(addr); assoc + calcIndex4Addr(addr) > i_0; ++i_0 )
-  {
-    l_0 = &content[i_0];
-    if ( !l_0->isValid() )
-      __assert_fail("l->isValid()", "CacheCore.cpp", 0x4Bu, "CacheLine* CacheCore::allocateLine(uint32_t, uint32_t*)");
-    if ( lineOldest )
-    {
-      Age = lineOldest->getAge();
-      if ( Age >= l_0->getAge() )
-        continue;
+
+  // Otherwise replace the oldest block
+  CacheLine *lineOldest = NULL;
+  uint32_t indexOldest = 0;
+  for(uint32_t i = index; i < index + assoc; i++) {
+    CacheLine *l = &content[i];
+    if (!isWayAllowed(index2Column(i)))
+      continue;
+    assert(l->isValid());
+    if (!lineOldest || l->getAge() > lineOldest->getAge()) {
+      lineOldest = l;
+      indexOldest = i;
     }
-    lineOldest = l_0;
-    indexOldest = i_0;
   }
-  if ( !rplcAddr )
-    __assert_fail("rplcAddr", "CacheCore.cpp", 0x53u, "CacheLine* CacheCore::allocateLine(uint32_t, uint32_t*)");
-  if ( lineOldest->isDirty() )
-  {
+  assert(lineOldest);
+  assert(rplcAddr);
+  if (lineOldest->isDirty()) {
     *rplcAddr = calcAddr(lineOldest->getTag(), indexOldest);
   }
   lineOldest->initialize();
@@ -106,3 +95,47 @@ CacheLine *CacheCore::allocateLine(uint32_t addr, uint32_t *rplcAddr)
   return lineOldest;
 }
 
+// Dispatch to a FixedCacheCore on the number of rows, then the associativity,
+// then the block size.  Returns NULL if the geometry is not one of these.
+
+template<uint32_t Ways, uint32_t LineBits>
+static CacheCore *createFixed(uint32_t sets, const char *pStr)
+{
+  switch(sets) {
+    case 1:    return new FixedCacheCore<1, Ways, LineBits>(pStr);
+    case 16:   return new FixedCacheCore<16, Ways, LineBits>(pStr);
+    case 32:   return new FixedCacheCore<32, Ways, LineBits>(pStr);
+    case 64:   return new FixedCacheCore<64, Ways, LineBits>(pStr);
+    case 128:  return new FixedCacheCore<128, Ways, LineBits>(pStr);
+    case 256:  return new FixedCacheCore<256, Ways, LineBits>(pStr);
+    case 512:  return new FixedCacheCore<512, Ways, LineBits>(pStr);
+    case 1024: return new FixedCacheCore<1024, Ways, LineBits>(pStr);
+    case 2048: return new FixedCacheCore<2048, Ways, LineBits>(pStr);
+    case 4096: return new FixedCacheCore<4096, Ways, LineBits>(pStr);
+    default:   return NULL;
+  }
+}
+
+template<uint32_t LineBits>
+static CacheCore *createFixed(uint32_t sets, uint32_t ways, const char *pStr)
+{
+  switch(ways) {
+    case 1:  return createFixed<1, LineBits>(sets, pStr);
+    case 2:  return createFixed<2, LineBits>(sets, pStr);
+    case 4:  return createFixed<4, LineBits>(sets, pStr);
+    case 8:  return createFixed<8, LineBits>(sets, pStr);
+    case 16: return createFixed<16, LineBits>(sets, pStr);
+    default: return NULL;
+  }
+}
+
+CacheCore *CacheCore::create(uint32_t s, uint32_t a, uint32_t b, const char *pStr)
+{
+  CacheCore *core = NULL;
+  if (a > 0 && b > 0 && s % (a * b) == 0) {
+    uint32_t sets = s / b / a;
+    if (b == 32) core = createFixed<5>(sets, a, pStr);
+    else if (b == 64) core = createFixed<6>(sets, a, pStr);
+  }
+  return core ? core : new CacheCore(s, a, b, pStr);
+}
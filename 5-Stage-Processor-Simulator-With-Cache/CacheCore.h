@@ -33,6 +33,16 @@ class CacheCore {
     const uint32_t  assoc;
     /** The number of cache blocks */
     const uint32_t  numLines;
+    /** log2 of the cache block size */
+    const uint32_t  lineBits;
+    /** log2 of the number of rows (sets) */
+    const uint32_t  rowBits;
+    /** log2 of the associativity */
+    const uint32_t  assocBits;
+    /** Mask that selects the row bits after shifting out the block offset */
+    const uint32_t  rowMask;
+    /** The ways (columns) allocateLine may choose from, one bit per way */
+    uint32_t  wayMask;
 
   protected:
 
@@ -45,11 +55,12 @@ class CacheCore {
     /** Returns the number of cache blcoks. */
     uint32_t  getNumLines() const   { return numLines;    }
 
-    uint32_t calcTag4Addr(uint32_t addr){return addr >> log2i(lineSize) >> log2i(size/lineSize/assoc);}
-    uint32_t calcIndex4Addr(uint32_t addr){return calcRow4Addr(addr) << log2i(assoc);}
-    uint32_t calcRow4Addr(uint32_t addr){return addr >> log2i(lineSize) & (size/lineSize/assoc-1);}
-    uint32_t calcAddr(uint32_t tag, uint32_t index){return ((tag <<log2i(size/lineSize/assoc)) + (index >> log2i(assoc))) << 
-    log2i(lineSize);}
+    // The shifts and masks are computed once in the constructor since these
+    // are called on every access.
+    uint32_t calcTag4Addr(uint32_t addr) const {return addr >> lineBits >> rowBits;}
+    uint32_t calcIndex4Addr(uint32_t addr) const {return calcRow4Addr(addr) << assocBits;}
+    uint32_t calcRow4Addr(uint32_t addr) const {return addr >> lineBits & rowMask;}
+    uint32_t calcAddr(uint32_t tag, uint32_t index) const {return ((tag << rowBits) + (index >> assocBits)) << lineBits;}
 
     /** <B>TODO</B>: Returns the row for the given content array index.<br>
      * Content index = row * associativity + column<br>
@@ -60,7 +71,7 @@ class CacheCore {
      * @return The corresponding row number
      */
     uint32_t index2Row(uint32_t index) const {
-      return index >> log2i(assoc);
+      return index >> assocBits;
     }
 
     /** <B>TODO</B>: Returns the column for the given content array index.<br>
@@ -75,6 +86,15 @@ class CacheCore {
       return index & (assoc - 1);
     }
 
+    /** Returns whether allocateLine may place a block in the given column.
+     * Columns beyond the width of wayMask are always allowed.
+     *
+     * @param column - The column (way) within a row
+     */
+    bool isWayAllowed(uint32_t column) const {
+      return column >= 32 || ((wayMask >> column) & 1);
+    }
+
   public:
 
     /** Constructor.
@@ -88,6 +108,20 @@ class CacheCore {
 
     virtual ~CacheCore();
 
+    /** Creates a cache block array for the given geometry.  Common power of
+     * 2 geometries get a FixedCacheCore specialized for them, and everything
+     * else gets a plain CacheCore.  Parameters are as in the constructor.
+     */
+    static CacheCore *create(uint32_t s, uint32_t a, uint32_t b, const char *pStr);
+
+    /** Returns the associativity. */
+    uint32_t  getNumWays() const    { return assoc;       }
+    /** Returns the mask of ways allocateLine may choose from. */
+    uint32_t  getWayMask() const    { return wayMask;     }
+    /** Restricts allocateLine to the ways set in mask (way partitioning).
+     * accessLine still searches every way of the row. */
+    void      setWayMask(uint32_t mask) { wayMask = mask; }
+
     /** Returns a string that describes the cache */
     std::string toString() {
       std::string ret;
@@ -120,16 +154,17 @@ class CacheCore {
      *
      * @return The matching cache block, or NULL if none matching
      */
-    CacheLine *accessLine(uint32_t addr);
+    virtual CacheLine *accessLine(uint32_t addr);
 
     /** <B>TODO</B>: Returns a cache block allocated for addr.  First, the
      * set is searched for invalid blocks.  If there is one, then the first
      * invalid block is chosen for allocation.  The allocated block is
      * validated and then initialized with the given address before being
      * returned.  If there are no invalid blocks, then a valid block needs
-     * to be replaced.  A block is chosen according to LRU based on the ages
-     * of the blocks.  If that block is dirty, rplcAddr is updated with the
-     * address of the replaced block to be used later for write back.
+     * to be replaced.  Only ways allowed by the way mask are considered.
+     * A block is chosen according to LRU based on the ages of the blocks.
+     * If that block is dirty, rplcAddr is updated with the address of the
+     * replaced block to be used later for write back.
      *
      * @param addr - The accessed address
      * @param rplcAaddr - The address of the dirty block that is replaced
@@ -137,7 +172,88 @@ class CacheCore {
      *
      * @return The allocated cache block
      */
-    CacheLine *allocateLine(uint32_t addr, uint32_t *rplcAddr);
+    virtual CacheLine *allocateLine(uint32_t addr, uint32_t *rplcAddr);
+};
+
+/** Computes log2 of a power of 2 at compile time */
+constexpr uint32_t log2c(uint32_t n) { return n <= 1 ? 0 : 1 + log2c(n >> 1); }
+
+/** @brief A CacheCore whose geometry is fixed at compile time.
+ *
+ * Behaves exactly like CacheCore, but with the number of rows, the
+ * associativity and the block size as template parameters the address
+ * decode folds into constants and the loops over a row get unrolled.
+ * CacheCore::create instantiates it for the common geometries.
+ *
+ * @tparam Sets - The number of rows (a power of 2)
+ * @tparam Ways - The associativity (a power of 2)
+ * @tparam LineBits - log2 of the cache block size
+ */
+template<uint32_t Sets, uint32_t Ways, uint32_t LineBits>
+class FixedCacheCore : public CacheCore {
+  protected:
+    static const uint32_t RowBits = log2c(Sets);
+
+    CacheLine *row4Addr(uint32_t addr) const {
+      return &content[((addr >> LineBits) & (Sets - 1)) * Ways];
+    }
+
+  public:
+    /** Constructor.
+     *
+     * @param pStr - The replacement policy (currently not used).
+     */
+    FixedCacheCore(const char *pStr)
+      : CacheCore(Sets * Ways << LineBits, Ways, 1u << LineBits, pStr)
+    {
+      static_assert((Sets & (Sets - 1)) == 0, "Sets must be a power of 2");
+      static_assert((Ways & (Ways - 1)) == 0, "Ways must be a power of 2");
+    }
+
+    CacheLine *accessLine(uint32_t addr) {
+      uint32_t tag = addr >> LineBits >> RowBits;
+      CacheLine *row = row4Addr(addr);
+      CacheLine *lineHit = NULL;
+
+      for(uint32_t i = 0; i < Ways; i++) {
+        row[i].incAge();
+        if(row[i].isValid() && row[i].getTag() == tag) {
+          lineHit = &row[i];
+          lineHit->resetAge();
+        }
+      }
+      return lineHit;
+    }
+
+    CacheLine *allocateLine(uint32_t addr, uint32_t *rplcAddr) {
+      uint32_t tag = addr >> LineBits >> RowBits;
+      CacheLine *row = row4Addr(addr);
+      CacheLine *lineOldest = NULL;
+
+      // Use the first invalid block, otherwise replace the oldest
+      for(uint32_t i = 0; i < Ways; i++) {
+        if(isWayAllowed(i) && !row[i].isValid()) {
+          lineOldest = &row[i];
+          break;
+        }
+      }
+      if(!lineOldest) {
+        for(uint32_t i = 0; i < Ways; i++) {
+          if(isWayAllowed(i) && (!lineOldest || row[i].getAge() > lineOldest->getAge())) {
+            lineOldest = &row[i];
+          }
+        }
+        assert(lineOldest);
+        assert(rplcAddr);
+        if(lineOldest->isDirty()) {
+          *rplcAddr = calcAddr(lineOldest->getTag(), lineOldest - content);
+        }
+      }
+      lineOldest->initialize();
+      lineOldest->validate();
+      lineOldest->setTag(tag);
+      return lineOldest;
+    }
 };
 
 #endif // CACHECORE_H
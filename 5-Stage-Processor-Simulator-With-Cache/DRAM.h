@@ -43,7 +43,7 @@ class DRAM : public MemObj
      * @param mreq - The memory request
      */
     void access(MemRequest *mreq) {
-      mreq->addLatency(hitDelay);
+      mreq->addLatency(hitDelay, this);
 
       if(verbose) {
         const char *memOp;
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "Hierarchy.h"
+#include "config.h"
+#include "log2i.h"
+
+// SlicedCache: Routes each request to one of several slices by address.
+
+SlicedCache::SlicedCache(const char *name)
+: MemObj(name)
+{
+  GError *error = NULL;
+
+  assert(lowerLevelMemObjs.size() > 0);
+
+  int bsize = g_key_file_get_integer(config->keyfile, name, "bsize", &error);
+  if(error != NULL) g_error (error->message);
+  assert(bsize > 0);
+  lineBits = log2i(bsize);
+
+  // Default to xor hashing since that is what real sliced LLCs do
+  hash = SliceHashXor;
+  gchar *hStr = g_key_file_get_string(config->keyfile, name, "sliceHash", NULL);
+  if(hStr != NULL) {
+    if(strcasecmp(hStr, "mod") == 0) {
+      hash = SliceHashMod;
+    } else if(strcasecmp(hStr, "xor") == 0) {
+      hash = SliceHashXor;
+    } else {
+      assert(0);
+    }
+    g_free(hStr);
+  }
+
+  sliceBits = log2i(lowerLevelMemObjs.size());
+  if(hash == SliceHashXor) {
+    // Folding only works for a power of 2 number of slices
+    assert((1u << sliceBits) == lowerLevelMemObjs.size());
+  }
+
+  for(size_t i = 0; i < lowerLevelMemObjs.size(); i++) {
+    sliceRequests.push_back(Counter(lowerLevelMemObjs[i]->getName().c_str()));
+  }
+}
+
+SlicedCache::~SlicedCache()
+{
+  // nothing to do
+}
+
+uint32_t SlicedCache::calcSlice4Addr(uint32_t addr) const
+{
+  uint32_t line = addr >> lineBits;
+
+  if(hash == SliceHashMod || sliceBits == 0) {
+    return line % lowerLevelMemObjs.size();
+  }
+
+  uint32_t slice = 0;
+  while(line) {
+    slice ^= line & ((1u << sliceBits) - 1);
+    line >>= sliceBits;
+  }
+  return slice;
+}
+
+void SlicedCache::access(MemRequest *mreq)
+{
+  uint32_t slice = calcSlice4Addr(mreq->getAddr());
+  sliceRequests[slice].inc();
+  lowerLevelMemObjs[slice]->access(mreq);
+}
+
+uint32_t SlicedCache::getAssoc() const
+{
+  uint32_t assoc = lowerLevelMemObjs[0]->getAssoc();
+  for(size_t i = 1; i < lowerLevelMemObjs.size(); i++) {
+    if(lowerLevelMemObjs[i]->getAssoc() != assoc) return 0;
+  }
+  return assoc;
+}
+
+uint32_t SlicedCache::getWayMask() const
+{
+  return lowerLevelMemObjs[0]->getWayMask();
+}
+
+void SlicedCache::setWayMask(uint32_t mask)
+{
+  for(size_t i = 0; i < lowerLevelMemObjs.size(); i++) {
+    lowerLevelMemObjs[i]->setWayMask(mask);
+  }
+}
+
+// Get string that describes MemObj
+std::string SlicedCache::toString() const
+{
+  std::string ret;
+  ret += "[" + getName() + "]\n";
+  ret += "device type = sliced\n";
+  ret += std::string("slice hash = ") + (hash == SliceHashMod ? "mod" : "xor") + "\n";
+  ret += "interleave = " + std::to_string(1u << lineBits) + "\n";
+  ret += "slices = " + getLowerLevel() + "\n";
+  return ret;
+}
+
+// Get string that summarizes how requests were spread over the slices
+std::string SlicedCache::getStatString() const
+{
+  std::string ret;
+  ret += getName();
+  for(size_t i = 0; i < sliceRequests.size(); i++) {
+    ret += ":" + sliceRequests[i].toString();
+  }
+  return ret;
+}
+
+// WayPartition: Restricts allocations in a shared cache to a range of ways.
+
+WayPartition::WayPartition(const char *name)
+: MemObj(name)
+  ,accesses("accesses")
+{
+  GError *error = NULL;
+
+  assert(lowerLevelMemObj);
+
+  firstWay = g_key_file_get_integer(config->keyfile, name, "firstWay", &error);
+  if(error != NULL) g_error (error->message);
+  numWays = g_key_file_get_integer(config->keyfile, name, "numWays", &error);
+  if(error != NULL) g_error (error->message);
+
+  // The lower level must be a cache (or slices with equal associativity)
+  // that is wide enough to hold the partition.
+  uint32_t assoc = lowerLevelMemObj->getAssoc();
+  assert(assoc > 0);
+  assert(numWays > 0);
+  assert(firstWay + numWays <= assoc);
+  assert(firstWay + numWays <= 32);
+
+  wayMask = (numWays == 32 ? ~0u : ((1u << numWays) - 1)) << firstWay;
+}
+
+WayPartition::~WayPartition()
+{
+  // nothing to do
+}
+
+void WayPartition::access(MemRequest *mreq)
+{
+  accesses.inc();
+
+  uint32_t prevMask = lowerLevelMemObj->getWayMask();
+  lowerLevelMemObj->setWayMask(wayMask);
+  lowerLevelMemObj->access(mreq);
+  lowerLevelMemObj->setWayMask(prevMask);
+}
+
+// Get string that describes MemObj
+std::string WayPartition::toString() const
+{
+  std::string ret;
+  ret += "[" + getName() + "]\n";
+  ret += "device type = partition\n";
+  ret += "ways = " + std::to_string(firstWay) + "-" + std::to_string(firstWay + numWays - 1) + "\n";
+  ret += "lower level = " + getLowerLevel() + "\n";
+  return ret;
+}
+
+// Get string that summarizes access statistics
+std::string WayPartition::getStatString() const
+{
+  return getName() + ":" + accesses.toString();
+}
@@ -0,0 +1,106 @@
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include "Counter.h"
+#include "MemObj.h"
+#include "MemRequest.h"
+
+enum SliceHash {SliceHashMod, SliceHashXor};
+
+/** @brief An address-interleaved sliced cache (e.g. a mesh-sliced L3).
+ *
+ * Holds no blocks itself.  Its lower levels are the slices, each an ordinary
+ * memory object, and every request is routed to exactly one slice chosen by
+ * hashing the block address.  With "mod" hashing, consecutive blocks go to
+ * consecutive slices.  With "xor" hashing, all block address bits are folded
+ * together so that strided accesses are spread evenly over the slices.
+ */
+class SlicedCache : public MemObj {
+  protected:
+    /** The hash function used to pick a slice */
+    SliceHash hash;
+    /** log2 of the interleaving granularity (the block size) */
+    uint32_t lineBits;
+    /** log2 of the number of slices, used by xor hashing */
+    uint32_t sliceBits;
+
+    // BEGIN Statistics
+    std::vector<Counter> sliceRequests;
+    // END Statistics
+
+  public:
+    /** Constructor.  First invokes the parent MemObj constructor, which
+     * creates the slices, then reads in the sliceHash and bsize parameters
+     * from the config file.
+     *
+     * @param name - The name of the sliced cache object on the config file.
+     */
+    SlicedCache(const char *name);
+    ~SlicedCache();
+
+    /** Returns the index of the slice that owns the given address.
+     *
+     * @param addr - The accessed address
+     */
+    uint32_t calcSlice4Addr(uint32_t addr) const;
+
+    /** Forwards the memory request to the slice that owns its address.
+     *
+     * @param mreq - The memory request
+     */
+    void access(MemRequest *mreq);
+
+    /** Way partitioning a sliced cache partitions every slice identically. */
+    uint32_t getAssoc() const;
+    uint32_t getWayMask() const;
+    void setWayMask(uint32_t mask);
+
+    std::string toString() const;
+    std::string getStatString() const;
+    std::string getContentString() const { return ""; }
+};
+
+/** @brief A way partition of a shared cache (e.g. an LLC partitioned
+ * between instruction and data paths).
+ *
+ * Holds no blocks itself.  Forwards every request to its lower level while
+ * restricting allocations there to ways [firstWay, firstWay + numWays).
+ * Hits may still come from any way, as with Intel CAT.  Several partitions
+ * may name the same lower level, each with its own range of ways.
+ */
+class WayPartition : public MemObj {
+  protected:
+    /** The first way of the partition */
+    uint32_t firstWay;
+    /** The number of ways in the partition */
+    uint32_t numWays;
+    /** The way mask built from firstWay and numWays */
+    uint32_t wayMask;
+
+    // BEGIN Statistics
+    Counter accesses;
+    // END Statistics
+
+  public:
+    /** Constructor.  First invokes the parent MemObj constructor, which
+     * creates the partitioned object, then reads in the firstWay and numWays
+     * parameters from the config file.
+     *
+     * @param name - The name of the partition object on the config file.
+     */
+    WayPartition(const char *name);
+    ~WayPartition();
+
+    /** Forwards the memory request to the partitioned object with its way
+     * mask temporarily replaced by this partition's.
+     *
+     * @param mreq - The memory request
+     */
+    void access(MemRequest *mreq);
+
+    std::string toString() const;
+    std::string getStatString() const;
+    std::string getContentString() const { return ""; }
+};
+
+#endif // HIERARCHY_H
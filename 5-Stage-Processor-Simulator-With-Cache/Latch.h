@@ -0,0 +1,43 @@
+#ifndef LATCH_H
+#define LATCH_H
+
+#include <assert.h>
+
+/* A pipeline latch: a FIFO of at most N entries kept in a ring buffer inside
+ * the object itself, so moving instructions between stages never touches
+ * the heap.  Supports the subset of std::deque that the pipeline uses.  N
+ * must be a power of 2 so that wrapping around is a mask.  Aligned to a
+ * cache line so that a latch does not share lines with its neighbors. */
+template<typename T, unsigned N>
+class alignas(64) Latch {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Latch capacity must be a power of 2");
+
+  T entries[N];
+  unsigned head;   // index of the front entry
+  unsigned count;  // number of entries
+
+public:
+  Latch() : head(0), count(0) {}
+
+  unsigned size() const { return count; }
+  bool empty() const { return count == 0; }
+  void clear() { head = 0; count = 0; }
+
+  T &operator[](unsigned i) { assert(i < count); return entries[(head + i) & (N - 1)]; }
+  const T &operator[](unsigned i) const { assert(i < count); return entries[(head + i) & (N - 1)]; }
+  T &front() { return (*this)[0]; }
+  T &back() { return (*this)[count - 1]; }
+
+  void push_back(const T &x) {
+    assert(count < N);
+    entries[(head + count) & (N - 1)] = x;
+    count++;
+  }
+  void pop_front() {
+    assert(count > 0);
+    head = (head + 1) & (N - 1);
+    count--;
+  }
+};
+
+#endif /* #define LATCH_H */
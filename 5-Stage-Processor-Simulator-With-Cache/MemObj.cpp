@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <set>
+#include <algorithm>
 
 #include "MemObj.h"
 #include "Cache.h"
 #include "DRAM.h"
+#include "Hierarchy.h"
 
 std::map<std::string, MemObj*> MemObj::memObjs;
 
@@ -41,6 +43,10 @@ MemObj *MemObj::create(const char *name)
     } else {
       assert(0);
     }
+  } else if(!strcmp(deviceType, "sliced")) {
+    obj = new SlicedCache(name);
+  } else if(!strcmp(deviceType, "partition")) {
+    obj = new WayPartition(name);
   } else {
     assert(0);
   }
@@ -55,19 +61,114 @@ MemObj *MemObj::create(const char *name)
   return obj;
 }
 
-MemObj::MemObj(const char *s)
-  :name(s)
+std::vector<std::string> MemObj::getLowerLevelNames(const char *name)
 {
   GError *error = NULL;
+  gchar **names = NULL;
+  gsize numNames = 0;
+  std::vector<std::string> ret;
 
-  // If there is a lower level memory object, recursively create that one too!
-  lowerLevel = g_key_file_get_string(config->keyfile, s, "lowerLevel", &error);
+  // The [hierarchy] section, if present, overrides per-object lowerLevel keys
+  if(g_key_file_has_key(config->keyfile, "hierarchy", name, NULL)) {
+    names = g_key_file_get_string_list(config->keyfile, "hierarchy", name, &numNames, &error);
+  } else {
+    names = g_key_file_get_string_list(config->keyfile, name, "lowerLevel", &numNames, &error);
+  }
   if(error != NULL) g_error (error->message);
-  if(strcmp(lowerLevel, "null")) {
-    // If not "null" create that object
-    lowerLevelMemObj = MemObj::create(lowerLevel);
-    assert(lowerLevelMemObj);
+
+  for(gsize i = 0; i < numNames; i++) {
+    g_strstrip(names[i]);
+    if(strlen(names[i]) > 0 && strcmp(names[i], "null")) {
+      ret.push_back(names[i]);
+    }
+  }
+  g_strfreev(names);
+  return ret;
+}
+
+// Depth first search over the hierarchy.  state is 1 while a node is on the
+// current path and 2 once all of its lower levels have been checked.
+static bool validateNode(const std::string &name, std::map<std::string, int> &state, std::vector<std::string> &path)
+{
+  if(state[name] == 2) return true;
+  if(state[name] == 1) {
+    fprintf(stderr, "Memory hierarchy has a cycle: ");
+    std::vector<std::string>::iterator it = std::find(path.begin(), path.end(), name);
+    for(; it != path.end(); it++) {
+      fprintf(stderr, "%s -> ", it->c_str());
+    }
+    fprintf(stderr, "%s\n", name.c_str());
+    return false;
+  }
+
+  if(!g_key_file_has_group(config->keyfile, name.c_str())) {
+    fprintf(stderr, "Memory object [%s] is referenced but not defined.\n", name.c_str());
+    return false;
   }
+  gchar *deviceType = g_key_file_get_string(config->keyfile, name.c_str(), "deviceType", NULL);
+  if(deviceType == NULL) {
+    fprintf(stderr, "Memory object [%s] has no deviceType.\n", name.c_str());
+    return false;
+  }
+
+  std::vector<std::string> lowerNames = MemObj::getLowerLevelNames(name.c_str());
+  bool ok = true;
+  if(!strcmp(deviceType, "dram")) {
+    ok = lowerNames.size() == 0;
+  } else if(!strcmp(deviceType, "cache") || !strcmp(deviceType, "partition")) {
+    ok = lowerNames.size() == 1;
+  } else if(!strcmp(deviceType, "sliced")) {
+    ok = lowerNames.size() >= 1;
+  } else {
+    fprintf(stderr, "Memory object [%s] has unknown deviceType %s.\n", name.c_str(), deviceType);
+    g_free(deviceType);
+    return false;
+  }
+  if(!ok) {
+    fprintf(stderr, "Memory object [%s] of type %s has %d lower levels.\n", name.c_str(), deviceType, (int)lowerNames.size());
+    g_free(deviceType);
+    return false;
+  }
+  g_free(deviceType);
+
+  state[name] = 1;
+  path.push_back(name);
+  for(size_t i = 0; i < lowerNames.size(); i++) {
+    if(!validateNode(lowerNames[i], state, path)) return false;
+  }
+  path.pop_back();
+  state[name] = 2;
+  return true;
+}
+
+bool MemObj::validateHierarchy(const char *name)
+{
+  std::map<std::string, int> state;
+  std::vector<std::string> path;
+
+  assert(config && config->keyfile);
+  assert(name);
+  return validateNode(name, state, path);
+}
+
+MemObj::MemObj(const char *s)
+  :name(s)
+  ,lowerLevelMemObj(NULL)
+  ,stallCycles(0)
+{
+  // If there are lower level memory objects, recursively create those too!
+  std::vector<std::string> lowerNames = getLowerLevelNames(s);
+  std::string joined;
+  for(size_t i = 0; i < lowerNames.size(); i++) {
+    MemObj *obj = MemObj::create(lowerNames[i].c_str());
+    assert(obj);
+    lowerLevelMemObjs.push_back(obj);
+    joined += (i > 0 ? ";" : "") + lowerNames[i];
+  }
+  if(!lowerLevelMemObjs.empty()) {
+    lowerLevelMemObj = lowerLevelMemObjs[0];
+  }
+  lowerLevel = g_strdup(lowerNames.empty() ? "null" : joined.c_str());
 }
 
 MemObj::~MemObj()
@@ -85,6 +186,16 @@ void MemObj::freeAll()
   memObjs.clear();
 }
 
+std::vector<MemObj*> MemObj::getAll()
+{
+  std::vector<MemObj*> objs;
+  std::map<std::string, MemObj*>::iterator it;
+  for(it = memObjs.begin(); it != memObjs.end(); it++) {
+    objs.push_back(it->second);
+  }
+  return objs;
+}
+
 void MemObj::printAll()
 {
   printf("======================================================================\n\n");
@@ -109,6 +220,21 @@ void MemObj::printAllStats()
   printf("\n======================================================================\n");
 }
 
+void MemObj::printAllProfiles()
+{
+  std::string profiles;
+  std::map<std::string, MemObj*>::iterator it;
+  for(it = memObjs.begin(); it != memObjs.end(); it++) {
+    profiles += it->second->getProfileString();
+  }
+  if(profiles.empty()) return;
+
+  printf("======================================================================\n\n");
+  printf("Printing all miss profiles ... \n\n");
+  printf("%s", profiles.c_str());
+  printf("\n======================================================================\n");
+}
+
 void MemObj::printAllContents()
 {
   printf("======================================================================\n");
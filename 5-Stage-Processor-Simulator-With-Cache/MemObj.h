@@ -16,7 +16,9 @@ class MemRequest;
  * getContentString methods so can't be instantiated.  Children classes
  * Cache and DRAM override these methods to implement them respectively.
  * Has a memObjs global registry of created objects so that a memory object
- * is not created twice when referred to twice as lower level memory.
+ * is not created twice when referred to twice as lower level memory.  This
+ * means the objects form a DAG rather than a chain: several upper levels may
+ * share one lower level, and a sliced object may have several lower levels.
  */
 class MemObj {
   protected:
@@ -25,10 +27,15 @@ class MemObj {
 
     /** The name of the cache object on the config file */
     std::string name;
-    /** The name of the lower level MemObj on the config file */
+    /** The name(s) of the lower level MemObj on the config file */
     gchar *lowerLevel;
-    /** The lower level MemObj on the config file */
+    /** The (first) lower level MemObj on the config file */
     MemObj *lowerLevelMemObj;
+    /** All lower level MemObjs on the config file, in the listed order */
+    std::vector<MemObj*> lowerLevelMemObjs;
+    /** Pipeline stall cycles charged to the latency this object added to
+     * loads and instruction fetches */
+    uint64_t stallCycles;
 
   public:
     /** Returns the named memory object.  If it is already created and the
@@ -41,6 +48,26 @@ class MemObj {
      */
     static MemObj *create(const char *name);
 
+    /** Walks the memory hierarchy reachable from the named object without
+     * creating anything and checks that every referenced section exists,
+     * has a known deviceType, has the right number of lower levels for that
+     * type, and that there are no cycles.  Problems are reported on stderr.
+     *
+     * @param name - The name of the root memory object in the config file.
+     *
+     * @return true if the hierarchy is well formed, false otherwise
+     */
+    static bool validateHierarchy(const char *name);
+
+    /** Returns the names of the lower level memory objects for the named
+     * object.  The [hierarchy] section is consulted first and, if it has no
+     * key for the object, the lowerLevel key in the object's own section.
+     * Either may be a ';' separated list.  "null" entries are dropped.
+     *
+     * @param name - The name of the memory object in the config file.
+     */
+    static std::vector<std::string> getLowerLevelNames(const char *name);
+
     /** Frees all objects in the memObjs registry to prevent memory leaks. */
     static void freeAll();
     /** Prints the descriptions of all objects in the memObjs registry. */
@@ -49,11 +76,16 @@ class MemObj {
     static void printAllStats();
     /** Prints the contents of all caches in the memObjs registry. */
     static void printAllContents();
+    /** Prints the miss attribution profiles of all objects in the memObjs
+     * registry that have one.  Prints nothing if none do. */
+    static void printAllProfiles();
+    /** Returns all objects in the memObjs registry, in name order. */
+    static std::vector<MemObj*> getAll();
 
-    /** Constructor.  Parses the lower level name from the config file and if
-     * it is not "null", then recursively invokes MemObj::create to create the
-     * lower level object.  The created object is assigned to
-     * lowerLevelMemObj.
+    /** Constructor.  Parses the lower level name(s) from the config file and
+     * for each that is not "null", recursively invokes MemObj::create to
+     * create the lower level object.  The created objects are appended to
+     * lowerLevelMemObjs and the first is also assigned to lowerLevelMemObj.
      *
      * @param name - The name of the memory object on the config file.
      */
@@ -68,6 +100,19 @@ class MemObj {
     std::string getLowerLevel() const { return lowerLevel; }
     /** Returns the lower level MemObj on the config file */
     MemObj *getLowerLevelMemObj() const { return lowerLevelMemObj; }
+    /** Returns the pipeline stall cycles charged to this object */
+    uint64_t getStallCycles() const { return stallCycles; }
+    /** Charges n pipeline stall cycles to this object */
+    void addStallCycles(uint64_t n) { stallCycles += n; }
+
+    /** Returns the associativity available for way partitioning, or 0 if
+     * the object cannot be way partitioned. */
+    virtual uint32_t getAssoc() const { return 0; }
+    /** Returns the mask of ways that allocations may currently use. */
+    virtual uint32_t getWayMask() const { return ~0u; }
+    /** Restricts future allocations to the ways set in mask.  Lookups still
+     * search all ways.  Only meaningful if getAssoc() is non-zero. */
+    virtual void setWayMask(uint32_t mask) { assert(0); }
 
     /** Accesses memory object with memory request.
      *
@@ -80,6 +125,9 @@ class MemObj {
     virtual std::string getStatString() const = 0;
     /** Returns a string that dumps all valid lines in cache */
     virtual std::string getContentString() const = 0;
+    /** Returns a string that reports where misses come from, or an empty
+     * string if the object is not being profiled */
+    virtual std::string getProfileString() const { return ""; }
 };
 
 #endif // MEMOBJ_H
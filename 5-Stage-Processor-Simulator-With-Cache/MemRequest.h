@@ -1,6 +1,11 @@
 #ifndef MEMREQUEST_H
 #define MEMREQUEST_H
 
+class MemObj;
+
+/** Number of memory objects a request remembers visiting */
+#define MEMREQ_MAX_PATH 8
+
 enum MemOperation {
   MemRead = 0,
   MemWrite,
@@ -25,6 +30,17 @@ class MemRequest {
     /** The type of memory operation for the memory request */
     MemOperation memOp;
 
+    /** The PC of the instruction that caused the request, or 0 if none */
+    uint32_t pc;
+
+    /** The memory objects that added latency, in the order visited, and the
+     * latency each added.  Only the first MEMREQ_MAX_PATH are kept, and the
+     * last of those takes the latency of any after it, so the latencies
+     * still add up to the request's. */
+    MemObj *path[MEMREQ_MAX_PATH];
+    uint32_t pathLatency[MEMREQ_MAX_PATH];
+    int pathLength;
+
   public:
 
     /** Constructor.  
@@ -36,6 +52,8 @@ class MemRequest {
       latency = 0;
       addr = a;
       memOp = m;
+      pc = 0;
+      pathLength = 0;
     }
 
     /** Returns the type of memory operation */
@@ -53,11 +71,34 @@ class MemRequest {
     uint32_t getLatency() { return latency; }
     /** Adds to the latency incurred by the memory request */
     void addLatency(uint32_t lat) { latency += lat; }
+    /** Adds to the latency incurred by the memory request and records that
+     * obj added it */
+    void addLatency(uint32_t lat, MemObj *obj) {
+      latency += lat;
+      if (pathLength < MEMREQ_MAX_PATH) {
+        path[pathLength] = obj;
+        pathLatency[pathLength] = lat;
+        pathLength++;
+      } else {
+        pathLatency[MEMREQ_MAX_PATH - 1] += lat;
+      }
+    }
+    /** Returns how many memory objects recorded latency on the request */
+    int getPathLength() const { return pathLength; }
+    /** Returns the i-th memory object to add latency */
+    MemObj *getPathObj(int i) const { return path[i]; }
+    /** Returns the latency added by the i-th memory object */
+    uint32_t getPathLatency(int i) const { return pathLatency[i]; }
 
     /** Returns the address for the memory request */
     uint32_t getAddr() const { return addr; }
     /** Sets the address for the memory request */
     void  setAddr(uint32_t a) { addr = a; }
+
+    /** Returns the PC of the instruction that caused the request */
+    uint32_t getPC() const { return pc; }
+    /** Sets the PC of the instruction that caused the request */
+    void  setPC(uint32_t p) { pc = p; }
 };
 
 #endif   // MEMREQUEST_H
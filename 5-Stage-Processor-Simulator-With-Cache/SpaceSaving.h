@@ -0,0 +1,130 @@
+#ifndef SPACESAVING_H
+#define SPACESAVING_H
+
+#include <stdint.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+/** @brief A Space-Saving heavy hitters sketch over 32-bit keys.
+ *
+ * Tracks at most capacity keys no matter how many distinct keys are added.
+ * When a new key arrives and the table is full, the key with the smallest
+ * count is replaced and the new key inherits that count (recorded as its
+ * error).  Any key that occurs more than total/capacity times is guaranteed
+ * to be tracked and its count is overestimated by at most its error.  The
+ * entries form a min-heap on count so each add is O(log capacity).
+ */
+class SpaceSaving {
+  protected:
+    struct Entry {
+      uint32_t key;
+      long long count;
+      long long error;
+    };
+
+    /** The name of the sketch that gets printed on screen */
+    std::string name;
+    /** Maximum number of tracked keys */
+    uint32_t capacity;
+    /** Total number of adds */
+    long long total;
+    /** Min-heap of entries ordered by count */
+    std::vector<Entry> heap;
+    /** Position of each tracked key in heap */
+    std::unordered_map<uint32_t, uint32_t> pos;
+
+    void swapEntries(uint32_t i, uint32_t j) {
+      std::swap(heap[i], heap[j]);
+      pos[heap[i].key] = i;
+      pos[heap[j].key] = j;
+    }
+
+    /** Restores the heap after the count at i grew */
+    void siftDown(uint32_t i) {
+      while(true) {
+        uint32_t l = 2 * i + 1, r = l + 1, m = i;
+        if(l < heap.size() && heap[l].count < heap[m].count) m = l;
+        if(r < heap.size() && heap[r].count < heap[m].count) m = r;
+        if(m == i) return;
+        swapEntries(i, m);
+        i = m;
+      }
+    }
+
+    /** Restores the heap after an entry was appended at i */
+    void siftUp(uint32_t i) {
+      while(i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+        swapEntries(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+      }
+    }
+
+  public:
+    /** Constructor.
+     *
+     * @param s - The name of the sketch
+     * @param c - The maximum number of tracked keys
+     */
+    SpaceSaving(const char *s, uint32_t c)
+      : name(s)
+      ,capacity(c)
+      ,total(0)
+    {
+      assert(capacity > 0);
+      heap.reserve(capacity);
+      pos.reserve(capacity * 2);
+    }
+
+    /** Counts one occurrence of key */
+    void add(uint32_t key) {
+      total++;
+      std::unordered_map<uint32_t, uint32_t>::iterator it = pos.find(key);
+      if(it != pos.end()) {
+        heap[it->second].count++;
+        siftDown(it->second);
+      } else if(heap.size() < capacity) {
+        Entry e = {key, 1, 0};
+        heap.push_back(e);
+        pos[key] = heap.size() - 1;
+        siftUp(heap.size() - 1);
+      } else {
+        // Replace the minimum, which is at the root
+        pos.erase(heap[0].key);
+        heap[0].key = key;
+        heap[0].error = heap[0].count;
+        heap[0].count++;
+        pos[key] = 0;
+        siftDown(0);
+      }
+    }
+
+    long long getTotal() const { return total; }
+
+    /** Returns a report of the n most frequent keys, one per line.  Each key
+     * is multiplied by scale before printing (e.g. to turn a page number
+     * back into an address).
+     *
+     * @param n - The number of keys to report
+     * @param label - What a key is, e.g. "PC"
+     * @param scale - Multiplier applied to keys when printing
+     */
+    std::string toString(uint32_t n, const char *label, uint32_t scale = 1) const {
+      std::vector<Entry> sorted(heap);
+      std::sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b) {
+        return a.count > b.count || (a.count == b.count && a.key < b.key);
+      });
+      std::string ret;
+      ret += name + ": top " + std::to_string(std::min<size_t>(n, sorted.size())) + " of " + std::to_string(total) + "\n";
+      for(size_t i = 0; i < sorted.size() && i < n; i++) {
+        ret += "  " + std::string(label) + "=" + std::to_string((uint64_t)sorted[i].key * scale);
+        ret += ":count=" + std::to_string(sorted[i].count);
+        ret += ":error=" + std::to_string(sorted[i].error) + "\n";
+      }
+      return ret;
+    }
+};
+
+#endif // SPACESAVING_H
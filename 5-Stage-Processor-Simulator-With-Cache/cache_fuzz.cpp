@@ -0,0 +1,436 @@
+/**
+ * Utility program that differentially tests CacheCore and the WBCache and
+ * WTCache classes against a trivially correct reference model.
+ *
+ * Each test case picks a random cache geometry and a random sequence of
+ * accesses, runs both the simulator classes and the reference on it, and
+ * compares hit/miss outcomes, replaced addresses, request latencies and the
+ * final statistics.  On a mismatch the sequence is shrunk to a minimal one
+ * that still fails, which is printed along with the configuration.  Runs are
+ * fully determined by the seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+#include "config.h"
+#include "CacheCore.h"
+#include "MemObj.h"
+#include "MemRequest.h"
+
+/** One access in a test sequence */
+struct Op {
+  uint32_t addr;
+  MemOperation memOp;
+};
+
+/** A randomly generated test case */
+struct TestCase {
+  bool coreOnly;        // drive CacheCore directly instead of a hierarchy
+  bool l1WriteBack;     // L1 write policy (L2 is always write back)
+  uint32_t l1Size, l1Assoc, l1BSize, l1HitDelay;
+  uint32_t l2Size, l2Assoc, l2BSize, l2HitDelay;
+  uint32_t memHitDelay;
+  std::vector<Op> ops;
+};
+
+/*
+ * The reference model.  Sets are kept in a map of lists ordered from most to
+ * least recently used, which is LRU by construction.
+ */
+
+struct RefLine {
+  uint32_t tag;
+  bool dirty;
+};
+
+class RefLevel {
+  public:
+    virtual ~RefLevel() {}
+    /** Returns the latency of the access including all lower levels */
+    virtual uint32_t access(uint32_t addr, MemOperation memOp) = 0;
+    virtual std::string getStatString() const = 0;
+};
+
+class RefDRAM : public RefLevel {
+  protected:
+    uint32_t hitDelay;
+    long long readHits, writeHits;
+  public:
+    RefDRAM(uint32_t d) : hitDelay(d), readHits(0), writeHits(0) {}
+    uint32_t access(uint32_t addr, MemOperation memOp) {
+      if(memOp == MemRead) readHits++;
+      if(memOp == MemWrite) writeHits++;
+      return hitDelay;
+    }
+    std::string getStatString() const {
+      return "Memory:readHits=" + std::to_string(readHits) + ":writeHits=" + std::to_string(writeHits);
+    }
+};
+
+class RefCore {
+  protected:
+    uint32_t lineBits, numSets, assoc;
+    std::map<uint32_t, std::list<RefLine> > sets;
+  public:
+    RefCore(uint32_t size, uint32_t a, uint32_t bsize)
+      : lineBits(log2i(bsize)), numSets(size / bsize / a), assoc(a) {}
+
+    /** Looks up addr and makes it most recently used on a hit */
+    RefLine *access(uint32_t addr) {
+      uint32_t line = addr >> lineBits;
+      std::list<RefLine> &set = sets[line % numSets];
+      for(std::list<RefLine>::iterator it = set.begin(); it != set.end(); it++) {
+        if(it->tag == line / numSets) {
+          set.splice(set.begin(), set, it);
+          return &set.front();
+        }
+      }
+      return NULL;
+    }
+
+    /** Allocates addr as most recently used.  Sets *rplcAddr to the address
+     * of the replaced block if it was dirty.  As with CacheCore, a dirty
+     * block at address 0 is indistinguishable from no replacement. */
+    RefLine *allocate(uint32_t addr, uint32_t *rplcAddr) {
+      uint32_t line = addr >> lineBits;
+      std::list<RefLine> &set = sets[line % numSets];
+      *rplcAddr = 0;
+      if(set.size() == assoc) {
+        RefLine victim = set.back();
+        set.pop_back();
+        if(victim.dirty) {
+          *rplcAddr = (victim.tag * numSets + line % numSets) << lineBits;
+        }
+      }
+      RefLine l = {line / numSets, false};
+      set.push_front(l);
+      return &set.front();
+    }
+};
+
+class RefCache : public RefLevel {
+  protected:
+    std::string name;
+    bool writeBack;
+    uint32_t hitDelay;
+    RefCore core;
+    RefLevel *lower;
+    long long readHits, readMisses, writeHits, writeMisses, writeBacks;
+
+    void allocate(uint32_t addr, bool dirty) {
+      uint32_t rplcAddr;
+      RefLine *l = core.allocate(addr, &rplcAddr);
+      l->dirty = dirty;
+      if(rplcAddr) {
+        writeBacks++;
+        lower->access(rplcAddr, MemWriteBack);
+      }
+    }
+
+  public:
+    RefCache(const char *n, bool wb, uint32_t size, uint32_t assoc, uint32_t bsize, uint32_t d, RefLevel *l)
+      : name(n), writeBack(wb), hitDelay(d), core(size, assoc, bsize), lower(l)
+      ,readHits(0), readMisses(0), writeHits(0), writeMisses(0), writeBacks(0) {}
+
+    uint32_t access(uint32_t addr, MemOperation memOp) {
+      uint32_t latency = hitDelay;
+      RefLine *l = core.access(addr);
+      switch(memOp) {
+        case MemRead:
+          if(l) {
+            readHits++;
+          } else {
+            readMisses++;
+            latency += lower->access(addr, MemRead);
+            allocate(addr, false);
+          }
+          break;
+        case MemWrite:
+          if(l) {
+            writeHits++;
+          } else {
+            writeMisses++;
+          }
+          if(!writeBack) {
+            latency += lower->access(addr, MemWrite);
+          } else if(l) {
+            l->dirty = true;
+          } else {
+            latency += lower->access(addr, MemRead);
+            allocate(addr, true);
+          }
+          break;
+        case MemWriteBack:
+          assert(writeBack);
+          if(l) {
+            l->dirty = true;
+          } else {
+            latency += lower->access(addr, MemWriteBack);
+          }
+          break;
+      }
+      return latency;
+    }
+
+    std::string getStatString() const {
+      return name + ":readHits=" + std::to_string(readHits) + ":readMisses=" + std::to_string(readMisses)
+        + ":writeHits=" + std::to_string(writeHits) + ":writeMisses=" + std::to_string(writeMisses)
+        + ":writeBacks=" + std::to_string(writeBacks);
+    }
+};
+
+/*
+ * Running a test case against the simulator classes.
+ */
+
+static std::string makeConfig(const TestCase &tc)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf),
+    "[L1]\ndeviceType=cache\nsize=%u\nassoc=%u\nbsize=%u\nwritePolicy=%s\nreplPolicy=LRU\nhitDelay=%u\nlowerLevel=L2\n"
+    "[L2]\ndeviceType=cache\nsize=%u\nassoc=%u\nbsize=%u\nwritePolicy=WB\nreplPolicy=LRU\nhitDelay=%u\nlowerLevel=Memory\n"
+    "[Memory]\ndeviceType=dram\nhitDelay=%u\nlowerLevel=null\n",
+    tc.l1Size, tc.l1Assoc, tc.l1BSize, tc.l1WriteBack ? "WB" : "WT", tc.l1HitDelay,
+    tc.l2Size, tc.l2Assoc, tc.l2BSize, tc.l2HitDelay, tc.memHitDelay);
+  return buf;
+}
+
+static const char *opName(MemOperation memOp)
+{
+  return memOp == MemRead ? "MemRead" : memOp == MemWrite ? "MemWrite" : "MemWriteBack";
+}
+
+/** Runs ops on the CacheCore that Cache would create and on RefCore.  Returns the index of the first
+ * mismatching op, ops.size() if all match, and describes it in msg. */
+static size_t runCore(const TestCase &tc, const std::vector<Op> &ops, std::string &msg)
+{
+  std::unique_ptr<CacheCore> core(CacheCore::create(tc.l1Size, tc.l1Assoc, tc.l1BSize, "LRU"));
+  RefCore ref(tc.l1Size, tc.l1Assoc, tc.l1BSize);
+  char buf[256];
+
+  for(size_t i = 0; i < ops.size(); i++) {
+    // Same sequence as WBCache: look up, and allocate on a miss
+    CacheLine *l = core->accessLine(ops[i].addr);
+    RefLine *r = ref.access(ops[i].addr);
+    if((l != NULL) != (r != NULL)) {
+      snprintf(buf, sizeof(buf), "accessLine(%u): CacheCore %s, reference %s", ops[i].addr, l ? "hit" : "missed", r ? "hit" : "missed");
+      msg = buf;
+      return i;
+    }
+    if(!l) {
+      uint32_t rplcAddr = 0, refRplcAddr = 0;
+      l = core->allocateLine(ops[i].addr, &rplcAddr);
+      r = ref.allocate(ops[i].addr, &refRplcAddr);
+      if(rplcAddr != refRplcAddr) {
+        snprintf(buf, sizeof(buf), "allocateLine(%u): CacheCore replaced %u, reference %u", ops[i].addr, rplcAddr, refRplcAddr);
+        msg = buf;
+        return i;
+      }
+    }
+    if(ops[i].memOp == MemWrite) {
+      l->makeDirty();
+      r->dirty = true;
+    }
+  }
+  return ops.size();
+}
+
+/** Runs ops on an L1/L2/Memory hierarchy of simulator objects and of
+ * reference objects.  Returns as runCore. */
+static size_t runHierarchy(const TestCase &tc, const std::vector<Op> &ops, std::string &msg)
+{
+  GError *error = NULL;
+  std::string text = makeConfig(tc);
+  char buf[256];
+
+  config = g_slice_new(Config);
+  config->keyfile = g_key_file_new();
+  config->branchUnit = NULL;
+  if(!g_key_file_load_from_data(config->keyfile, text.c_str(), text.size(), G_KEY_FILE_NONE, &error)) {
+    g_error (error->message);
+  }
+  MemObj *l1 = MemObj::create("L1");
+  MemObj *l2 = l1->getLowerLevelMemObj();
+  MemObj *mem = l2->getLowerLevelMemObj();
+
+  RefDRAM refMem(tc.memHitDelay);
+  RefCache refL2("L2", true, tc.l2Size, tc.l2Assoc, tc.l2BSize, tc.l2HitDelay, &refMem);
+  RefCache refL1("L1", tc.l1WriteBack, tc.l1Size, tc.l1Assoc, tc.l1BSize, tc.l1HitDelay, &refL2);
+
+  size_t i;
+  for(i = 0; i < ops.size(); i++) {
+    MemRequest mreq(ops[i].addr, ops[i].memOp);
+    l1->access(&mreq);
+    uint32_t refLatency = refL1.access(ops[i].addr, ops[i].memOp);
+    if(mreq.getLatency() != refLatency) {
+      snprintf(buf, sizeof(buf), "%s(%u): latency %u, reference %u", opName(ops[i].memOp), ops[i].addr, mreq.getLatency(), refLatency);
+      msg = buf;
+      break;
+    }
+  }
+  if(i == ops.size()) {
+    const char *names[] = {"L1", "L2", "Memory"};
+    MemObj *objs[] = {l1, l2, mem};
+    RefLevel *refs[] = {&refL1, &refL2, &refMem};
+    for(int j = 0; j < 3; j++) {
+      if(objs[j]->getStatString() != refs[j]->getStatString()) {
+        msg = std::string(names[j]) + " stats differ:\n  simulator " + objs[j]->getStatString() + "\n  reference " + refs[j]->getStatString();
+        i = ops.size() - 1;
+        break;
+      }
+    }
+  }
+
+  MemObj::freeAll();
+  g_key_file_free(config->keyfile);
+  g_slice_free(Config, config);
+  config = NULL;
+  return i;
+}
+
+static bool fails(const TestCase &tc, const std::vector<Op> &ops, std::string &msg)
+{
+  if(ops.empty()) return false;
+  size_t i = tc.coreOnly ? runCore(tc, ops, msg) : runHierarchy(tc, ops, msg);
+  return i < ops.size();
+}
+
+/** Shrinks a failing sequence by repeatedly removing chunks of ops, halving
+ * the chunk size whenever no chunk can be removed (ddmin). */
+static std::vector<Op> shrink(const TestCase &tc, std::vector<Op> ops)
+{
+  std::string msg;
+  size_t chunk = ops.size() / 2;
+  while(chunk >= 1) {
+    bool removed = false;
+    for(size_t start = 0; start < ops.size(); ) {
+      std::vector<Op> candidate(ops.begin(), ops.begin() + start);
+      candidate.insert(candidate.end(), ops.begin() + std::min(ops.size(), start + chunk), ops.end());
+      if(fails(tc, candidate, msg)) {
+        ops = candidate;
+        removed = true;
+      } else {
+        start += chunk;
+      }
+    }
+    if(!removed) chunk /= 2;
+  }
+  return ops;
+}
+
+/*
+ * Test case generation.
+ */
+
+static TestCase generate(std::mt19937 &rng, uint32_t length)
+{
+  TestCase tc;
+  std::uniform_int_distribution<uint32_t> coin(0, 1);
+
+  tc.coreOnly = rng() % 4 == 0;
+  tc.l1WriteBack = coin(rng);
+  // Small geometries so that sets fill up and replacements happen often
+  tc.l1BSize = 1u << (2 + rng() % 6);
+  tc.l1Assoc = 1u << (rng() % 4);
+  tc.l1Size = tc.l1BSize * tc.l1Assoc * (1u << (rng() % 6));
+  tc.l2BSize = tc.l1BSize << (rng() % 2);
+  tc.l2Assoc = 1u << (rng() % 5);
+  tc.l2Size = tc.l2BSize * tc.l2Assoc * (1u << (rng() % 7));
+  tc.l1HitDelay = 1 + rng() % 4;
+  tc.l2HitDelay = 5 + rng() % 16;
+  tc.memHitDelay = 50 + rng() % 100;
+
+  // Blocks are drawn from a footprint of a few times the L2 capacity, with
+  // a hot subset so there are hits at every level.  Occasionally the
+  // footprint starts at address 0 to exercise that corner.
+  uint32_t footprint = 4 * tc.l2Size / tc.l1BSize + 1;
+  uint32_t hot = footprint / 8 + 1;
+  uint32_t base = rng() % 8 == 0 ? 0 : (rng() & 0x7fff0000u);
+  for(uint32_t i = 0; i < length; i++) {
+    uint32_t line = rng() % 2 ? rng() % hot : rng() % footprint;
+    Op op;
+    op.addr = base + line * tc.l1BSize + rng() % tc.l1BSize;
+    op.memOp = rng() % 3 == 0 ? MemWrite : MemRead;
+    tc.ops.push_back(op);
+  }
+  return tc;
+}
+
+static void print_case(const TestCase &tc)
+{
+  if(tc.coreOnly) {
+    printf("CacheCore(size=%u, assoc=%u, bsize=%u) driven as a write back cache\n", tc.l1Size, tc.l1Assoc, tc.l1BSize);
+  } else {
+    printf("Configuration:\n%s", makeConfig(tc).c_str());
+  }
+  printf("Accesses:\n");
+  for(size_t i = 0; i < tc.ops.size(); i++) {
+    printf("  %s %u\n", opName(tc.ops[i].memOp), tc.ops[i].addr);
+  }
+}
+
+void print_usage_info()
+{
+  printf("USAGE: cache_fuzz [OPTIONS]\n");
+  printf("Differentially tests CacheCore, WBCache and WTCache against a reference model.\n\n");
+  printf("  -h           this help screen.\n");
+  printf("  -s seed      random seed (default 1).\n");
+  printf("  -n cases     number of test cases (default 1000).\n");
+  printf("  -l length    accesses per test case (default 2000).\n");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seed = 1;
+  uint32_t cases = 1000;
+  uint32_t length = 2000;
+
+  int c;
+  while ((c = getopt (argc, argv, "hs:n:l:")) != -1) {
+    switch (c) {
+      case 'h':
+        print_usage_info();
+        return 0;
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        cases = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        length = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        print_usage_info();
+        return 1;
+    }
+  }
+
+  std::mt19937 rng(seed);
+  unsigned long long accesses = 0;
+  for(uint32_t n = 0; n < cases; n++) {
+    TestCase tc = generate(rng, length);
+    std::string msg;
+    if(fails(tc, tc.ops, msg)) {
+      printf("Case %u (seed %u) failed after %u accesses.  Shrinking ...\n\n", n, seed, (uint32_t)tc.ops.size());
+      tc.ops = shrink(tc, tc.ops);
+      fails(tc, tc.ops, msg);
+      print_case(tc);
+      printf("\nMismatch: %s\n", msg.c_str());
+      return 1;
+    }
+    accesses += tc.ops.size();
+  }
+
+  printf("Passed %u cases (%llu accesses) with seed %u.\n", cases, accesses, seed);
+  return 0;
+}
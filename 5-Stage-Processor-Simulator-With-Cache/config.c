@@ -4,6 +4,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "config.h"
 
@@ -15,6 +16,7 @@ int parse_config(const char *config_file_name)
 {
   gchar *instSource = NULL;
   gchar *dataSource = NULL;
+  gchar *branchUnit = NULL;
   GError *error = NULL;
 
   config = g_slice_new (Config);
@@ -32,21 +34,43 @@ int parse_config(const char *config_file_name)
 
   config->pipelineWidth = g_key_file_get_integer (config->keyfile, "pipeline", "width", NULL);
   if(error != NULL) g_error (error->message);
-  assert(config->pipelineWidth <= 2);  // fetch width > 2 is not supported
+  assert(config->pipelineWidth <= MAX_WIDTH);  // fetch width > 2 is not supported
 
   instSource = g_key_file_get_string(config->keyfile, "pipeline", "instSource", NULL);
   if(error != NULL) g_error (error->message);
   dataSource = g_key_file_get_string(config->keyfile, "pipeline", "dataSource", NULL);
   if(error != NULL) g_error (error->message);
 
+  // Check the whole hierarchy before creating anything so that a dangling
+  // name or a cycle is reported instead of recursing forever.
+  if (!MemObj::validateHierarchy(instSource) || !MemObj::validateHierarchy(dataSource)) {
+    g_free(instSource);
+    g_free(dataSource);
+    g_key_file_free(config->keyfile);
+    g_slice_free(Config, config);
+    config = NULL;
+    return 0;
+  }
+
   config->instSource = MemObj::create(instSource);
   config->dataSource = MemObj::create(dataSource);
 
   printf("Memory system setup successful.\n");
   MemObj::printAll();
 
+  /* The branch predictor is optional.  Without one, fetch never stalls on
+   * control hazards. */
+  config->branchUnit = NULL;
+  branchUnit = g_key_file_get_string(config->keyfile, "pipeline", "branchPredictor", NULL);
+  if (branchUnit != NULL && strcmp(branchUnit, "null")) {
+    config->branchUnit = new BranchUnit(branchUnit);
+    printf("%s", config->branchUnit->toString().c_str());
+    printf("======================================================================\n");
+  }
+
   g_free(instSource);
   g_free(dataSource);
+  g_free(branchUnit);
   return 1;
 }
 
@@ -54,6 +78,7 @@ void free_config()
 {
   assert(config && config->keyfile);
 
+  delete config->branchUnit;
   g_key_file_free(config->keyfile);
   g_slice_free(Config, config);
 }
@@ -4,6 +4,10 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 #include "MemObj.h"
+#include "BranchPredictor.h"
+
+/* Maximum pipeline width.  WB always holds two entries (ALU and lwsw). */
+#define MAX_WIDTH 2
 
 typedef struct
 {
@@ -13,6 +17,7 @@ typedef struct
   int pipelineWidth;
   MemObj *instSource;
   MemObj *dataSource;
+  BranchUnit *branchUnit;   // NULL if control hazards are not modeled
 } Config;
 
 int parse_config(const char *config_file_name);
@@ -24,6 +24,7 @@ void print_usage_info()
   printf("  -h           this help screen.\n");
   printf("  -v           verbose output (shows each instruction).\n");
   printf("  -d           debug output (shows pipeline on each cycle).\n");
+  printf("  -s           prints a CPI stack of where issue slots were lost.\n");
   printf("  -c file      [Required] uses file as configuration file.\n");
   printf("  -t file      [Required] uses file as input trace file.\n");
 }
@@ -32,9 +33,10 @@ int main(int argc, char **argv)
 {
   char *trace_file_name = NULL;
   char *config_file_name = NULL;
+  bool cpi_stack = false;
   
   char c;
-  while ((c = getopt (argc, argv, "hvdc:t:")) != -1) {
+  while ((c = getopt (argc, argv, "hvdsc:t:")) != -1) {
     switch (c) {
       case 'h':
         print_usage_info();
@@ -46,6 +48,9 @@ int main(int argc, char **argv)
         debug = true;
         verbose = true;
         break;
+      case 's':
+        cpi_stack = true;
+        break;
       case 't':
         trace_file_name = optarg;
         break;
@@ -73,7 +78,7 @@ int main(int argc, char **argv)
   }
 
   if (!parse_config(config_file_name)) {
-    fprintf(stderr, "\nError while parsing config file %s.\n\n", trace_file_name);
+    fprintf(stderr, "\nError while parsing config file %s.\n\n", config_file_name);
     exit(1);
   }
 
@@ -101,10 +106,20 @@ int main(int argc, char **argv)
       /* all instructions simulated to completion */
       /* print memory stats*/
       MemObj::printAllStats();
+      /* print miss profiles, if any*/
+      MemObj::printAllProfiles();
+      /* print branch stats*/
+      if (config->branchUnit) {
+        printf("%s\n", config->branchUnit->getStatString().c_str());
+        printf("+ Branch stall cycles : %u\n", branch_stall_cycles);
+      }
       /* print pipeline stats*/
       printf("+ Memory stall cycles : %u\n", mem_stall_cycles);
       printf("+ Number of cycles : %u\n", cycle_number);
       printf("+ IPC (Instructions Per Cycle) : %0.4f\n", (float)inst_number / (float)cycle_number);
+      if (cpi_stack) {
+        print_cpi_stack();
+      }
       break;
     }
   }
@@ -0,0 +1,245 @@
+/**
+ * Microbenchmarks for the simulator hot paths, using Google Benchmark.
+ *
+ * Covers reading the trace, the CacheCore block array, a request through an
+ * L1/L2/L3/DRAM chain, and the whole five stage loop.  Throughput is reported
+ * as insts_per_sec or accesses_per_sec.  'make bench' also writes the results
+ * to bench.json for comparing runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+#include <benchmark/benchmark.h>
+#include "CPU.h"
+#include "trace.h"
+#include "CacheCore.h"
+#include "MemObj.h"
+#include "MemRequest.h"
+
+/** Number of times traces/sample.tr is repeated to make the benchmark trace */
+#define TRACE_COPIES 100
+
+/** Contents of the benchmark trace, read once */
+static std::string trace_data;
+
+static void load_trace()
+{
+  if (!trace_data.empty()) return;
+  FILE *fd = fopen("traces/sample.tr", "rb");
+  if (!fd) {
+    fprintf(stderr, "\nError while opening trace file traces/sample.tr.\n\n");
+    exit(1);
+  }
+  std::string sample;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) sample.append(buf, n);
+  fclose(fd);
+  for (int i = 0; i < TRACE_COPIES; i++) trace_data += sample;
+}
+
+/** Opens the benchmark trace as trace_fd and initializes the trace buffer */
+static void open_trace()
+{
+  load_trace();
+  trace_fd = fmemopen((void *)trace_data.data(), trace_data.size(), "rb");
+  assert(trace_fd);
+  trace_init();
+}
+
+/** Parses a config file or string without the setup printout on stdout */
+static void quiet_parse_config(const char *file_name, const char *text)
+{
+  fflush(stdout);
+  int saved = dup(1);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, 1);
+  close(null_fd);
+
+  if (file_name) {
+    if (!parse_config(file_name)) {
+      fprintf(stderr, "\nError while parsing config file %s.\n\n", file_name);
+      exit(1);
+    }
+  } else {
+    GError *error = NULL;
+    config = g_slice_new0(Config);
+    config->keyfile = g_key_file_new();
+    if (!g_key_file_load_from_data(config->keyfile, text, strlen(text), G_KEY_FILE_NONE, &error)) {
+      g_error (error->message);
+    }
+  }
+
+  fflush(stdout);
+  dup2(saved, 1);
+  close(saved);
+}
+
+static void teardown_config()
+{
+  MemObj::freeAll();
+  free_config();
+  config = NULL;
+}
+
+/** Returns n random addresses over footprint bytes, half of them within the
+ * first eighth so that every level sees some hits. */
+static std::vector<uint32_t> make_addrs(size_t n, uint32_t footprint)
+{
+  std::mt19937 rng(1);
+  std::vector<uint32_t> addrs(n);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t range = rng() % 2 ? footprint / 8 : footprint;
+    addrs[i] = 0x10000000 + (rng() % range & ~3u);
+  }
+  return addrs;
+}
+
+static void BM_TraceGetItem(benchmark::State& state)
+{
+  instruction *item;
+  long long items = 0;
+
+  open_trace();
+  for (auto _ : state) {
+    if (!trace_get_item(&item)) {
+      rewind(trace_fd);
+      trace_get_item(&item);
+    }
+    benchmark::DoNotOptimize(item);
+    items++;
+  }
+  trace_uninit();
+  state.counters["insts_per_sec"] = benchmark::Counter(items, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_TraceGetItem);
+
+/** Returns a 32KB CacheCore with 64B blocks of the given associativity.
+ * If fixed, it is the FixedCacheCore from CacheCore::create. */
+static CacheCore *make_core(uint32_t assoc, bool fixed)
+{
+  if (fixed) return CacheCore::create(32 * 1024, assoc, 64, "LRU");
+  return new CacheCore(32 * 1024, assoc, 64, "LRU");
+}
+
+/** A cache that the footprint fits in, so every accessLine hits once
+ * warm.  Arguments are the associativity and whether it is fixed. */
+static void BM_CacheCoreAccessLine(benchmark::State& state)
+{
+  std::unique_ptr<CacheCore> core(make_core(state.range(0), state.range(1)));
+  std::vector<uint32_t> addrs(4096);
+  for (size_t i = 0; i < addrs.size(); i++) addrs[i] = (i * 97 % 512) * 64;
+  uint32_t rplcAddr;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    if (!core->accessLine(addrs[i])) core->allocateLine(addrs[i], &rplcAddr);
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(core->accessLine(addrs[i]));
+    i = (i + 1) % addrs.size();
+  }
+  state.counters["accesses_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_CacheCoreAccessLine)->ArgNames({"assoc", "fixed"})->ArgsProduct({{1, 2, 4, 8, 16}, {0, 1}});
+
+/** A cache streamed through, so every access misses and allocates.
+ * Arguments are as in BM_CacheCoreAccessLine. */
+static void BM_CacheCoreAllocateLine(benchmark::State& state)
+{
+  std::unique_ptr<CacheCore> core(make_core(state.range(0), state.range(1)));
+  uint32_t addr = 0;
+
+  for (auto _ : state) {
+    uint32_t rplcAddr;
+    if (!core->accessLine(addr)) {
+      CacheLine *l = core->allocateLine(addr, &rplcAddr);
+      l->makeDirty();
+    }
+    addr += 64;
+  }
+  state.counters["accesses_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_CacheCoreAllocateLine)->ArgNames({"assoc", "fixed"})->ArgsProduct({{1, 2, 4, 8, 16}, {0, 1}});
+
+static const char *chain_config =
+  "[L1]\ndeviceType=cache\nsize=32768\nassoc=4\nbsize=64\nwritePolicy=WB\nreplPolicy=LRU\nhitDelay=2\nlowerLevel=L2\n"
+  "[L2]\ndeviceType=cache\nsize=262144\nassoc=8\nbsize=64\nwritePolicy=WB\nreplPolicy=LRU\nhitDelay=10\nlowerLevel=L3\n"
+  "[L3]\ndeviceType=cache\nsize=2097152\nassoc=16\nbsize=64\nwritePolicy=WB\nreplPolicy=LRU\nhitDelay=30\nlowerLevel=Memory\n"
+  "[Memory]\ndeviceType=dram\nhitDelay=100\nlowerLevel=null\n";
+
+/** Reads and writes through L1/L2/L3/DRAM over a 4MB footprint. */
+static void BM_CacheChainAccess(benchmark::State& state)
+{
+  quiet_parse_config(NULL, chain_config);
+  MemObj *l1 = MemObj::create("L1");
+  std::vector<uint32_t> addrs = make_addrs(1 << 16, 4 * 1024 * 1024);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    MemRequest mreq(addrs[i], i % 3 == 0 ? MemWrite : MemRead);
+    l1->access(&mreq);
+    benchmark::DoNotOptimize(mreq.getLatency());
+    i = (i + 1) % addrs.size();
+  }
+  state.counters["accesses_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  teardown_config();
+}
+BENCHMARK(BM_CacheChainAccess);
+
+/** Resets the pipeline latches and counters in CPU.c */
+static void reset_pipeline()
+{
+  cycle_number = 0;
+  inst_number = 0;
+  mem_stall_cycles = 0;
+  branch_stall_cycles = 0;
+  IF.clear();
+  ID.clear();
+  WB.clear();
+  EX_ALU = MEM_ALU = EX_lwsw = MEM_lwsw = get_NOP();
+}
+
+/** The main loop of five_stage over the benchmark trace.  The config is
+ * parsed once, so caches stay warm across iterations. */
+static void BM_FiveStage(benchmark::State& state, const char *config_file_name)
+{
+  long long insts = 0;
+
+  quiet_parse_config(config_file_name, NULL);
+  for (auto _ : state) {
+    state.PauseTiming();
+    reset_pipeline();
+    open_trace();
+    state.ResumeTiming();
+
+    while (1) {
+      cycle_number++;
+      writeback();
+      memory();
+      issue();
+      decode();
+      fetch();
+      if (is_finished()) break;
+    }
+
+    state.PauseTiming();
+    insts += inst_number;
+    trace_uninit();
+    state.ResumeTiming();
+  }
+  state.counters["insts_per_sec"] = benchmark::Counter(insts, benchmark::Counter::kIsRate);
+  teardown_config();
+}
+BENCHMARK_CAPTURE(BM_FiveStage, l1_wb, "confs/l1-wb.conf")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FiveStage, l1_wt, "confs/l1-wt.conf")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FiveStage, l1_wb_tage, "bp_confs/l1-wb-tage.conf")->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
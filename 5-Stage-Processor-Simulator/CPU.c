@@ -12,15 +12,8 @@
 
 #include <inttypes.h>
 #include <assert.h>
-#include "CPU.h"
-#include "trace.h"
-
-unsigned int cycle_number = 0;
-unsigned int inst_number = 0;
-
-std::deque<dynamic_inst> IF, ID, WB;
-dynamic_inst EX_ALU = {0}, MEM_ALU = {0};
-dynamic_inst EX_lwsw = {0}, MEM_lwsw = {0};
+#include <string.h>
+#include "Simulator.h"
 
 bool is_ALU(dynamic_inst dinst) {
   instruction inst = dinst.inst;
@@ -46,14 +39,17 @@ dynamic_inst get_NOP() {
   return dinst;
 }
 
-bool is_finished()
+/* Returns the index of the first free unit, or -1 if all n are busy */
+int free_unit(uint32_t busy, int n) {
+  uint32_t free = ~busy & ((1u << n) - 1);
+  return free ? __builtin_ctz(free) : -1;
+}
+
+bool Simulator::is_finished()
 {
   /* Finished when pipeline is completely empty */
-  if (IF.size() > 0 || ID.size() > 0) return 0;
-  if (!is_NOP(EX_ALU) || !is_NOP(MEM_ALU) || !is_NOP(EX_lwsw) || !is_NOP(MEM_lwsw)) {
-    return 0;
-  }
-  return 1;
+  return IF.size() == 0 && ID.size() == 0 &&
+         (ex_alu_busy | mem_alu_busy | ex_lwsw_busy | mem_lwsw_busy) == 0;
 }
 
 bool is_taken(dynamic_inst dinst) {
@@ -75,272 +71,351 @@ bool has_second_operand(dynamic_inst dinst) {
   return dinst.inst.type == ti_RTYPE || dinst.inst.type == ti_STORE || dinst.inst.type == ti_BRANCH;
 }
 
-bool data_hazard_check_wb()
-{
-  bool result = 0;
-  if ( has_dest_operand(MEM_ALU) )
-    if ( has_dest_operand(MEM_lwsw) && MEM_ALU.inst.dReg == MEM_lwsw.inst.dReg )
-      return 1;
-  return result;
+void Simulator::new_stage_scan() {
+  if (++cur_stamp == 0) {
+    memset(written_stamp, 0, sizeof(written_stamp));
+    cur_stamp = 1;
+  }
+}
+
+/* Records that dinst is ahead of the rest of the instructions being scanned */
+void Simulator::mark_stage_scan(const dynamic_inst &dinst) {
+  if (has_dest_operand(dinst))
+    written_stamp[dinst.inst.dReg] = cur_stamp;
+}
+
+/* Returns the data hazard cause for instruction n of stage waiting on reg
+ * written by an instruction ahead of it in the same stage */
+stall_cause stage_producer_cause(Latch<dynamic_inst, MAX_WIDTH> &stage, int n, unsigned char reg) {
+  while (--n >= 0)
+    if (has_dest_operand(stage[n]) && stage[n].inst.dReg == reg)
+      break;
+  assert(n >= 0);
+  return stage[n].inst.type == ti_LOAD ? STALL_DATA_LOAD : STALL_DATA_ALU;
+}
+
+/* Returns true if reg is not ready for instruction n in ID being checked */
+bool Simulator::reg_busy_ex(unsigned char reg, int n) {
+  if (written_stamp[reg] == cur_stamp) {
+    hazard_cause = stage_producer_cause(ID, n, reg);
+    return 1;
+  }
+  if (pending_loads[reg] > 0) {
+    hazard_cause = STALL_DATA_LOAD;
+    return 1;
+  }
+  return 0;
 }
 
-int data_hazard_check_ex() {
-  unsigned char sReg_a, sReg_b;
-  int ret, i, j, k;
-  
-  ret = 0;
+/* Returns how many instructions at the head of ID can issue when data
+ * forwarding is enabled: they must not depend on an earlier instruction in
+ * ID, nor on a load in MEM (use-after-load). */
+int Simulator::data_hazard_check_ex() {
+  int ret;
 
-  for ( i = 0; i < (int) ID.size(); i++ )
+  new_stage_scan();
+  for ( ret = 0; ret < (int) ID.size(); ret++ )
   {
-    if ( has_first_operand(ID[i]) )
-	{
-	  for ( j = 0; j < i; j++ )
-	  {
-	    if ( has_dest_operand(ID[j]) ) 
-		{
-		  sReg_a = ID[i].inst.sReg_a;
-		  if ( sReg_a == ID[j].inst.dReg )
-		    return ret;
-		}
-	  }
-	  
-	  if ( MEM_lwsw.inst.type == ti_LOAD && ID[i].inst.sReg_a == MEM_lwsw.inst.dReg )
-	    return ret;
-	}
-	
-	if ( has_second_operand (ID[i]) )
-	{
-	  for ( k = 0; k < i; k++ )
-	  {
-	    if ( has_dest_operand(ID[k]) )
-		{
-		  sReg_b = ID[i].inst.sReg_b;
-		  if ( sReg_b == ID[k].inst.dReg )
-		    return ret;
-		}
-	  }
-	  
-	  if ( MEM_lwsw.inst.type == ti_LOAD && ID[i].inst.sReg_b == MEM_lwsw.inst.dReg )
-	    return ret;
-	}
-	
-	ret++;
+    const dynamic_inst &dinst = ID[ret];
+    if ( has_first_operand(dinst) && reg_busy_ex(dinst.inst.sReg_a, ret) )
+      return ret;
+    if ( has_second_operand(dinst) && reg_busy_ex(dinst.inst.sReg_b, ret) )
+      return ret;
+    mark_stage_scan(dinst);
   }
-  
   return ret;
 }
 
-int data_hazard_check_id()
-{
-  int ret, i, j, k, m; 
-  unsigned char sReg_a;
-  unsigned char sReg_b;
+/* Returns true if reg is not ready for instruction n in IF being checked */
+bool Simulator::reg_busy_id(unsigned char reg, int n) {
+  if (written_stamp[reg] == cur_stamp) {
+    hazard_cause = stage_producer_cause(IF, n, reg);
+    return 1;
+  }
+  if (!config->enableForwarding && pending_writes[reg] > 0) {
+    hazard_cause = last_writer_load[reg] ? STALL_DATA_LOAD : STALL_DATA_ALU;
+    return 1;
+  }
+  return 0;
+}
 
-  ret = 0;
+/* Returns how many instructions at the head of IF can move to ID: they must
+ * not depend on an earlier instruction in IF and, without data forwarding,
+ * on any instruction still in ID, EX, MEM or WB. */
+int Simulator::data_hazard_check_id()
+{
+  int ret;
 
-  for ( i = 0; i < (int)IF.size(); ++i )
+  new_stage_scan();
+  for ( ret = 0; ret < (int)IF.size(); ++ret )
   {
-    if ( has_first_operand(IF[i]) )
-    {
-      sReg_a = IF[i].inst.sReg_a;
-      for ( j = 0; j < i; ++j )
-        if ( has_dest_operand(IF[j]) )
-          if ( sReg_a == IF[j].inst.dReg )
-            return ret;
-      if (!config->enableForwarding)
-      {
-        for ( k = 0; k < (int)ID.size(); ++k )
-          if ( has_dest_operand(ID[k]) )
-            if ( sReg_a == ID[k].inst.dReg)
-              return ret;
-        if ( has_dest_operand(EX_ALU) && sReg_a == EX_ALU.inst.dReg )
-          return ret;
-        if ( has_dest_operand(EX_lwsw) && sReg_a == EX_lwsw.inst.dReg )
-          return ret;
-        if ( has_dest_operand(MEM_ALU) && sReg_a == MEM_ALU.inst.dReg )
-          return ret;
-        if ( has_dest_operand(MEM_lwsw) && sReg_a == MEM_lwsw.inst.dReg )
-          return ret;
-        for ( m = 0; m < (int)WB.size(); ++m )
-          if ( has_dest_operand(WB[m]) )
-            if (sReg_a == WB[m].inst.dReg )
-              return ret;
-      }
-    }
-
-    if ( has_second_operand(IF[i]) )
-    {
-      sReg_b = IF[i].inst.sReg_b;
-	   for ( j = 0; j < i; ++j )
-        if ( has_dest_operand(IF[j]) )
-          if (sReg_b == IF[j].inst.dReg )
-            return ret;
-      if (!config->enableForwarding)
-      {
-        for ( k = 0; k < (int)ID.size(); ++k )
-          if ( has_dest_operand(ID[k]) )
-            if ( sReg_b == ID[k].inst.dReg)
-              return ret;
-        if ( has_dest_operand(EX_ALU) && sReg_b == EX_ALU.inst.dReg )
-          return ret;
-        if ( has_dest_operand(EX_lwsw) && sReg_b == EX_lwsw.inst.dReg )
-          return ret;
-        if ( has_dest_operand(MEM_ALU) && sReg_b == MEM_ALU.inst.dReg )
-          return ret;
-        if ( has_dest_operand(MEM_lwsw) && sReg_b == MEM_lwsw.inst.dReg )
-          return ret;
-        for ( m = 0; m < (int)WB.size(); ++m )
-          if ( has_dest_operand(WB[m]) )
-            if (sReg_b == WB[m].inst.dReg )
-              return ret;
-      }
-    }
-    ++ret;
+    const dynamic_inst &dinst = IF[ret];
+    if ( has_first_operand(dinst) && reg_busy_id(dinst.inst.sReg_a, ret) )
+      return ret;
+    if ( has_second_operand(dinst) && reg_busy_id(dinst.inst.sReg_b, ret) )
+      return ret;
+    mark_stage_scan(dinst);
   }
   return ret;
 }
 
-bool control_hazard_check() {
-  int i, j;
-  dynamic_inst dinst;
-  
-  for ( i = 0; i < (int) IF.size() ; i++ )
-  {
-    if ( is_taken(IF[i]) )
-	  return 0;
-  }
-  
-  if ( !config->branchTargetBuffer )
-  {
-    for ( j = 0; j < (int) ID.size(); j++ )
-	{
-	  if ( is_taken(ID[j]) )
-	    return 0;
-	}
+bool Simulator::control_hazard_check() {
+  if ( taken_in_if > 0 || (!config->branchPredictor && taken_in_ex > 0) ) {
+    hazard_cause = STALL_TAKEN_BRANCH;
+    return 0;
   }
-  
-  if ( !config->branchPredictor )
-  {
-    dinst = EX_ALU;
-	
-	if ( is_taken(dinst) )
-	  return 0;
-	  
-	dinst = EX_lwsw;
+  if ( !config->branchTargetBuffer && taken_in_id > 0 ) {
+    hazard_cause = STALL_BTB_MISS;
+    return 0;
   }
-  
   return 1;
 }
 
-int  writeback()
+/* Empties a MEM unit and marks it free */
+void Simulator::free_mem_slot(dynamic_inst *slot)
+{
+  if (slot >= MEM_ALU && slot < MEM_ALU + MAX_UNITS)
+    mem_alu_busy &= ~(1u << (slot - MEM_ALU));
+  else
+    mem_lwsw_busy &= ~(1u << (slot - MEM_lwsw));
+  *slot = get_NOP();
+}
+
+void Simulator::reset()
 {
-  static unsigned int cur_seq = 1;
+  cycle_number = 0;
+  inst_number = 0;
+  IF.clear();
+  ID.clear();
   WB.clear();
-  
-  if (config->regFileWritePorts == 1  && 
-      has_dest_operand(MEM_ALU) && 
-      has_dest_operand(MEM_lwsw) 
-      || 
-      data_hazard_check_wb() )
-	  {
-          if ( is_older(MEM_ALU, MEM_lwsw) )
-          {
-            WB.push_back(MEM_ALU);
-            MEM_ALU = get_NOP();
-            WB.push_back(get_NOP());
-          }
-          else 
-          { 
-            WB.push_back(MEM_lwsw);
-            MEM_lwsw = get_NOP();
-            WB.push_back(get_NOP());
-          }
-	  }
-  
-  else {
-    if (is_older(MEM_ALU, MEM_lwsw))
-    {
-      WB.push_back(MEM_ALU);
-      MEM_ALU = get_NOP();
-      WB.push_back(MEM_lwsw);
-      MEM_lwsw = get_NOP();
+  for (int i = 0; i < MAX_UNITS; i++)
+    EX_ALU[i] = MEM_ALU[i] = EX_lwsw[i] = MEM_lwsw[i] = get_NOP();
+  ex_alu_busy = mem_alu_busy = ex_lwsw_busy = mem_lwsw_busy = 0;
+  taken_in_if = taken_in_id = taken_in_ex = 0;
+  fetch_seq = retire_seq = 1;
+  memset(lost_slots, 0, sizeof(lost_slots));
+  fetch_cause = decode_cause = hazard_cause = STALL_DRAIN;
+  memset(pending_writes, 0, sizeof(pending_writes));
+  memset(pending_loads, 0, sizeof(pending_loads));
+  memset(last_writer_load, 0, sizeof(last_writer_load));
+  memset(written_stamp, 0, sizeof(written_stamp));
+  cur_stamp = 0;
+}
+
+Simulator::Simulator(Config *config)
+  : config(config)
+{
+  reset();
+}
+
+Simulator::~Simulator()
+{
+  g_slice_free (Config, config);
+}
+
+bool Simulator::step()
+{
+  if (cycle_number > 0 && is_finished())
+    return true;  /* nothing left to simulate */
+
+  cycle_number++;
+
+  if (debug) {/* print cycle number if debug=1 */
+    printf("[CYCLE NUMBER: %d]\n", cycle_number);
+  }
+
+  /* move instructions one stage ahead */
+  writeback();
+  memory();
+  issue();
+  decode();
+  fetch();
+
+  if (debug) {/* print the pipeline contents if debug=1 */
+    print_pipeline();
+  }
+
+  return is_finished();
+}
+
+bool Simulator::step(unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++)
+    if (step()) return true;
+  return cycle_number > 0 && is_finished();
+}
+
+void Simulator::run()
+{
+  while (!step())
+    ;
+}
+
+sim_stats Simulator::stats() const
+{
+  sim_stats st;
+
+  st.cycles = cycle_number;
+  st.insts = inst_number;
+  memcpy(st.lost_slots, lost_slots, sizeof(lost_slots));
+  return st;
+}
+
+int Simulator::writeback()
+{
+  dynamic_inst *mem[2 * MAX_UNITS];
+  int n = 0, i, j, ports = 0;
+  uint32_t busy;
+
+  /* The previous cycle's instructions leave WB */
+  for (i = 0; i < (int)WB.size(); i++)
+    if (has_dest_operand(WB[i]))
+      pending_writes[WB[i].inst.dReg]--;
+  WB.clear();
+
+  /* Gather the instructions in MEM, oldest first */
+  for (busy = mem_alu_busy; busy; busy &= busy - 1)
+    mem[n++] = &MEM_ALU[__builtin_ctz(busy)];
+  for (busy = mem_lwsw_busy; busy; busy &= busy - 1)
+    mem[n++] = &MEM_lwsw[__builtin_ctz(busy)];
+  for (i = 1; i < n; i++)
+    for (j = i; j > 0 && is_older(*mem[j], *mem[j - 1]); j--) {
+      dynamic_inst *tmp = mem[j];
+      mem[j] = mem[j - 1];
+      mem[j - 1] = tmp;
     }
-    else
-    {
-      WB.push_back(MEM_lwsw);
-      MEM_lwsw = get_NOP();
-      WB.push_back(MEM_ALU);
-      MEM_ALU = get_NOP();
+
+  /* Retire in order until we run out of register file write ports or hit a
+   * second write to the same register in this cycle */
+  for (i = 0; i < n; i++) {
+    if (has_dest_operand(*mem[i])) {
+      if (config->regFileWritePorts > 0 && ports == config->regFileWritePorts)
+        break;
+      for (j = 0; j < (int)WB.size(); j++)
+        if (has_dest_operand(WB[j]) && WB[j].inst.dReg == mem[i]->inst.dReg)
+          break;
+      if (j < (int)WB.size())
+        break;
+      ports++;
     }
-  }	
-	
+    if (mem[i]->inst.type == ti_LOAD)
+      pending_loads[mem[i]->inst.dReg]--;
+    WB.push_back(*mem[i]);
+    free_mem_slot(mem[i]);
+  }
+  while ((int)WB.size() < config->aluUnits + config->lsUnits)
+    WB.push_back(get_NOP());
+
   if (verbose) {/* print the instruction exiting the pipeline if verbose=1 */
     for (int i = 0; i < (int) WB.size(); i++) {
       printf("[%d: WB] %s\n", cycle_number, get_instruction_string(WB[i], true));
       if(!is_NOP(WB[i])) {
-        if(config->pipelineWidth > 1 && config->regFileWritePorts == 1) {
+        if(config->pipelineWidth > 1 &&
+           (config->regFileWritePorts == 1 || config->aluUnits + config->lsUnits > 2)) {
           // There is a corner case where an instruction without a
-          // destination register can get pulled in out of sequence but
-          // other than that, it should be strictly in-order.
+          // destination register can get pulled in out of sequence, and
+          // with more than one unit of a kind an instruction stuck in EX
+          // can be overtaken.  Other than that, it should be strictly
+          // in-order.
         } else {
-          assert(WB[i].seq == cur_seq);
+          assert(WB[i].seq == retire_seq);
         }
-        cur_seq++;
+        retire_seq++;
       }
     }
   }
   return WB.size();
 }
 
-int memory()
+int Simulator::memory()
 {
-  int insts = 0;
-  if (is_NOP(MEM_ALU)) {
-    MEM_ALU = EX_ALU;
-    EX_ALU = get_NOP();
-    insts++;
+  /* Units whose MEM stage is free take the instruction from EX */
+  uint32_t alu_moving = ex_alu_busy & ~mem_alu_busy;
+  uint32_t lwsw_moving = ex_lwsw_busy & ~mem_lwsw_busy;
+  uint32_t busy;
+  int i;
+
+  for (busy = alu_moving; busy; busy &= busy - 1) {
+    i = __builtin_ctz(busy);
+    if (is_taken(EX_ALU[i]))
+      taken_in_ex--;
+    MEM_ALU[i] = EX_ALU[i];
+    EX_ALU[i] = get_NOP();
   }
-  if (is_NOP(MEM_lwsw)) {
-    MEM_lwsw = EX_lwsw;
-    EX_lwsw = get_NOP();
-    insts++;
+  for (busy = lwsw_moving; busy; busy &= busy - 1) {
+    i = __builtin_ctz(busy);
+    if (EX_lwsw[i].inst.type == ti_LOAD)
+      pending_loads[EX_lwsw[i].inst.dReg]++;
+    MEM_lwsw[i] = EX_lwsw[i];
+    EX_lwsw[i] = get_NOP();
   }
-  return insts;
+  mem_alu_busy |= alu_moving;
+  ex_alu_busy &= ~alu_moving;
+  mem_lwsw_busy |= lwsw_moving;
+  ex_lwsw_busy &= ~lwsw_moving;
+  return __builtin_popcount(alu_moving) + __builtin_popcount(lwsw_moving);
 }
 
-int issue()
+int Simulator::issue()
 {
-  int i;
+  int i, unit, reads;
   int ready_insts = ID.size();
+  int read_ports = 0;
+  /* Units still busy now were held up because MEM could not write back */
+  uint32_t alu_held = ex_alu_busy, lwsw_held = ex_lwsw_busy;
+  stall_cause cause = decode_cause;
 
   if ( config->enableForwarding )
     ready_insts = data_hazard_check_ex();
+  if ( ready_insts < (int)ID.size() )
+    cause = hazard_cause;
 
   for (i = 0; i < ready_insts; ++i)
   {
+    /* Structural hazard on the register file read ports */
+    reads = has_first_operand(ID.front()) + has_second_operand(ID.front());
+    if (config->regFileReadPorts > 0 && read_ports + reads > config->regFileReadPorts) {
+      cause = STALL_READ_PORTS;
+      break;
+    }
+
     if (is_ALU(ID.front()))
     {
-      if (!is_NOP(EX_ALU))
-        return i;
-      EX_ALU = ID.front();
+      unit = free_unit(ex_alu_busy, config->aluUnits);
+      if (unit < 0) {
+        cause = alu_held ? STALL_WRITE_PORTS : STALL_UNITS;
+        break;
+      }
+      if (is_taken(ID.front())) {
+        taken_in_id--;
+        taken_in_ex++;
+      }
+      EX_ALU[unit] = ID.front();
+      ex_alu_busy |= 1u << unit;
       ID.pop_front();
+      read_ports += reads;
     }
     else if (is_lwsw(ID.front()))
     {
-      if (!is_NOP(EX_lwsw))
-        return i;
-      EX_lwsw = ID.front();
+      unit = free_unit(ex_lwsw_busy, config->lsUnits);
+      if (unit < 0) {
+        cause = lwsw_held ? STALL_WRITE_PORTS : STALL_UNITS;
+        break;
+      }
+      EX_lwsw[unit] = ID.front();
+      ex_lwsw_busy |= 1u << unit;
       ID.pop_front();
+      read_ports += reads;
     }
   }
+  lost_slots[cause] += config->pipelineWidth - i;
   return i;
 }
 
-int decode()
+int Simulator::decode()
 {
   int ready_insts, i;
-  ready_insts = data_hazard_check_id();
-  
+
   if ( config->enableForwarding )
 	ready_insts = IF.size();
   else
@@ -348,36 +423,55 @@ int decode()
 
   for (i = 0; i < ready_insts && (int)ID.size() < config->pipelineWidth; ++i )
   {
+    if (has_dest_operand(IF.front())) {
+      pending_writes[IF.front().inst.dReg]++;
+      last_writer_load[IF.front().inst.dReg] = IF.front().inst.type == ti_LOAD;
+    }
+    if (is_taken(IF.front())) {
+      taken_in_if--;
+      taken_in_id++;
+    }
     ID.push_back(IF.front());
     IF.pop_front();
   }
+  if ( (int)ID.size() < config->pipelineWidth )
+    decode_cause = IF.size() > 0 ? hazard_cause : fetch_cause;
   return i;
 }
 
-int fetch()
+int Simulator::fetch()
 {
-  static unsigned int cur_seq = 1;
   int insts = 0;
   dynamic_inst dinst;
   instruction *tr_entry = NULL;
 
   //! Struct hazard with Mem
-    if ( !config->splitCaches && MEM_lwsw.inst.type == ti_LOAD )
-      return 0;
+  if ( !config->splitCaches )
+    for ( uint32_t busy = mem_lwsw_busy; busy; busy &= busy - 1 )
+      if ( MEM_lwsw[__builtin_ctz(busy)].inst.type == ti_LOAD ) {
+        fetch_cause = STALL_SPLIT_CACHES;
+        return 0;
+      }
 
   /* copy trace entry(s) into IF stage */
   while ((int)IF.size() < config->pipelineWidth)
   {
-    if (!control_hazard_check())
+    if (!control_hazard_check()) {
+      fetch_cause = hazard_cause;
       break;
-    size_t size = trace_get_item(&tr_entry); /* put the instruction into a buffer */
-    if (size <= 0)
+    }
+    size_t size = trace_src.get_item(&tr_entry); /* put the instruction into a buffer */
+    if (size <= 0) {
+      fetch_cause = STALL_DRAIN;
       break;
+    }
 
     // Add new instr to queue
     dinst.inst = *tr_entry;
-    dinst.seq = cur_seq++;
+    dinst.seq = fetch_seq++;
     IF.push_back(dinst);
+    if (is_taken(dinst))
+      taken_in_if++;
     insts++;
 
     if (verbose) /* print the instruction entering the pipeline if verbose=1 */
@@ -1,8 +1,8 @@
 #ifndef CPU_H
 #define CPU_H
 
-#include <deque>
 #include "config.h"
+#include "Latch.h"
 
 enum opcode {
 	ti_NOP = 0,
@@ -16,6 +16,9 @@ enum opcode {
 	ti_JRTYPE
 };
 
+/* Registers are named by an unsigned char */
+#define NUM_REGS 256
+
 typedef struct {
 	unsigned char type;		// see above
 	unsigned char sReg_a;		// 1st operand
@@ -30,21 +33,23 @@ typedef struct {
 	unsigned int seq;		// dynamic sequence number (important for in-order commit)
 } dynamic_inst;
 
-extern unsigned int cycle_number;
-extern unsigned int inst_number;
-
-extern std::deque<dynamic_inst> IF, ID, WB;
-extern dynamic_inst EX_ALU, MEM_ALU;
-extern dynamic_inst EX_lwsw, MEM_lwsw;
+/* Causes that an issue slot can be lost to.  Every cycle the issue stage has
+ * pipelineWidth slots; each one not filled with an instruction is charged to
+ * exactly one cause, so instructions plus lost slots equal width * cycles. */
+typedef enum {
+  STALL_DRAIN = 0,      // filling the pipeline at the start, draining at the end
+  STALL_DATA_ALU,       // waiting on the result of an ALU instruction
+  STALL_DATA_LOAD,      // waiting on the result of a load
+  STALL_UNITS,          // no free ALU or load/store unit
+  STALL_READ_PORTS,     // out of register file read ports
+  STALL_WRITE_PORTS,    // unit held by an instruction that could not write back
+  STALL_SPLIT_CACHES,   // fetch blocked by a load using the unified cache
+  STALL_TAKEN_BRANCH,   // fetch waiting for a taken branch to resolve
+  STALL_BTB_MISS,       // fetch waiting for a taken branch target from ID
+  NUM_STALL_CAUSES
+} stall_cause;
 
-bool is_finished();
 bool is_NOP(dynamic_inst dinst);
 dynamic_inst get_NOP();
 
-int writeback();
-int memory();
-int issue();
-int decode();
-int fetch();
-
 #endif /* #define CPU_H */
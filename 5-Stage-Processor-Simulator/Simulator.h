@@ -0,0 +1,126 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdint.h>
+#include "config.h"
+#include "CPU.h"
+#include "Latch.h"
+#include "trace.h"
+
+/* What a simulation has done so far */
+typedef struct {
+  unsigned int cycles;
+  unsigned int insts;
+  unsigned long long lost_slots[NUM_STALL_CAUSES];  // see stall_cause
+} sim_stats;
+
+/* One simulation of the five stage pipeline.  It owns its configuration,
+ * pipeline state and trace source and shares nothing with other Simulators,
+ * so any number of them can run in one process, in one thread or in many.
+ *
+ *   Simulator sim(parse_config("confs/2-wide.conf"));
+ *   if (!sim.trace().open("traces/sample.tr")) ...
+ *   sim.run();
+ *   printf("%u cycles\n", sim.stats().cycles);
+ *
+ * The stages are implemented in CPU.c. */
+class Simulator {
+public:
+  /* Takes ownership of config, which must come from parse_config or
+   * read_config */
+  Simulator(Config *config);
+  ~Simulator();
+  Simulator(const Simulator &) = delete;
+  Simulator &operator=(const Simulator &) = delete;
+
+  /* The trace the pipeline fetches from.  It has to be opened or shared
+   * before the first step. */
+  Trace &trace() { return trace_src; }
+  const Config &get_config() const { return *config; }
+
+  /* Moves the pipeline forward one cycle.  Returns true once it is empty. */
+  bool step();
+  /* Moves the pipeline forward up to n cycles.  Returns true once it is
+   * empty. */
+  bool step(unsigned int n);
+  /* Simulates until the trace is done and the pipeline is empty */
+  void run();
+  /* Empties the pipeline and clears all counters, to simulate again from
+   * wherever the trace is now */
+  void reset();
+  /* Whether the pipeline is empty, as it is before the first step and once
+   * the simulation is done */
+  bool is_finished();
+  sim_stats stats() const;
+
+  void print_pipeline();
+  void print_cpi_stack();
+
+  int writeback();
+  int memory();
+  int issue();
+  int decode();
+  int fetch();
+
+private:
+  Config *config;
+  Trace trace_src;
+
+  unsigned int cycle_number;
+  unsigned int inst_number;
+
+  Latch<dynamic_inst, MAX_WIDTH> IF, ID, WB;
+  /* Only the first config->aluUnits and config->lsUnits entries are used */
+  dynamic_inst EX_ALU[MAX_UNITS], MEM_ALU[MAX_UNITS];
+  dynamic_inst EX_lwsw[MAX_UNITS], MEM_lwsw[MAX_UNITS];
+
+  /* Occupancy of the units: bit i is set while unit i holds an instruction,
+   * so the stages only visit the units that are busy.  Taken branches in IF,
+   * ID and EX are counted for the same reason. */
+  uint32_t ex_alu_busy, mem_alu_busy;
+  uint32_t ex_lwsw_busy, mem_lwsw_busy;
+  int taken_in_if, taken_in_id, taken_in_ex;
+
+  /* Sequence numbers of the next instruction to be fetched and to retire */
+  unsigned int fetch_seq, retire_seq;
+
+  /* CPI stack.  Issue charges its empty slots to why it stopped; when it ran
+   * out of instructions in ID, that is why decode did not fill ID the cycle
+   * before, which in turn may be why fetch did not fill IF.  hazard_cause is
+   * set by the hazard checks for the stage that called them. */
+  unsigned long long lost_slots[NUM_STALL_CAUSES];
+  stall_cause fetch_cause, decode_cause;
+  stall_cause hazard_cause;
+
+  /* Register scoreboard.  Instead of scanning the pipeline for producers on
+   * every check, it counts the in-flight producers of each register and is
+   * updated as instructions move between stages. */
+
+  /* Number of instructions in ID, EX, MEM or WB that write each register.
+   * Incremented when an instruction enters ID and decremented when it leaves
+   * WB. */
+  int pending_writes[NUM_REGS];
+  /* Number of loads in MEM that write each register.  Incremented when a
+   * load enters MEM and decremented when it leaves MEM. */
+  int pending_loads[NUM_REGS];
+  /* Whether the last instruction to enter ID that writes each register was a
+   * load */
+  bool last_writer_load[NUM_REGS];
+
+  /* Registers written by the instructions ahead of the one being checked in
+   * the same stage are those whose stamp equals cur_stamp, so starting a new
+   * scan of a stage only takes a cur_stamp increment. */
+  unsigned int written_stamp[NUM_REGS];
+  unsigned int cur_stamp;
+
+  void new_stage_scan();
+  void mark_stage_scan(const dynamic_inst &dinst);
+  bool reg_busy_ex(unsigned char reg, int n);
+  int data_hazard_check_ex();
+  bool reg_busy_id(unsigned char reg, int n);
+  int data_hazard_check_id();
+  bool control_hazard_check();
+  void free_mem_slot(dynamic_inst *slot);
+};
+
+#endif /* #define SIMULATOR_H */
@@ -6,14 +6,15 @@
 #include <assert.h>
 #include "config.h"
 
-Config *config;
 bool verbose = false;
 bool debug = false;
 
-int parse_config(const char *config_file_name)
+/* Returns a new configuration with the settings in config_file_name */
+Config *parse_config(const char *config_file_name)
 {
   GKeyFile *keyfile;
   GError *error = NULL;
+  Config *config;
 
   /* Create a new GKeyFile object and a bitwise list of flags. */
   keyfile = g_key_file_new ();
@@ -22,19 +23,41 @@ int parse_config(const char *config_file_name)
   if (!g_key_file_load_from_file (keyfile, config_file_name, G_KEY_FILE_NONE, &error))
   {
     g_error (error->message);
-    return 0;
+    return NULL;
   }
 
-  config = g_slice_new (Config);
+  config = read_config (keyfile);
+  g_key_file_free (keyfile);
+
+  return config;
+}
+
+/* Returns a new configuration with the settings in keyfile */
+Config *read_config(GKeyFile *keyfile)
+{
+  Config *config = g_slice_new (Config);
 
   config->pipelineWidth = g_key_file_get_integer (keyfile, "pipeline", "width", NULL);
-  assert(config->pipelineWidth <= 2);  // fetch width > 2 is not supported
+  assert(config->pipelineWidth >= 1 && config->pipelineWidth <= MAX_WIDTH);
+
+  /* One ALU and one load/store unit unless configured otherwise */
+  config->aluUnits = 1;
+  if (g_key_file_has_key (keyfile, "structural hazard", "aluUnits", NULL))
+    config->aluUnits = g_key_file_get_integer (keyfile, "structural hazard", "aluUnits", NULL);
+  config->lsUnits = 1;
+  if (g_key_file_has_key (keyfile, "structural hazard", "lsUnits", NULL))
+    config->lsUnits = g_key_file_get_integer (keyfile, "structural hazard", "lsUnits", NULL);
+  assert(config->aluUnits >= 1 && config->aluUnits <= MAX_UNITS);
+  assert(config->lsUnits >= 1 && config->lsUnits <= MAX_UNITS);
+  assert(config->aluUnits + config->lsUnits <= MAX_WIDTH);
 
   config->splitCaches = g_key_file_get_boolean (keyfile, "structural hazard", "splitCaches", NULL);
+  config->regFileReadPorts = g_key_file_get_integer (keyfile, "structural hazard", "regFileReadPorts", NULL);
   config->regFileWritePorts = g_key_file_get_integer (keyfile, "structural hazard", "regFileWritePorts", NULL);
+  assert(config->regFileReadPorts >= 0 && config->regFileWritePorts >= 0);
   config->enableForwarding = g_key_file_get_boolean (keyfile, "data hazard", "enableForwarding", NULL);
   config->branchPredictor = g_key_file_get_boolean (keyfile, "control hazard", "branchPredictor", NULL);
   config->branchTargetBuffer = g_key_file_get_boolean (keyfile, "control hazard", "branchTargetBuffer", NULL);
 
-  return 1;
+  return config;
 }
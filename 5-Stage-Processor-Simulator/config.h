@@ -4,19 +4,27 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 
+/* Maximum pipeline width.  Also bounds WB, which holds an entry per unit. */
+#define MAX_WIDTH 32
+/* Maximum number of ALUs and of load/store units */
+#define MAX_UNITS 16
+
 typedef struct
 {
   int pipelineWidth;
+  int aluUnits;            // number of EX/MEM ALU slots
+  int lsUnits;             // number of EX/MEM load/store slots
   bool splitCaches;
-  int regFileWritePorts;
+  int regFileReadPorts;    // 0 means as many as needed
+  int regFileWritePorts;   // 0 means as many as needed
   bool enableForwarding;
   bool branchPredictor;
   bool branchTargetBuffer;
 } Config;
 
-int parse_config(const char *config_file_name);
+Config *parse_config(const char *config_file_name);
+Config *read_config(GKeyFile *keyfile);
 
-extern Config *config;
 extern bool verbose;
 extern bool debug;
 
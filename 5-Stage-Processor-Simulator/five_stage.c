@@ -1,7 +1,7 @@
 /** Code by @author Wonsun Ahn
  * 
- * Main function. Parses commandline arguments and invokes the five stages in
- * CPU.c at every clock cycle.
+ * Main function. Parses commandline arguments and runs a Simulator over the
+ * trace.
  */
 
 #include <stdio.h>
@@ -13,8 +13,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
-#include "CPU.h" 
-#include "trace.h" 
+#include "Simulator.h"
 
 void print_usage_info()
 {
@@ -23,17 +22,98 @@ void print_usage_info()
   printf("  -h           this help screen.\n");
   printf("  -v           verbose output (shows each instruction).\n");
   printf("  -d           debug output (shows pipeline on each cycle).\n");
+  printf("  -s           prints a CPI stack of where issue slots were lost.\n");
+  printf("  -p file      simulates only the intervals picked by simpoint into file.\n");
+  printf("  -w n         with -p, instructions of warm-up before each interval (default: 10000).\n");
   printf("  -c file      [Required] uses file as configuration file.\n");
   printf("  -t file      [Required] uses file as input trace file.\n");
 }
 
+/* Simulates only the intervals listed in the simpoints file.  Before each
+ * interval, the trace is skipped up to warmup instructions ahead of it and
+ * those are simulated to fill the pipeline, without counting their cycles.
+ * The base pipeline keeps no state beyond the instructions in flight, so
+ * there is nothing to warm up functionally while skipping.  The interval's
+ * cycles are counted from when its first instruction is fetched until the
+ * pipeline drains.  The IPC is estimated from the weighted CPIs. */
+void run_sampled(Simulator &sim, const char *simpoints_file_name, unsigned long long warmup)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  GError *error = NULL;
+  gsize num_intervals, num_weights;
+  instruction *tr_entry;
+
+  if (!g_key_file_load_from_file (keyfile, simpoints_file_name, G_KEY_FILE_NONE, &error)) {
+    g_error (error->message);
+  }
+  unsigned long long interval_size = g_key_file_get_uint64 (keyfile, "simpoints", "intervalSize", NULL);
+  unsigned long long total_insts = g_key_file_get_uint64 (keyfile, "simpoints", "totalInsts", NULL);
+  gint *intervals = g_key_file_get_integer_list (keyfile, "simpoints", "intervals", &num_intervals, NULL);
+  gdouble *weights = g_key_file_get_double_list (keyfile, "simpoints", "weights", &num_weights, NULL);
+  if (interval_size == 0 || !intervals || !weights || num_intervals != num_weights) {
+    fprintf(stderr, "\nError while parsing simpoints file %s.\n\n", simpoints_file_name);
+    exit(1);
+  }
+
+  unsigned long long pos = 0;  /* trace items read so far */
+  double cpi = 0, total_weight = 0;
+  for (gsize i = 0; i < num_intervals; i++) {
+    unsigned long long start = (unsigned long long)intervals[i] * interval_size;
+    unsigned long long warm_start = start > warmup ? start - warmup : 0;
+    if (warm_start < pos)
+      warm_start = pos;  /* the previous interval ran up to here */
+    for (; pos < warm_start; pos++)
+      if (!sim.trace().get_item(&tr_entry)) break;
+
+    sim.reset();
+    sim.trace().set_limit(start - warm_start + interval_size);
+    unsigned int interval_start_cycle = 0;
+    bool started = false;  /* interval_start_cycle can itself be 0 */
+    while (!sim.step()) {
+      if (!started && sim.stats().insts > start - warm_start) {
+        interval_start_cycle = sim.stats().cycles - 1;
+        started = true;
+      }
+    }
+    sim.trace().set_limit(-1);
+    sim_stats st = sim.stats();
+    pos += st.insts;
+    if (st.insts <= start - warm_start)
+      break;  /* the trace ended before the interval */
+
+    unsigned int insts = st.insts - (start - warm_start);
+    cpi += weights[i] * (st.cycles - interval_start_cycle) / insts;
+    total_weight += weights[i];
+    if (verbose) {
+      printf("+ Interval %d : weight %0.4f, IPC %0.4f\n", intervals[i], weights[i],
+             (float)insts / (float)(st.cycles - interval_start_cycle));
+    }
+  }
+  if (total_weight == 0) {
+    fprintf(stderr, "\nNo interval in simpoints file %s is in the trace.\n\n", simpoints_file_name);
+    exit(1);
+  }
+  cpi /= total_weight;
+
+  printf("+ Simulated intervals : %d of %llu instructions with %llu warm-up\n", (int)num_intervals, interval_size, warmup);
+  printf("+ Number of cycles (estimated) : %.0f\n", cpi * total_insts);
+  printf("+ IPC (Instructions Per Cycle) : %0.4f\n", 1 / cpi);
+
+  g_free(intervals);
+  g_free(weights);
+  g_key_file_free(keyfile);
+}
+
 int main(int argc, char **argv)
 {
   char *trace_file_name = NULL;
   char *config_file_name = NULL;
+  bool cpi_stack = false;
+  char *simpoints_file_name = NULL;
+  unsigned long long warmup = 10000;
   
   char c;
-  while ((c = getopt (argc, argv, "hvdc:t:")) != -1) {
+  while ((c = getopt (argc, argv, "hvdsc:t:p:w:")) != -1) {
     switch (c) {
       case 'h':
         print_usage_info();
@@ -45,14 +125,23 @@ int main(int argc, char **argv)
         debug = true;
         verbose = true;
         break;
+      case 's':
+        cpi_stack = true;
+        break;
       case 't':
         trace_file_name = optarg;
         break;
       case 'c':
         config_file_name = optarg;
         break;
+      case 'p':
+        simpoints_file_name = optarg;
+        break;
+      case 'w':
+        warmup = strtoull(optarg, NULL, 10);
+        break;
       case '?':
-        if (optopt == 't' || optopt == 'c')
+        if (optopt == 't' || optopt == 'c' || optopt == 'p' || optopt == 'w')
           fprintf (stderr, "Option -%c requires an argument.\n", optopt);
         else if (isprint (optopt))
           fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -71,50 +160,31 @@ int main(int argc, char **argv)
     exit(1);
   }
 
-  if (!parse_config(config_file_name)) {
+  Config *config = parse_config(config_file_name);
+  if (!config) {
     fprintf(stderr, "\nError while parsing config file %s.\n\n", trace_file_name);
     exit(1);
   }
+  Simulator sim(config);
 
-  trace_fd = fopen(trace_file_name, "rb");
-
-  if (!trace_fd) {
+  if (!sim.trace().open(trace_file_name)) {
     fprintf(stderr, "\nError while opening trace file %s.\n\n", trace_file_name);
     exit(1);
   }
 
-  trace_init();
-
-  while(1) {
-    /* move the pipeline forward */
-    cycle_number++;
-
-    if (debug) {/* print cycle number if debug=1 */
-      printf("[CYCLE NUMBER: %d]\n", cycle_number);
-    }
-
-    /* move instructions one stage ahead */
-    writeback();
-    memory();
-    issue();
-    decode();
-    fetch();
-
-    if (debug) {/* print the pipeline contents if debug=1 */
-      print_pipeline();
-    }
-
-    if (is_finished()) {
-      /* all instructions simulated to completion */
-      printf("+ Number of cycles : %u\n", cycle_number);
-      printf("+ IPC (Instructions Per Cycle) : %0.4f\n", (float)inst_number / (float)cycle_number);
-      break;
-    }
+  if (simpoints_file_name) {
+    run_sampled(sim, simpoints_file_name, warmup);
+    return 0;
   }
 
-  trace_uninit();
+  sim.run();
+
+  /* all instructions simulated to completion */
+  sim_stats st = sim.stats();
+  printf("+ Number of cycles : %u\n", st.cycles);
+  printf("+ IPC (Instructions Per Cycle) : %0.4f\n", (float)st.insts / (float)st.cycles);
+  if (cpi_stack)
+    sim.print_cpi_stack();
 
   return 0;
 }
-
-
@@ -0,0 +1,310 @@
+/**
+ * Picks representative intervals of a trace for sampled simulation, in the
+ * manner of SimPoint.
+ *
+ * The trace is cut into intervals of a fixed number of instructions.  Each
+ * interval is summarized by its basic block vector: how many of its
+ * instructions fall in each basic block, where a basic block starts at the
+ * first instruction and after every branch or jump and is named by its first
+ * PC.  Each vector is normalized by the interval length and randomly
+ * projected down to PROJECTED_DIMS dimensions, so no table of blocks is
+ * kept.  The vectors are clustered with k-means, and the interval closest to
+ * the center of each cluster is chosen to stand for it, weighted by the
+ * share of the instructions in the cluster.  The result is written as a
+ * GKeyFile that five_stage reads with -p.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <float.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <vector>
+#include "CPU.h"
+#include "trace.h"
+
+/* Dimensions of the randomly projected basic block vectors */
+#define PROJECTED_DIMS 15
+
+typedef struct {
+  double v[PROJECTED_DIMS];
+} point;
+
+static std::vector<point> bbvs;
+static std::vector<unsigned long long> lengths;
+static uint64_t rng_state;
+
+void print_usage_info()
+{
+  printf("USAGE: simpoint [OPTIONS]\n");
+  printf("Picks representative intervals of an instruction trace file for five_stage -p.\n\n");
+  printf("  -h           this help screen.\n");
+  printf("  -i n         interval size in instructions (default: 100000).\n");
+  printf("  -k n         number of clusters, at most one interval is picked per cluster (default: 10).\n");
+  printf("  -r n         number of k-means runs from different random starts (default: 5).\n");
+  printf("  -s seed      random seed (default: 1).\n");
+  printf("  -t file      [Required] uses file as input trace file.\n");
+  printf("  -o file      [Required] writes the picked intervals and weights to file.\n");
+}
+
+/* Returns a uniformly random double in [0, 1) */
+double rand_double()
+{
+  rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Returns the projection of basic block pc onto dimension d: a value in
+ * [-1, 1) that is always the same for the same pc and d */
+double projection(uint32_t pc, int d)
+{
+  uint64_t x = ((uint64_t)pc << 8 | d) * 0x9E3779B97F4A7C15ULL;
+  x ^= x >> 31;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 29;
+  return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+bool ends_basic_block(const instruction *inst)
+{
+  return inst->type == ti_BRANCH || inst->type == ti_JTYPE || inst->type == ti_JRTYPE;
+}
+
+/* Reads the trace into bbvs and lengths, one entry per interval */
+void read_intervals(Trace &trace, unsigned long long interval_size)
+{
+  instruction *tr_entry = NULL;
+  uint32_t block_pc = 0;
+  bool block_start = true;
+  point cur = {{0}};
+  unsigned long long n = 0;
+
+  while (trace.get_item(&tr_entry)) {
+    if (block_start) {
+      block_pc = tr_entry->PC;
+      block_start = false;
+    }
+    for (int d = 0; d < PROJECTED_DIMS; d++)
+      cur.v[d] += projection(block_pc, d);
+    block_start = ends_basic_block(tr_entry);
+
+    if (++n == interval_size) {
+      for (int d = 0; d < PROJECTED_DIMS; d++)
+        cur.v[d] /= n;
+      bbvs.push_back(cur);
+      lengths.push_back(n);
+      memset(&cur, 0, sizeof(cur));
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    for (int d = 0; d < PROJECTED_DIMS; d++)
+      cur.v[d] /= n;
+    bbvs.push_back(cur);
+    lengths.push_back(n);
+  }
+}
+
+double distance2(const point &a, const point &b)
+{
+  double sum = 0;
+  for (int d = 0; d < PROJECTED_DIMS; d++)
+    sum += (a.v[d] - b.v[d]) * (a.v[d] - b.v[d]);
+  return sum;
+}
+
+/* Clusters bbvs into k clusters starting from k-means++ seeds.  Fills in the
+ * cluster of each interval and returns the sum of squared distances to the
+ * cluster centers. */
+double kmeans(int k, std::vector<int> &cluster, std::vector<point> &centers)
+{
+  size_t n = bbvs.size();
+  std::vector<double> dist(n, DBL_MAX);
+
+  /* k-means++: each next seed is picked with probability proportional to
+   * its squared distance from the nearest seed so far */
+  centers.assign(1, bbvs[(size_t)(rand_double() * n)]);
+  while ((int)centers.size() < k) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+      double d = distance2(bbvs[i], centers.back());
+      if (d < dist[i]) dist[i] = d;
+      total += dist[i];
+    }
+    if (total == 0) break;
+    double r = rand_double() * total;
+    size_t i = 0;
+    while (i < n - 1 && (r -= dist[i]) >= 0) i++;
+    centers.push_back(bbvs[i]);
+  }
+  k = centers.size();
+
+  cluster.assign(n, -1);
+  for (int iter = 0; iter < 100; iter++) {
+    bool changed = false;
+    for (size_t i = 0; i < n; i++) {
+      int best = 0;
+      for (int c = 1; c < k; c++)
+        if (distance2(bbvs[i], centers[c]) < distance2(bbvs[i], centers[best]))
+          best = c;
+      if (best != cluster[i]) {
+        cluster[i] = best;
+        changed = true;
+      }
+    }
+    if (!changed) break;
+
+    /* Move every center to the mean of its intervals.  An empty cluster
+     * keeps its center. */
+    std::vector<point> sums(k);
+    std::vector<int> counts(k, 0);
+    memset(sums.data(), 0, sizeof(point) * k);
+    for (size_t i = 0; i < n; i++) {
+      for (int d = 0; d < PROJECTED_DIMS; d++)
+        sums[cluster[i]].v[d] += bbvs[i].v[d];
+      counts[cluster[i]]++;
+    }
+    for (int c = 0; c < k; c++)
+      if (counts[c] > 0)
+        for (int d = 0; d < PROJECTED_DIMS; d++)
+          centers[c].v[d] = sums[c].v[d] / counts[c];
+  }
+
+  double sse = 0;
+  for (size_t i = 0; i < n; i++)
+    sse += distance2(bbvs[i], centers[cluster[i]]);
+  return sse;
+}
+
+int main(int argc, char **argv)
+{
+  char *trace_file_name = NULL;
+  char *output_file_name = NULL;
+  unsigned long long interval_size = 100000;
+  int k = 10, runs = 5;
+  uint64_t seed = 1;
+
+  char c;
+  while ((c = getopt (argc, argv, "hi:k:r:s:t:o:")) != -1) {
+    switch (c) {
+      case 'h':
+        print_usage_info();
+        return 0;
+      case 'i':
+        interval_size = strtoull(optarg, NULL, 10);
+        break;
+      case 'k':
+        k = atoi(optarg);
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 't':
+        trace_file_name = optarg;
+        break;
+      case 'o':
+        output_file_name = optarg;
+        break;
+      case '?':
+        if (strchr("ikrsto", optopt))
+          fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+        else if (isprint (optopt))
+          fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+          fprintf (stderr,
+                   "Unknown option character `\\x%x'.\n",
+                   optopt);
+        return 1;
+      default:
+        abort ();
+    }
+  }
+
+  if (trace_file_name == NULL || output_file_name == NULL || interval_size == 0 || k < 1 || runs < 1) {
+    print_usage_info();
+    exit(1);
+  }
+
+  Trace trace;
+  if (!trace.open(trace_file_name)) {
+    fprintf(stderr, "\nError while opening trace file %s.\n\n", trace_file_name);
+    exit(1);
+  }
+  read_intervals(trace, interval_size);
+  trace.close();
+  if (bbvs.empty()) {
+    fprintf(stderr, "\nTrace file %s is empty.\n\n", trace_file_name);
+    exit(1);
+  }
+  if (k > (int)bbvs.size())
+    k = bbvs.size();
+
+  /* Keep the clustering with the least squared error */
+  std::vector<int> cluster, best_cluster;
+  std::vector<point> centers, best_centers;
+  double best_sse = DBL_MAX;
+  rng_state = seed;
+  for (int r = 0; r < runs; r++) {
+    double sse = kmeans(k, cluster, centers);
+    if (sse < best_sse) {
+      best_sse = sse;
+      best_cluster = cluster;
+      best_centers = centers;
+    }
+  }
+
+  /* Pick the interval closest to each center and weigh it by the share of
+   * instructions in its cluster */
+  k = best_centers.size();
+  unsigned long long total_insts = 0;
+  std::vector<unsigned long long> cluster_insts(k, 0);
+  std::vector<int> rep(k, -1);
+  for (size_t i = 0; i < bbvs.size(); i++) {
+    int cl = best_cluster[i];
+    total_insts += lengths[i];
+    cluster_insts[cl] += lengths[i];
+    if (rep[cl] < 0 || distance2(bbvs[i], best_centers[cl]) < distance2(bbvs[rep[cl]], best_centers[cl]))
+      rep[cl] = i;
+  }
+
+  /* Intervals are listed in trace order so five_stage can skip forward */
+  std::vector<int> order;
+  for (int cl = 0; cl < k; cl++)
+    if (rep[cl] >= 0)
+      order.push_back(cl);
+  for (size_t i = 1; i < order.size(); i++)
+    for (size_t j = i; j > 0 && rep[order[j]] < rep[order[j - 1]]; j--) {
+      int tmp = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = tmp;
+    }
+
+  FILE *out = fopen(output_file_name, "w");
+  if (!out) {
+    fprintf(stderr, "\nError while opening output file %s.\n\n", output_file_name);
+    exit(1);
+  }
+  fprintf(out, "# Picked by simpoint from %s\n", trace_file_name);
+  fprintf(out, "[simpoints]\n\n");
+  fprintf(out, "intervalSize=%llu\n", interval_size);
+  fprintf(out, "totalInsts=%llu\n", total_insts);
+  fprintf(out, "intervals=");
+  for (size_t i = 0; i < order.size(); i++)
+    fprintf(out, "%s%d", i ? ";" : "", rep[order[i]]);
+  fprintf(out, "\nweights=");
+  for (size_t i = 0; i < order.size(); i++)
+    fprintf(out, "%s%0.6f", i ? ";" : "", (double)cluster_insts[order[i]] / total_insts);
+  fprintf(out, "\n");
+  fclose(out);
+
+  printf("+ Intervals : %zu of %llu instructions\n", bbvs.size(), interval_size);
+  printf("+ Simulation points : %zu\n", order.size());
+  return 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * Runs the five stage pipeline over every point of a grid of configurations.
+ *
+ * The grid is a configuration file in which any value may be a ';' separated
+ * list.  Every combination of the listed values is a point.  The trace is
+ * read and decoded once, and the points are simulated in parallel threads
+ * that replay it from memory.  The results are printed as one table, one row
+ * per point, in the order the points are listed (last key varies fastest).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <assert.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Simulator.h"
+
+/* A key of the grid and the values it takes */
+typedef struct {
+  std::string group;
+  std::string key;
+  std::vector<std::string> values;
+} axis;
+
+static std::vector<axis> axes;
+static size_t num_points = 1;
+static instruction *trace_items;
+static size_t num_trace_items;
+static std::vector<sim_stats> results;
+static std::atomic<size_t> next_point(0);
+
+void print_usage_info()
+{
+  printf("USAGE: five_stage_sweep [OPTIONS]\n");
+  printf("Runs a CPU simulation for every configuration in a grid over one instruction trace file.\n\n");
+  printf("  -h           this help screen.\n");
+  printf("  -j threads   number of simulations to run in parallel (default: all cores).\n");
+  printf("  -c file      [Required] uses file as grid configuration file.\n");
+  printf("  -t file      [Required] uses file as input trace file.\n");
+}
+
+/* Reads every key of the grid file into axes */
+void parse_grid(const char *grid_file_name)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  GError *error = NULL;
+
+  if (!g_key_file_load_from_file (keyfile, grid_file_name, G_KEY_FILE_NONE, &error)) {
+    g_error (error->message);
+  }
+
+  gsize num_groups, num_keys, num_values;
+  gchar **groups = g_key_file_get_groups (keyfile, &num_groups);
+  for (gsize i = 0; i < num_groups; i++) {
+    gchar **keys = g_key_file_get_keys (keyfile, groups[i], &num_keys, NULL);
+    for (gsize j = 0; j < num_keys; j++) {
+      gchar **values = g_key_file_get_string_list (keyfile, groups[i], keys[j], &num_values, NULL);
+      axis a;
+      a.group = groups[i];
+      a.key = keys[j];
+      for (gsize k = 0; k < num_values; k++) {
+        g_strstrip(values[k]);
+        if (strlen(values[k]) > 0)
+          a.values.push_back(values[k]);
+      }
+      if (a.values.empty()) {
+        fprintf(stderr, "\nKey %s in [%s] has no values.\n\n", keys[j], groups[i]);
+        exit(1);
+      }
+      num_points *= a.values.size();
+      axes.push_back(a);
+      g_strfreev(values);
+    }
+    g_strfreev(keys);
+  }
+  g_strfreev(groups);
+  g_key_file_free(keyfile);
+}
+
+/* Returns the index into axes[a].values of the value at point p */
+size_t value_index(size_t p, size_t a)
+{
+  for (size_t i = axes.size() - 1; i > a; i--)
+    p /= axes[i].values.size();
+  return p % axes[a].values.size();
+}
+
+/* Simulates points until there are none left */
+void run_points()
+{
+  size_t p;
+
+  while ((p = next_point++) < num_points) {
+    GKeyFile *keyfile = g_key_file_new ();
+    for (size_t a = 0; a < axes.size(); a++)
+      g_key_file_set_string (keyfile, axes[a].group.c_str(), axes[a].key.c_str(),
+                             axes[a].values[value_index(p, a)].c_str());
+    Simulator sim(read_config (keyfile));
+    g_key_file_free (keyfile);
+
+    sim.trace().share(trace_items, num_trace_items);
+    sim.run();
+    results[p] = sim.stats();
+  }
+}
+
+/* Prints one row per point with the value of every key that varies */
+void print_results()
+{
+  std::vector<size_t> shown;
+  std::vector<int> widths;
+
+  for (size_t a = 0; a < axes.size(); a++) {
+    if (axes[a].values.size() == 1) continue;
+    int w = axes[a].key.size();
+    for (size_t v = 0; v < axes[a].values.size(); v++)
+      if ((int)axes[a].values[v].size() > w) w = axes[a].values[v].size();
+    shown.push_back(a);
+    widths.push_back(w);
+  }
+
+  for (size_t i = 0; i < shown.size(); i++)
+    printf("%*s ", widths[i], axes[shown[i]].key.c_str());
+  printf("%12s %12s %8s\n", "insts", "cycles", "IPC");
+  for (size_t p = 0; p < num_points; p++) {
+    for (size_t i = 0; i < shown.size(); i++)
+      printf("%*s ", widths[i], axes[shown[i]].values[value_index(p, shown[i])].c_str());
+    printf("%12u %12u %8.4f\n", results[p].insts, results[p].cycles,
+           (float)results[p].insts / (float)results[p].cycles);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  char *trace_file_name = NULL;
+  char *grid_file_name = NULL;
+  int num_threads = std::thread::hardware_concurrency();
+
+  char c;
+  while ((c = getopt (argc, argv, "hj:c:t:")) != -1) {
+    switch (c) {
+      case 'h':
+        print_usage_info();
+        return 0;
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 't':
+        trace_file_name = optarg;
+        break;
+      case 'c':
+        grid_file_name = optarg;
+        break;
+      case '?':
+        if (optopt == 't' || optopt == 'c' || optopt == 'j')
+          fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+        else if (isprint (optopt))
+          fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+          fprintf (stderr,
+                   "Unknown option character `\\x%x'.\n",
+                   optopt);
+        return 1;
+      default:
+        abort ();
+    }
+  }
+
+  if (grid_file_name == NULL || trace_file_name == NULL) {
+    print_usage_info();
+    exit(1);
+  }
+  if (num_threads < 1)
+    num_threads = 1;
+
+  parse_grid(grid_file_name);
+  results.resize(num_points);
+
+  FILE *fd = fopen(trace_file_name, "rb");
+  if (!fd) {
+    fprintf(stderr, "\nError while opening trace file %s.\n\n", trace_file_name);
+    exit(1);
+  }
+  trace_items = trace_read_all(fd, &num_trace_items);
+  fclose(fd);
+
+  if ((size_t)num_threads > num_points)
+    num_threads = num_points;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++)
+    threads.push_back(std::thread(run_points));
+  for (int i = 0; i < num_threads; i++)
+    threads[i].join();
+
+  print_results();
+
+  free(trace_items);
+  return 0;
+}
@@ -6,12 +6,8 @@
 #include <inttypes.h>
 #include <assert.h>
 #include "trace.h"
-#include "CPU.h"
+#include "Simulator.h"
 
-FILE *trace_fd;
-static int trace_buf_ptr;
-static int trace_buf_end;
-static instruction *trace_buf;
 static FILE *out_fd;
 
 int is_big_endian(void)
@@ -30,46 +26,150 @@ uint32_t my_ntohl(uint32_t x)
 	return (uint32_t)(s[3] << 24 | s[2] << 16 | s[1] << 8 | s[0]);
 }
 
-void trace_init()
+bool Trace::open(const char *file_name)
 {
-	trace_buf = (instruction *) malloc(sizeof(instruction) * TRACE_BUFSIZE);
+	close();
+	fd = fopen(file_name, "rb");
+	if (!fd) return false;
 
-	if (!trace_buf) {
+	bufs = (instruction *) malloc(sizeof(instruction) * TRACE_BUFSIZE * TRACE_NUM_BUFS);
+
+	if (!bufs) {
 		fprintf(stdout, "** trace_buf not allocated\n");
 		exit(-1);
 	}
 
-	trace_buf_ptr = 0;
-	trace_buf_end = 0;
+	buf = NULL;
+	buf_ptr = 0;
+	buf_end = 0;
+	shared = false;
+	items_left = -1;
+	taken = 0;
+	at_end = false;
+	filled = 0;
+	released = 0;
+	stopping = false;
+	reader = std::thread(&Trace::read_ahead, this);
+	return true;
 }
 
-void trace_uninit()
+void Trace::close()
 {
-	free(trace_buf);
-	fclose(trace_fd);
+	if (reader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		ready.notify_all();
+		reader.join();
+	}
+	if (!shared) {
+		free(bufs);
+		if (fd) fclose(fd);
+	}
+	fd = NULL;
+	buf = bufs = NULL;
+	buf_ptr = buf_end = 0;
+	shared = false;
 }
 
-int trace_get_item(instruction **item)
+/* Body of the reader thread: fills each buffer in turn as soon as get_item
+ * has released it, until the end of the file.  An empty buffer marks the
+ * end. */
+void Trace::read_ahead()
 {
-	int n_items;
+	for (unsigned long i = 0; ; i++) {
+		if (i >= released.load(std::memory_order_acquire) + TRACE_NUM_BUFS) {
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [&] { return stopping || i < released + TRACE_NUM_BUFS; });
+		}
+		if (stopping) return;
 
-	if (trace_buf_ptr == trace_buf_end) {	/* if no more unprocessed items in the trace buffer, get new data  */
-		n_items = fread(trace_buf, sizeof(instruction), TRACE_BUFSIZE, trace_fd);
-		if (!n_items) return 0;				/* if no more items in the file, we are done */
+		instruction *b = bufs + (i % TRACE_NUM_BUFS) * TRACE_BUFSIZE;
+		int n_items = fread(b, sizeof(instruction), TRACE_BUFSIZE, fd);
+		if (is_big_endian()) {
+			for (int j = 0; j < n_items; j++) {
+				b[j].PC = my_ntohl(b[j].PC);
+				b[j].Addr = my_ntohl(b[j].Addr);
+			}
+		}
+		buf_items[i % TRACE_NUM_BUFS] = n_items;
 
-		trace_buf_ptr = 0;
-		trace_buf_end = n_items;			/* n_items were read and placed in trace buffer */
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			filled.store(i + 1, std::memory_order_release);
+		}
+		ready.notify_all();
+		if (n_items == 0) return;	/* if no more items in the file, we are done */
 	}
+}
 
-	*item = &trace_buf[trace_buf_ptr];	/* read a new trace item for processing */
-	trace_buf_ptr++;
+/* Releases the buffer get_item is done with and takes the next one from the
+ * reader thread.  Returns false at the end of the trace. */
+bool Trace::next_buffer()
+{
+	if (shared || !fd || at_end) return false;
+
+	if (taken > 0) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			released.store(taken, std::memory_order_release);
+		}
+		ready.notify_all();
+	}
+	if (filled.load(std::memory_order_acquire) <= taken) {
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [&] { return filled > taken; });
+	}
+
+	int idx = taken++ % TRACE_NUM_BUFS;
+	if (buf_items[idx] == 0) {
+		at_end = true;
+		return false;
+	}
+	buf = bufs + idx * TRACE_BUFSIZE;
+	buf_ptr = 0;
+	buf_end = buf_items[idx];
+	return true;
+}
+
+/* Reads all of the trace in fd into one array, already in host byte order,
+ * so that it can be replayed any number of times with Trace::share */
+instruction *trace_read_all(FILE *fd, size_t *n_items)
+{
+	size_t cap = TRACE_BUFSIZE, n = 0, got;
+	instruction *items = (instruction *) malloc(sizeof(instruction) * cap);
+
+	while (items && (got = fread(items + n, sizeof(instruction), cap - n, fd)) > 0) {
+		n += got;
+		if (n == cap) {
+			cap *= 2;
+			items = (instruction *) realloc(items, sizeof(instruction) * cap);
+		}
+	}
+	if (!items) {
+		fprintf(stdout, "** trace_buf not allocated\n");
+		exit(-1);
+	}
 
 	if (is_big_endian()) {
-		(*item)->PC = my_ntohl((*item)->PC);
-		(*item)->Addr = my_ntohl((*item)->Addr);
+		for (size_t i = 0; i < n; i++) {
+			items[i].PC = my_ntohl(items[i].PC);
+			items[i].Addr = my_ntohl(items[i].Addr);
+		}
 	}
+	*n_items = n;
+	return items;
+}
 
-	return 1;
+void Trace::share(instruction *items, size_t n_items)
+{
+	close();
+	buf = items;
+	buf_ptr = 0;
+	buf_end = n_items;
+	shared = true;
+	items_left = -1;
 }
 
 int write_trace(instruction item, char *fname)
@@ -140,40 +240,59 @@ void print_pipeline_row(dynamic_inst dinst, const char *stageName)
   printf("%s\n", stageName);
 }
 
-void print_pipeline()
+/* Prints the first n units, numbering them if there is more than one */
+void print_units(dynamic_inst *units, int n, const char *stageName)
+{
+  char name[32];
+  for (int i = 0; i < n; i++) {
+    if (n == 1) {
+      print_pipeline_row(units[i], stageName);
+    } else {
+      snprintf(name, sizeof(name), "%s%d", stageName, i);
+      print_pipeline_row(units[i], name);
+    }
+  }
+}
+
+void Simulator::print_pipeline()
 {
   printf("=================================================================================\n");
   // Print header
   printf("%45s ", "");
   printf("%s\n", "Pipeline Stage");
-  // Print each instruction currently in the pipeline
-  for (int i = 0; i < config->pipelineWidth; i++) {
+  // Print each instruction currently in the pipeline.  There may be more
+  // instructions leaving WB than the width if they piled up in MEM.
+  int wb_rows = config->pipelineWidth;
+  int wb_insts = 0;
+  for (int i = 0; i < (int)WB.size(); i++) {
+    if (!is_NOP(WB[i])) wb_insts++;
+  }
+  if (wb_insts > wb_rows) wb_rows = wb_insts;
+  for (int i = 0; i < wb_rows; i++) {
     if(i < (int)WB.size()) {
       print_pipeline_row(WB[i], "WB");
     } else {
       print_pipeline_row(get_NOP(), "WB");
     }
   }
-  if (config->pipelineWidth == 2) {
-    print_pipeline_row(MEM_ALU, "MEM_ALU");
-    print_pipeline_row(MEM_lwsw, "MEM_lwsw");
-    print_pipeline_row(EX_ALU, "EX_ALU");
-    print_pipeline_row(EX_lwsw, "EX_lwsw");
-  } else if (config->pipelineWidth == 1) {
-    if (!is_NOP(MEM_ALU)) {
-      assert(is_NOP(MEM_lwsw));
-      print_pipeline_row(MEM_ALU, "MEM");
+  if (config->pipelineWidth == 1 && config->aluUnits == 1 && config->lsUnits == 1) {
+    if (!is_NOP(MEM_ALU[0])) {
+      assert(is_NOP(MEM_lwsw[0]));
+      print_pipeline_row(MEM_ALU[0], "MEM");
     } else {
-      print_pipeline_row(MEM_lwsw, "MEM");
+      print_pipeline_row(MEM_lwsw[0], "MEM");
     }
-    if (!is_NOP(EX_ALU)) {
-      assert(is_NOP(EX_lwsw));
-      print_pipeline_row(EX_ALU, "EX");
+    if (!is_NOP(EX_ALU[0])) {
+      assert(is_NOP(EX_lwsw[0]));
+      print_pipeline_row(EX_ALU[0], "EX");
     } else {
-      print_pipeline_row(EX_lwsw, "EX");
+      print_pipeline_row(EX_lwsw[0], "EX");
     }
   } else {
-    assert(0);
+    print_units(MEM_ALU, config->aluUnits, "MEM_ALU");
+    print_units(MEM_lwsw, config->lsUnits, "MEM_lwsw");
+    print_units(EX_ALU, config->aluUnits, "EX_ALU");
+    print_units(EX_lwsw, config->lsUnits, "EX_lwsw");
   }
   for (int i = 0; i < config->pipelineWidth; i++) {
     if(i < (int)ID.size()) {
@@ -192,3 +311,27 @@ void print_pipeline()
   printf("=================================================================================\n");
 }
 
+/* Prints the CPI, split into the base CPI of a full-width pipeline and the
+ * share of each cause of lost issue slots */
+void Simulator::print_cpi_stack()
+{
+  static const char *names[NUM_STALL_CAUSES] = {
+    "Pipeline fill/drain",
+    "Data hazard on ALU result",
+    "Data hazard on load result",
+    "Structural: EX units",
+    "Structural: reg read ports",
+    "Structural: reg write ports",
+    "Structural: unified cache",
+    "Control: taken branch",
+    "Control: BTB miss",
+  };
+  double slots = (double)config->pipelineWidth * inst_number;
+
+  if (inst_number == 0) return;
+  printf("+ CPI stack (%d issue slots per cycle) :\n", config->pipelineWidth);
+  printf("+   %-28s : %0.4f\n", "Base", inst_number / slots);
+  for (int i = 0; i < NUM_STALL_CAUSES; i++)
+    printf("+   %-28s : %0.4f (%llu slots)\n", names[i], lost_slots[i] / slots, lost_slots[i]);
+  printf("+   %-28s : %0.4f\n", "Total", (float)cycle_number / (float)inst_number);
+}
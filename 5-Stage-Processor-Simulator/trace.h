@@ -1,20 +1,81 @@
 #ifndef TRACE_H
 #define TRACE_H
 
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "config.h"
 #include "CPU.h"
 
-#define TRACE_BUFSIZE 1024*1024
+#define TRACE_BUFSIZE 256*1024
+/* Number of buffers a trace file is read into ahead of the simulation */
+#define TRACE_NUM_BUFS 4
+
+/* A source of trace items for one simulation: either a trace file, or a
+ * whole trace already in memory (see trace_read_all) that any number of
+ * sources may share.
+ *
+ * A trace file is read by a thread of its own into TRACE_NUM_BUFS buffers in
+ * turn, so the simulation only waits on the file if it catches up with the
+ * reader.  The buffers are handed back and forth by counting them: buffer i
+ * (modulo TRACE_NUM_BUFS) holds items once filled > i and may be refilled
+ * once released > i.  Either side only sleeps, on ready, if the other is
+ * behind. */
+class Trace {
+  FILE *fd;
+  instruction *buf;     // the buffer items are being taken from
+  int buf_ptr;
+  int buf_end;
+  bool shared;          // whether buf is a whole trace shared with others
+  long long items_left; // items get_item may still return, or -1 for no limit
+
+  instruction *bufs;    // TRACE_NUM_BUFS buffers of TRACE_BUFSIZE items
+  int buf_items[TRACE_NUM_BUFS];
+  unsigned long taken;  // buffers taken by get_item so far
+  bool at_end;          // whether the reader has reached the end of the file
+  std::atomic<unsigned long> filled, released;
+  std::atomic<bool> stopping;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::thread reader;
+
+  void read_ahead();
+  bool next_buffer();
+
+public:
+  Trace() : fd(NULL), buf(NULL), buf_ptr(0), buf_end(0), shared(false), items_left(-1),
+            bufs(NULL), taken(0), at_end(false), filled(0), released(0), stopping(false) {}
+  ~Trace() { close(); }
+  Trace(const Trace &) = delete;
+  Trace &operator=(const Trace &) = delete;
+
+  /* Starts reading the trace file named file_name.  Returns false if it
+   * can't be opened. */
+  bool open(const char *file_name);
+  /* Replays n_items from trace_read_all.  The items are only read. */
+  void share(instruction *items, size_t n_items);
+  void close();
+  /* Points item at the next trace item and returns 1, or returns 0 at the end
+   * of the trace.  The item stays valid until the next call. */
+  int get_item(instruction **item)
+  {
+    if (items_left == 0) return 0;
+    if (buf_ptr == buf_end && !next_buffer()) return 0;
+    *item = &buf[buf_ptr++];
+    if (items_left > 0) items_left--;
+    return 1;
+  }
+  /* Makes get_item end the trace after n more items, or never if n < 0 */
+  void set_limit(long long n) { items_left = n; }
+};
 
 /* Trace related functions */
-extern FILE *trace_fd;
-void trace_init();
-void trace_uninit();
-int trace_get_item(instruction **item);
+instruction *trace_read_all(FILE *fd, size_t *n_items);
 int write_trace(instruction item, char *fname);
 
 /* Output related functions */
 char* get_instruction_string(dynamic_inst dinst, bool long_form);
-void print_pipeline();
 
 #endif /* #define TRACE_H */
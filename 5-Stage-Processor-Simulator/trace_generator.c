@@ -60,10 +60,10 @@ int main(int argc, char **argv)
     if (repeat == 0) write_trace(*tr_entry, trace_file_name);
   }
   printf("Now, the file \"%s\" contains the following instructions: \n", trace_file_name);
-  trace_fd = fopen(trace_file_name, "rb");
-  trace_init();
+  Trace trace;
+  trace.open(trace_file_name);
   while(1) {
-    size = trace_get_item(&tr_entry);
+    size = trace.get_item(&tr_entry);
    
     if (!size) 
       break; 
@@ -75,7 +75,7 @@ int main(int argc, char **argv)
     printf("%s\n", get_instruction_string(dinst, true));
   }
 
-  trace_uninit();
+  trace.close();
 
   exit(0);
 }
@@ -23,11 +23,11 @@ int main(int argc, char **argv)
     exit(0);
   }
   trace_file_name = argv[1];
-  trace_fd = fopen(trace_file_name, "rb");
-  trace_init();
+  Trace trace;
+  trace.open(trace_file_name);
 
   while(1) {
-    size = trace_get_item(&tr_entry);
+    size = trace.get_item(&tr_entry);
    
     if (!size) 
       break; 
@@ -39,7 +39,7 @@ int main(int argc, char **argv)
     printf("%s\n", get_instruction_string(dinst, true));
   }
 
-  trace_uninit();
+  trace.close();
 
   exit(0);
 }
@@ -3,21 +3,255 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <fuse.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cs1550.h"
 
+// What a path leads to, as found by lookup()
+struct cs1550_dentry
+{
+	// Number of fields sscanf matched: 1 for a directory, 2 or 3 for a file
+	int res;
+	// Whether the directory, or the file in it, exists
+	int exists;
+	// Block of the directory
+	size_t n_dir_block;
+	// Hash of the file's name, and the block its entry goes in: the
+	// directory's block, or in a hashed directory the leaf the hash picks
+	size_t hash;
+	size_t n_leaf_block;
+	// The file's slot in that block, and its index block
+	size_t n_file;
+	size_t n_index_block;
+};
+
+// A file's blocks in file order, as read from its index block by load_map()
+struct file_map
+{
+	// Runs of blocks, merged wherever they meet. A run starting at block 0 is a hole
+	struct cs1550_extent *extents;
+	size_t num_extents;
+	size_t max_extents;
+	// The index block, and the extent blocks chained to it
+	size_t *chain;
+	size_t chain_length;
+	// Whether store_map() has anything to write
+	int changed;
+};
+
 // Declare helper functions (see end of file)
-static struct cs1550_directory_entry * find_dir_entry(char dir_name[]);
 static struct cs1550_file_entry * find_file(struct cs1550_directory_entry *, char file_name[], char extension[]);
 static int check_path(const char *path);
 static int get_start_block(char dir_name[]);
+static void lookup(const char *path, struct cs1550_dentry *dentry, int exclusive);
+static void unlock_dentry(struct cs1550_dentry *dentry);
+static pthread_rwlock_t * dir_lock(size_t n_dir_block);
+static int dcache_get(const char *path, struct cs1550_dentry *dentry);
+static void dcache_put(const char *path, struct cs1550_dentry *dentry);
+static void dcache_forget(const char *path);
+static void dcache_clear(void);
+static int add_file(struct cs1550_dentry *dentry, char filename[], char extension[]);
+static struct open_file * find_open_file(size_t n_index_block);
+static struct open_file * get_open_file(struct cs1550_dentry *dentry);
+static void put_open_file(struct open_file *open_file);
+static int hold_file(const char *path, struct fuse_file_info *fi, struct open_file **open_file);
+static void drop_file(struct fuse_file_info *fi, struct open_file *open_file);
+static int find_file_by_index(struct cs1550_directory_entry *dir, size_t n_index_block);
+static size_t hash_name(const char *filename, const char *extension);
+static size_t find_leaf(size_t n_dir_block, size_t hash);
+static size_t dir_leaves(size_t n_dir_block, size_t *leaves);
+static int split_leaf(size_t n_dir_block, size_t hash);
+static void load_bitmap(void);
+static size_t alloc_block(size_t goal);
+static void reset_bit(size_t bit_num);
+static void free_block(size_t n_block);
+static void free_file_blocks(size_t n_index_block);
+static void load_map(size_t n_index_block, struct file_map *map);
+static size_t map_lookup(struct file_map *map, size_t n_file_block);
+static size_t map_lookup_run(struct file_map *map, size_t n_file_block, size_t *num_blocks);
+static void map_set(struct file_map *map, size_t n_file_block, size_t n_block);
+static int store_map(struct file_map *map);
+static void free_map(struct file_map *map);
+static int read_file(const char *path, char *buf, struct fuse_bufvec **bufv, size_t size,
+		     off_t offset, struct fuse_file_info *fi);
+static int write_file(const char *path, const char *buf, struct fuse_bufvec *bufv, size_t size,
+		      off_t offset, struct fuse_file_info *fi);
+static void store_root(void);
+static void load_superblock(void);
+static void store_bitmap(void);
+static void init_cache(void);
+static void read_block(size_t n_block, void *buf);
+static void read_blocks(size_t n_block, size_t offset, size_t size, char *buf, struct fuse_bufvec **bufv);
+static void add_buf(struct fuse_bufvec **bufv, void *mem, size_t size, int buf_fd, off_t pos);
+static int can_write_direct(size_t n_block);
+static int write_direct(struct fuse_bufvec *bufv, size_t n_block, size_t num_blocks);
+static void read_ahead(struct open_file *open_file, struct file_map *map, size_t offset, size_t size);
+static void write_block(size_t n_block, const void *buf);
+static void write_meta_block(size_t n_block, const void *buf);
+static void flush_cache(void);
+static void commit_if_due(void);
+static int commit_freed_blocks(void);
+static void replay_journal(void);
+static int journal_has(size_t n_block);
+static void journal_commit(void);
+static void journal_checkpoint(void);
+static void release_freed_blocks(void);
 
 // Dat root block
 struct cs1550_root_directory *root;
-// .disk file
-FILE *f;
+// .disk file. It's only read and written with pread and pwrite, so threads
+// don't share a file position
+int fd = -1;
+
+// Operations run on several threads at once. Their locks are taken in this
+// order, and each one is released before a lock earlier in the order is taken:
+//  - root_lock, for reading by every operation, and for writing by mkdir and
+//    rmdir, which change the directories in the root
+//  - an open file's lock, for reading to read the file, and for writing to
+//    write it
+//  - a directory's lock, for reading to look a file up, and for writing to
+//    change the directory's block
+// dcache_lock, open_files_lock and cache_lock are only held inside the helpers
+// that need them. Blocks are allocated with atomic operations on the bitmap.
+static pthread_rwlock_t root_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Directories share DIR_LOCKS locks, by block number
+#define DIR_LOCKS 64
+static pthread_rwlock_t dir_locks[DIR_LOCKS];
+
+// Layout of .disk, from its superblock, or the original layout if it has none
+static size_t block_size;
+static size_t n_root_block;
+static size_t max_files_in_dir;
+static size_t max_dirs_in_root;
+static size_t max_extents_in_block;
+// Whether directories may be hashed once their block is full, and the most
+// leaves the index of one has: the slots that fit in a block, down to a power of 2
+static int hashed_dirs;
+static size_t max_leaves_in_index;
+
+// Bytes of .disk kept in the buffer cache
+#define CACHE_SIZE (4 * 1024 * 1024)
+
+// Most bytes of a file asked for ahead of a sequential reader
+#define READAHEAD_MAX (1024 * 1024)
+
+// A block of .disk kept in memory. Blocks are written back to .disk only when
+// they are evicted or the cache is flushed, so repeated updates to the root,
+// directory and index blocks within an operation cost one write.
+struct cache_block
+{
+	size_t n_block;
+	int valid;
+	int dirty;
+	// Set on every use and cleared by the clock hand on its way round
+	int referenced;
+	// Set while the block is read in from .disk, without cache_lock held
+	int loading;
+	// Set when the block's changes go through the journal. Until they are
+	// committed the block is pinned: it can't be written in place
+	int journaled;
+	int pinned;
+	struct cache_block *next_in_bucket;
+	char *data;
+};
+
+// CACHE_SIZE bytes' worth of blocks, and a hash table of at least twice as
+// many buckets (a power of 2)
+static struct cache_block *cache;
+static size_t cache_blocks;
+static struct cache_block **cache_buckets;
+static size_t cache_buckets_mask;
+static size_t clock_hand;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled whenever a block has been read in
+static pthread_cond_t cache_loaded = PTHREAD_COND_INITIALIZER;
+// Number of pinned blocks
+static size_t pinned_blocks;
+
+// The journal's header block and the ring after it, from the superblock. A
+// ring of 0 blocks means there's no journal, and blocks are written in place
+static size_t journal_start;
+static size_t journal_ring;
+// Where the next transaction goes, and its sequence number
+static size_t journal_head;
+static size_t journal_sequence;
+// Where the transactions not written in place yet start
+static size_t journal_tail;
+// Set when transactions were committed since .disk was last synced
+static int journal_unsynced;
+// Set when data blocks were written in place since .disk was last synced
+static int data_unsynced;
+// Blocks that have a copy in the journal after the tail: a hash set of block
+// numbers plus one, with room for as many blocks as there are in the ring
+static size_t *journal_set;
+static size_t journal_set_mask;
+
+// Longest path check_path lets through, "/dir/file.ext"
+#define MAX_PATH (1 + MAX_FILENAME + 1 + MAX_FILENAME + 1 + MAX_EXTENSION)
+// Number of paths kept in the dentry cache (a power of 2)
+#define DCACHE_ENTRIES 1024
+
+// A path resolved by lookup(). Paths that don't exist are kept too, so a
+// storm of getattr calls for missing files doesn't scan the directories
+// either. Entries are forgotten whenever a directory or file is created.
+struct dcache_entry
+{
+	int valid;
+	char path[MAX_PATH + 1];
+	struct cs1550_dentry dentry;
+};
+
+static struct dcache_entry dcache[DCACHE_ENTRIES];
+static pthread_mutex_t dcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A file that is open. open() leaves a pointer to it in fi->fh, shared by
+// every open of the file, and read and write hold one for the call when
+// there's no handle. A file unlinked while it's open keeps its blocks until
+// it is released for the last time.
+struct open_file
+{
+	// The file's directory, and the hash of its name, which finds its entry
+	size_t n_dir_block;
+	size_t hash;
+	size_t n_index_block;
+	int n_opens;
+	int unlinked;
+	// Where the last read ended, and how far ahead of it to read when the
+	// next one starts there. Only hints, so readers update them unlocked
+	size_t next_read;
+	size_t readahead;
+	// Held while the file's map and data blocks are read or written
+	pthread_rwlock_t lock;
+	struct open_file *next;
+};
+
+static struct open_file *open_files;
+static pthread_mutex_t open_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Free-space bitmap: bit n is set while block n is in use. Block 0 (the
+// superblock or the root), the root and the bitmap's own blocks are always
+// in use, so a clear bit 0 means the bitmap has to be built.
+static unsigned char *bitmap;
+// Number of blocks in .disk, and the bitmap's first block and length
+static size_t n_disk_blocks;
+static size_t bitmap_start;
+static size_t bitmap_blocks;
+// Which bitmap blocks changed since they were last written to the cache
+static unsigned char *bitmap_dirty;
+// With a journal, the blocks freed since the last commit, with their bits still
+// set in bitmap so they aren't written over while a crash could bring back the
+// metadata that used them. The bitmap written to the cache has them cleared
+static unsigned char *bitmap_freed;
+static size_t freed_blocks;
+// Where the next allocation starts looking, kept in the root block as
+// last_allocated_block when the root is written
+static size_t last_allocated;
 
 /**
  * Called whenever the system wants to know the file attributes, including
@@ -45,15 +279,15 @@ static int cs1550_getattr(const char *path, struct stat *statbuf)
 		return 0;
 	}
 
-	char directory[MAX_FILENAME + 1];
-	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
-	int res;
-	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
-	int size;
+	pthread_rwlock_rdlock(&root_lock);
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 0);
+
+	// Unless it's found below, the path doesn't exist.
+	int ret = -ENOENT;
 
 	// Check if the path is a file.
-	if (res == 2 || res == 3) 
+	if ((dentry.res == 2 || dentry.res == 3) && dentry.exists) 
 	{
 		// Regular file
 		statbuf->st_mode = S_IFREG | 0666;
@@ -61,52 +295,25 @@ static int cs1550_getattr(const char *path, struct stat *statbuf)
 		// Only one hard link to this file
 		statbuf->st_nlink = 1;
 
-		// Attempt to find match in root block
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
-		{
-			return -ENOENT;
-		}
-		else
-		{
-			// If match attempt to find a matching file
-			struct cs1550_file_entry *matching_file = find_file(matching_directory, filename, extension);
-			if(!matching_file)
-			{
-				free(matching_directory);
-				return -ENOENT;
-			}
-			else
-			{
-				size = matching_file->fsize;
-			}
-		}
-
 		// Determine file size
-		statbuf->st_size = size;
-		free(matching_directory);
-		return 0;
+		size_t dir_buf[block_size / sizeof(size_t)];
+		struct cs1550_directory_entry *matching_directory = (struct cs1550_directory_entry *) dir_buf;
+		read_block(dentry.n_leaf_block, matching_directory);
+		statbuf->st_size = matching_directory->files[dentry.n_file].fsize;
+		ret = 0;
 	}
 
 	// Check if path is a subdir.
-	if (res == 1) 
+	if (dentry.res == 1 && dentry.exists) 
 	{
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
-		{
-			return -ENOENT;
-		}
-		else
-		{
-			statbuf->st_mode = S_IFDIR | 0755;
-			statbuf->st_nlink = 2;
-			free(matching_directory);
-			return 0;
-		}
+		statbuf->st_mode = S_IFDIR | 0755;
+		statbuf->st_nlink = 2;
+		ret = 0;
 	}
 
-	// Otherwise, the path doesn't exist.
-	return -ENOENT;
+	unlock_dentry(&dentry);
+	pthread_rwlock_unlock(&root_lock);
+	return ret;
 }
 
 /**
@@ -125,12 +332,7 @@ static int cs1550_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		return -ENAMETOOLONG;
 	}
 
-	// Parsing data
-	char directory[MAX_FILENAME + 1];
-	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
-	int res;
-	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
+	pthread_rwlock_rdlock(&root_lock);
 
 	// Check path to find directory
 	if (strcmp(path, "/") == 0)
@@ -144,25 +346,38 @@ static int cs1550_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		{
 			filler(buf, root->directories[i].dname, NULL, 0);
 		}
+		pthread_rwlock_unlock(&root_lock);
 		return 0;
 	}
-	else if(res == 1)
-	{
-		// Add the current and parent directories
-		filler(buf, ".", NULL, 0);
-		filler(buf, "..", NULL, 0);
 
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 0);
+
+	if(dentry.res == 1)
+	{
 		// If res = 1, then we are in a subdir
-		// Attempt to find matching dir in root block
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
+		if(!dentry.exists)
 		{
-		
+			pthread_rwlock_unlock(&root_lock);
 			return -ENOENT;
 		}
-		// If we find a match list all files
-		else
+
+		// Add the current and parent directories
+		filler(buf, ".", NULL, 0);
+		filler(buf, "..", NULL, 0);
+
+		// List the files of every block of the directory, with the directory
+		// locked so no file moves from one to another meanwhile
+		size_t leaves[max_leaves_in_index];
+		size_t dir_buf[block_size / sizeof(size_t)];
+		struct cs1550_directory_entry *matching_directory = (struct cs1550_directory_entry *) dir_buf;
+		pthread_rwlock_rdlock(dir_lock(dentry.n_dir_block));
+		size_t num_leaves = dir_leaves(dentry.n_dir_block, leaves);
+		for (size_t n = 0; n < num_leaves; n++)
 		{
+			read_block(leaves[n], matching_directory);
+
+			// List all files
 			// Make an array for the filename + extension. Set the size to max filename + 1 char for . + max extension + 1 char for \0
 			char file[MAX_FILENAME + MAX_EXTENSION + 2];
 			for (size_t i = 0; i < matching_directory->num_files; i++) 
@@ -179,13 +394,16 @@ static int cs1550_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 				// Write changes
 				filler(buf, file, NULL, 0);
 			}
-			free(matching_directory);
-			return 0;
-			
 		}
+		pthread_rwlock_unlock(dir_lock(dentry.n_dir_block));
+		pthread_rwlock_unlock(&root_lock);
+		return 0;
 	}
 	else
 	{
+		unlock_dentry(&dentry);
+		pthread_rwlock_unlock(&root_lock);
+
 		//Return -ENOTDIR if the path is not to a directory
 		return -ENOTDIR;	
 	}
@@ -211,38 +429,58 @@ static int cs1550_mkdir(const char *path, mode_t mode)
 	int res;
 	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
 
-	// Make a directory in the root
+	// Make a directory in the root, with every other operation kept out while the root changes
 	if (res == 1) 
 	{
+		pthread_rwlock_wrlock(&root_lock);
+		int ret = 0;
+
 		// Loop through dirs and check if any of their names match the directory name. If so, return -EEXIST
 		for (size_t i = 0; i < root->num_directories; i++)
 		{
 			if (strcmp(directory, root->directories[i].dname) == 0)
 			{
-				return -EEXIST;
+				ret = -EEXIST;
+				break;
 			}
 		}
 
 		// Check to make sure there is space for new dir
-		if (root->num_directories >= MAX_DIRS_IN_ROOT)
+		if (ret == 0 && root->num_directories >= max_dirs_in_root)
 		{
-			return -ENOSPC;
+			ret = -ENOSPC;
 		}
-		else
+		else if (ret == 0)
+		{
+			// Allocate the directory block after the last block allocated, and start it empty
+			size_t start_block = alloc_block(0);
+			if (start_block == 0)
+			{
+				ret = -ENOSPC;
+			}
+			else
+			{
+				size_t new_directory[block_size / sizeof(size_t)];
+				memset(new_directory, 0, block_size);
+				write_meta_block(start_block, new_directory);
+
+				// Copy the new directory name into the next index if dir does NOT exist and there is space.
+				// Increment num of dirs then write changes
+				strncpy(root->directories[root->num_directories].dname, directory, (MAX_FILENAME + 1));
+				root->directories[root->num_directories].n_start_block = start_block;
+				root->num_directories++;
+				store_root();
+				dcache_forget(path);
+			}
+		}
+
+		pthread_rwlock_unlock(&root_lock);
+		commit_if_due();
+		if (ret == -ENOSPC && commit_freed_blocks())
 		{
-			// Copy the new directory name into the next index if dir does NOT exist and there is space.
-			strncpy(root->directories[root->num_directories].dname, directory, (MAX_FILENAME + 1));
-			
-			// Set the starting block of the new directory to the last allocated block
-			// Increment num of dirs and last block allocated
-			// Find start of file then write changes
-			root->directories[root->num_directories].n_start_block = root->last_allocated_block + 1;
-			root->num_directories++;
-			root->last_allocated_block++;
-			fseek(f, 0, SEEK_SET);
-			fwrite(root, BLOCK_SIZE, 1, f);
-			return 0;
+			return cs1550_mkdir(path, mode);
 		}
+		return ret;
 	}
 
 	return -EPERM;
@@ -253,8 +491,76 @@ static int cs1550_mkdir(const char *path, mode_t mode)
  */
 static int cs1550_rmdir(const char *path)
 {
-	(void) path;
-	return 0;
+	// Check if the path is valid
+	if(check_path(path) == 0)
+	{
+		return -ENAMETOOLONG;
+	}
+
+	// Removing a directory changes the root, which keeps every other
+	// operation out, so the directory itself needn't stay locked
+	pthread_rwlock_wrlock(&root_lock);
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 0);
+	unlock_dentry(&dentry);
+
+	int ret = 0;
+	size_t leaves[max_leaves_in_index];
+	size_t num_leaves = 0;
+	size_t dir_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_entry *matching_directory = (struct cs1550_directory_entry *) dir_buf;
+	if(dentry.res != 1)
+	{
+		ret = -ENOTDIR;
+	}
+	else if(!dentry.exists)
+	{
+		ret = -ENOENT;
+	}
+	else
+	{
+		// Only empty directories can be removed, with every block empty
+		num_leaves = dir_leaves(dentry.n_dir_block, leaves);
+		for (size_t n = 0; n < num_leaves && ret == 0; n++)
+		{
+			read_block(leaves[n], matching_directory);
+			if(matching_directory->num_files > 0)
+			{
+				ret = -ENOTEMPTY;
+			}
+		}
+	}
+
+	if(ret == 0)
+	{
+		// Move the last directory into its place in the root, and free its block
+		for (size_t i = 0; i < root->num_directories; i++)
+		{
+			if (root->directories[i].n_start_block == dentry.n_dir_block)
+			{
+				root->num_directories--;
+				root->directories[i] = root->directories[root->num_directories];
+				memset(&root->directories[root->num_directories], 0, sizeof(struct cs1550_directory));
+				break;
+			}
+		}
+		free_block(dentry.n_dir_block);
+		for (size_t n = 0; n < num_leaves; n++)
+		{
+			if (leaves[n] != dentry.n_dir_block)
+			{
+				free_block(leaves[n]);
+			}
+		}
+		store_root();
+
+		// Forget every path that went through the directory, including the ones that weren't found in it
+		dcache_clear();
+	}
+
+	pthread_rwlock_unlock(&root_lock);
+	commit_if_due();
+	return ret;
 }
 
 /**
@@ -267,7 +573,7 @@ static int cs1550_mknod(const char *path, mode_t mode, dev_t dev)
 
 	char directory[MAX_FILENAME + 1];
 	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
+	char extension[MAX_EXTENSION + 1] = "";
 
 	// Check if the path is valid
 	if(check_path(path) == 0)
@@ -281,76 +587,38 @@ static int cs1550_mknod(const char *path, mode_t mode, dev_t dev)
 	// Make sure there are 2-3 args.
 	if (res == 2 || res == 3)
 	{
-		// Try to find matching dir in root block
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
+		// Try to find matching dir in root block, and a matching file in it, with the dir locked to add to it
+		pthread_rwlock_rdlock(&root_lock);
+		struct cs1550_dentry dentry;
+		lookup(path, &dentry, 1);
+		int ret;
+		if(dentry.n_dir_block == 0)
 		{
-			return -ENOENT;
+			ret = -ENOENT;
 		}
 
+		// File already exists
+		else if(dentry.exists)
+		{
+			ret = -EEXIST;
+		}
 		else
 		{
-			// If we find a matching dir attempt to find a matching file. If file does NOT exist
-			// attempt to create new one. Check to make sure there's enough space tho.
-			struct cs1550_file_entry *matching_file = find_file(matching_directory, filename, extension);
-
-			if(!matching_file)
-			{
-				if(matching_directory->num_files < MAX_FILES_IN_DIR)
-				{
-					int start_block = get_start_block(directory);
-
-					//Copy file data into the next free file and add extension if needed
-					strncpy(matching_directory->files[matching_directory->num_files].fname, filename, (MAX_FILENAME + 1));
-					
-					if(res == 3)
-					{
-						strncpy(matching_directory->files[matching_directory->num_files].fext, extension, (MAX_EXTENSION + 1));
-
-					}
-					matching_directory->files[matching_directory->num_files].fsize = 0;
-					matching_directory->files[matching_directory->num_files].n_index_block = root->last_allocated_block + 1;
-
-					//Seek to and read the index block into a variable of type struct cs1550_index_block. Write the value of the last_allocated_block
-					// as the first entry in the index block array. Increment last_allocated_block for the first data block of the file
-					struct cs1550_index_block *index = malloc(sizeof(struct cs1550_index_block));
-					memset(index, 0, sizeof(struct cs1550_index_block));
-					fseek(f, ((root->last_allocated_block + 1) * BLOCK_SIZE), SEEK_SET);
-					fread(index, BLOCK_SIZE, 1, f);
-					root->last_allocated_block++;
-					index->entries[0] = root->last_allocated_block + 1;
-					root->last_allocated_block++;
-					matching_directory->num_files++;
-
-					//Write changes to dir and root back to disk
-					fseek(f, start_block * BLOCK_SIZE, SEEK_SET);
-					fwrite(matching_directory, BLOCK_SIZE, 1, f);
-					fseek(f, 0, SEEK_SET);
-					fwrite(root, BLOCK_SIZE, 1, f);
-					fseek(f, ((root->last_allocated_block - 1) * BLOCK_SIZE), SEEK_SET);
-					fwrite(index, BLOCK_SIZE, 1, f);
-
-					free(matching_directory);
-					free(matching_file);
-					free(index);
-					return 0;
-				}
-
-				// Not enough space
-				else
-				{
-					free(matching_directory);
-					return -ENOSPC;
-				}
-			}
+			ret = add_file(&dentry, filename, extension);
+		}
 
-			// File already exists
-			else
-			{
-				free(matching_directory);
-				return -EEXIST;
-			}
+		if(ret == 0)
+		{
+			dcache_forget(path);
+		}
+		unlock_dentry(&dentry);
+		pthread_rwlock_unlock(&root_lock);
+		commit_if_due();
+		if (ret == -ENOSPC && commit_freed_blocks())
+		{
+			return cs1550_mknod(path, mode, dev);
 		}
+		return ret;
 	}
 	else
 	{
@@ -363,21 +631,7 @@ static int cs1550_mknod(const char *path, mode_t mode, dev_t dev)
  */
 static int cs1550_unlink(const char *path)
 {
-	(void) path;
-	return 0;
-}
-
-/**
- * Read `size` bytes from file into `buf`, starting from `offset`.
- */
-static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
-		       struct fuse_file_info *fi)
-{
-	(void) fi;
-
 	char directory[MAX_FILENAME + 1];
-	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
 
 	// Check if the path is valid
 	if(check_path(path) == 0)
@@ -385,205 +639,122 @@ static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
 		return -ENAMETOOLONG;
 	}
 
-	int res;
-	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
-	
-	// Check for path/filename
-	if(res == 2 || res == 3)
+	pthread_rwlock_rdlock(&root_lock);
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 1);
+	int ret = 0;
+	if(dentry.res != 2 && dentry.res != 3)
+	{
+		ret = -EISDIR;
+	}
+	else if(!dentry.exists)
 	{
-		// Look for matching dir in root block
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
+		ret = -ENOENT;
+	}
+	else
+	{
+		// Free the file's blocks, unless it is still open: then the last release does
+		pthread_mutex_lock(&open_files_lock);
+		struct open_file *open_file = find_open_file(dentry.n_index_block);
+		if(open_file != NULL)
 		{
-			return -ENOENT;
+			open_file->unlinked = 1;
+		}
+		pthread_mutex_unlock(&open_files_lock);
+		if(open_file == NULL)
+		{
+			free_file_blocks(dentry.n_index_block);
 		}
 
-		else
+		// Move the last file of the directory into its slot
+		size_t dir_buf[block_size / sizeof(size_t)];
+		struct cs1550_directory_entry *matching_directory = (struct cs1550_directory_entry *) dir_buf;
+		read_block(dentry.n_leaf_block, matching_directory);
+		matching_directory->num_files--;
+		struct cs1550_file_entry *moved_file = &matching_directory->files[matching_directory->num_files];
+		matching_directory->files[dentry.n_file] = *moved_file;
+
+		// Forget the path, and the path of the moved file whose slot changed
+		dcache_forget(path);
+		if(dentry.n_file != matching_directory->num_files)
 		{
-			// Matching dir?
-			struct cs1550_file_entry *matching_file = find_file(matching_directory, filename, extension);
-			if(!matching_file)
+			char moved_path[MAX_PATH + 1];
+			sscanf(path, "/%[^/]/", directory);
+			if(strcmp(moved_file->fext, "") != 0)
 			{
-				free(matching_directory);
-				return -ENOENT;
+				sprintf(moved_path, "/%s/%s.%s", directory, moved_file->fname, moved_file->fext);
 			}
-			
 			else
 			{
-				//Read the index and data blocks
-				struct cs1550_index_block *index = malloc(sizeof(struct cs1550_index_block));
-				fseek(f, (matching_file->n_index_block * BLOCK_SIZE), SEEK_SET);
-				fread(index, BLOCK_SIZE, 1, f);
-
-				struct cs1550_data_block *data = malloc(sizeof(struct cs1550_data_block));
-
-				size_t temp_size = 0;
-				while(temp_size != size)
-				{
-					
-					// Determine the index inside the array of data blocks inside the index block (offset / block size)
-					// Then calc curr offset and num of bytes to read
-					int curr_index = (offset + temp_size) / BLOCK_SIZE;
-					int curr_offset = (offset + temp_size) % BLOCK_SIZE;
-					int curr_size = BLOCK_SIZE;
-
-					if((size - temp_size) < BLOCK_SIZE)
-					{
-						if((size - temp_size) + curr_offset > BLOCK_SIZE)
-						{
-							curr_size = BLOCK_SIZE - curr_offset;
-						}
-						
-						else
-						{
-							curr_size = size - temp_size;
-
-						}
-					}
-
-					// If the index empty skip reading data
-					if(index->entries[curr_index] == 0)
-					{
-						temp_size += curr_size;
-						continue;
-					}
-
-					// Seek to curr offset, read block in, copy data, increment bytes copied
-					fseek(f, (index->entries[curr_index] * BLOCK_SIZE), SEEK_SET);
-					fread(data, BLOCK_SIZE, 1, f);
-					memcpy(buf + temp_size, ((char*)data) + curr_offset, curr_size);
-					temp_size += curr_size;
-
-				}
-				
-				// If you need to read the next data blocks, retrieve the block numbers
-				free(matching_directory);
-				free(index);
-				free(data);
-				return size;
+				sprintf(moved_path, "/%s/%s", directory, moved_file->fname);
 			}
+			dcache_forget(moved_path);
 		}
+		memset(moved_file, 0, sizeof(struct cs1550_file_entry));
+		write_meta_block(dentry.n_leaf_block, matching_directory);
 	}
 
-	else
-	{
-		return -EISDIR;
-	}
+	unlock_dentry(&dentry);
+	pthread_rwlock_unlock(&root_lock);
+	commit_if_due();
+	return ret;
 }
 
 /**
- * Write `size` bytes from `buf` into file, starting from `offset`.
+ * Read `size` bytes from file into `buf`, starting from `offset`.
  */
-static int cs1550_write(const char *path, const char *buf, size_t size,
-			off_t offset, struct fuse_file_info *fi)
+static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
+		       struct fuse_file_info *fi)
 {
-	(void) fi;
-
-	char directory[MAX_FILENAME + 1];
-	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
+	return read_file(path, buf, NULL, size, offset, fi);
+}
 
-	// Check if the path is valid
-	if(check_path(path) == 0)
-	{
-		return -ENAMETOOLONG;
-	}
+/**
+ * Read `size` bytes from file, starting from `offset`, into a vector of
+ * buffers for FUSE to copy to the reader. Runs of blocks that aren't cached
+ * are handed over as parts of the `.disk` file, so FUSE can splice them from
+ * it without their passing through here.
+ */
+static int cs1550_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+			   off_t offset, struct fuse_file_info *fi)
+{
+	// Start with no buffers, read_file adds them
+	struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec));
+	*bufv = FUSE_BUFVEC_INIT(0);
+	bufv->count = 0;
 
-	int res;
-	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
-	// Check for path/filename
-	if(res == 2 || res == 3)
+	int ret = read_file(path, NULL, &bufv, size, offset, fi);
+	if(ret != 0)
 	{
-		// Look for matching dir in the root block
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
+		for(size_t i = 0; i < bufv->count; i++)
 		{
-			return -ENOENT;
+			free(bufv->buf[i].mem);
 		}
-		else
-		{
-			// Look for matching file if matching dir and return an error if file does NOT exist
-			struct cs1550_file_entry *matching_file = find_file(matching_directory, filename, extension);
-			if(!matching_file)
-			{
-				free(matching_directory);
-				return -ENOENT;
-			}
-
-			else
-			{
-				//Read the index/data blocks
-				struct cs1550_index_block *index = malloc(sizeof(struct cs1550_index_block));
-				fseek(f, (matching_file->n_index_block * BLOCK_SIZE), SEEK_SET);
-				fread(index, BLOCK_SIZE, 1, f);
-
-				struct cs1550_data_block *data = malloc(sizeof(struct cs1550_data_block));
-
-				size_t temp_size = 0;
-				while(temp_size != size)
-				{
-					// Use the offset to determine the index
-					// Calc offset for curr data block and amount of bytes to read
-					int curr_index = (offset + temp_size) / BLOCK_SIZE;
-					int curr_offset = (offset + temp_size) % BLOCK_SIZE;
-					int curr_size = BLOCK_SIZE;
-					if((size - temp_size) < BLOCK_SIZE)
-					{
-						if((size - temp_size) + curr_offset > BLOCK_SIZE)
-						{
-							curr_size = BLOCK_SIZE - curr_offset;
-						}
-						else
-						{
-							curr_size = size - temp_size;
-
-						}
-					}
-
-					// If the index entry is empty, allocate a new block if there's space
-					// Write changes back to disk
-					if(index->entries[curr_index] == 0)
-					{
-						index->entries[curr_index] = root->last_allocated_block + 1;
-						root->last_allocated_block++;
-						fseek(f, 0, SEEK_SET);
-						fwrite(root, BLOCK_SIZE, 1, f);
-						fseek(f, (matching_file->n_index_block * BLOCK_SIZE), SEEK_SET);
-						fwrite(index, BLOCK_SIZE, 1, f);
-					}
-
-					// Read in the current data block and copy contents. Write change back
-					fseek(f, (index->entries[curr_index] * BLOCK_SIZE), SEEK_SET);
-					fread(data, BLOCK_SIZE, 1, f);
-					memcpy(((char*)data) + curr_offset, buf + temp_size, curr_size);
-					fseek(f, (index->entries[curr_index] * BLOCK_SIZE), SEEK_SET);
-					fwrite(data, BLOCK_SIZE, 1, f);
-					temp_size += curr_size;
-
-				}
-				
-				free(index);
-				free(data);
-				
-				// Increment file size and write changes
-				if(offset == 0)
-					matching_file->fsize = size;
+		free(bufv);
+		return ret;
+	}
+	*bufp = bufv;
+	return 0;
+}
 
-				else
-					matching_file->fsize += size;
+/**
+ * Write `size` bytes from `buf` into file, starting from `offset`.
+ */
+static int cs1550_write(const char *path, const char *buf, size_t size,
+			off_t offset, struct fuse_file_info *fi)
+{
+	return write_file(path, buf, NULL, size, offset, fi);
+}
 
-				fseek(f, (get_start_block(directory) * BLOCK_SIZE), SEEK_SET);
-				fwrite(matching_directory, BLOCK_SIZE, 1, f);
-				free(matching_directory);
-				return size;
-			}
-		}
-	}
-	
-	else
-	{
-		return -EISDIR;
-	}
+/**
+ * Write the contents of a vector of buffers into file, starting from
+ * `offset`. Whole blocks that aren't cached are copied by FUSE straight
+ * to the `.disk` file, so data FUSE has in a pipe can be spliced to it.
+ */
+static int cs1550_write_buf(const char *path, struct fuse_bufvec *bufv, off_t offset,
+			    struct fuse_file_info *fi)
+{
+	return write_file(path, NULL, bufv, fuse_buf_size(bufv), offset, fi);
 }
 
 /**
@@ -604,66 +775,47 @@ static int cs1550_truncate(const char *path, off_t size)
  */
 static int cs1550_open(const char *path, struct fuse_file_info *fi)
 {
-    (void) fi;
-
-	char directory[MAX_FILENAME + 1];
-	char filename[MAX_FILENAME + 1];
-	char extension[MAX_EXTENSION + 1];
-
 	// Check if the path is valid
 	if(check_path(path) == 0)
 	{
 		return -ENAMETOOLONG;
 	}
 
-	int res;
-	res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
+	// Attempt to find matching directory in the root block, then matching file.
+	pthread_rwlock_rdlock(&root_lock);
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 0);
 
-	if(res == 1)
+	int ret = 0;
+	if((dentry.res != 1 && dentry.res != 2 && dentry.res != 3) || !dentry.exists)
 	{
-		// Attempt to find matching directory in the root block. Return error if NOT found, return 0 if found.
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-
-		if(!matching_directory)
-		{
-			return -ENOENT;
-		}
-
-		else
-		{
-			return 0;
-		}
+		ret = -ENOENT;
 	}
 
-	// Attempt to find matching dir in root block then matching file.
-	else if(res == 2 || res == 3)
+	// Hand the resolved file to read and write so they don't look it up again
+	else if(dentry.res != 1)
 	{
-		struct cs1550_directory_entry *matching_directory = find_dir_entry(directory);
-		if(!matching_directory)
-		{
-			return -ENOENT;
-		}
-		else
-		{
-			struct cs1550_file_entry *matching_file = find_file(matching_directory, filename, extension);
-
-			if(!matching_file)
-			{
-				return -ENOENT;
-			}
-
-			else
-			{
-				return 0;
-			}
-		}
+		fi->fh = (uintptr_t) get_open_file(&dentry);
 	}
+	unlock_dentry(&dentry);
+	pthread_rwlock_unlock(&root_lock);
+	return ret;
+}
 
-	// Else path is invalid	
-	else
+/**
+ * Called when the last file descriptor from an open is closed.
+ */
+static int cs1550_release(const char *path, struct fuse_file_info *fi)
+{
+	(void) path;
+
+	struct open_file *open_file = (struct open_file *)(uintptr_t) fi->fh;
+	fi->fh = 0;
+	if(open_file != NULL)
 	{
-		return -ENOENT;
+		put_open_file(open_file);
 	}
+	return 0;
 }
 
 /**
@@ -676,6 +828,31 @@ static int cs1550_flush(const char *path, struct fuse_file_info *fi)
 {
 	(void) path;
 	(void) fi;
+
+	// Write the cached blocks back, or commit them to the journal, so they are on .disk once close() returns
+	flush_cache();
+	return 0;
+}
+
+/**
+ * Called on fsync(2). Everything cached is written back or committed, whether
+ * or not it belongs to this file, and .disk is synced.
+ */
+static int cs1550_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void) path;
+	(void) fi;
+
+	flush_cache();
+	if(fd >= 0)
+	{
+		pthread_mutex_lock(&cache_lock);
+		journal_unsynced = 0;
+		data_unsynced = 0;
+		int ret = (datasync ? fdatasync(fd) : fsync(fd)) == 0 ? 0 : -errno;
+		pthread_mutex_unlock(&cache_lock);
+		return ret;
+	}
 	return 0;
 }
 
@@ -684,15 +861,27 @@ static int cs1550_flush(const char *path, struct fuse_file_info *fi)
  */
 static void *cs1550_init(struct fuse_conn_info *fi)
 {
-	(void) fi;
+	// Let FUSE splice data between /dev/fuse and .disk for read_buf and write_buf
+	fi->want |= fi->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
 
-	//Read in first disk block(root)
-	root = malloc(BLOCK_SIZE);
-	f = fopen(".disk", "rb+");
-	if (f != NULL)
+	fd = open(".disk", O_RDWR);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	for (size_t i = 0; i < DIR_LOCKS; i++)
 	{
-		fread(root, BLOCK_SIZE, 1, f);
+		pthread_rwlock_init(&dir_locks[i], NULL);
 	}
+
+	// Find the layout of .disk, put back what the journal has, then read in the root block
+	load_superblock();
+	init_cache();
+	replay_journal();
+	root = malloc(block_size);
+	read_block(n_root_block, root);
+	last_allocated = root->last_allocated_block;
+	load_bitmap();
 	return NULL;
 }
 
@@ -703,9 +892,52 @@ static void cs1550_destroy(void *args)
 {
 	(void) args;
 
-	// Free teh node! ...And close the .disk file
+	// Nothing to do if .disk couldn't be opened
+	if (fd < 0)
+	{
+		return;
+	}
+
+	// Free the blocks of files still open after they were unlinked
+	while (open_files != NULL)
+	{
+		struct open_file *open_file = open_files;
+		open_files = open_file->next;
+		if (open_file->unlinked)
+		{
+			free_file_blocks(open_file->n_index_block);
+		}
+		pthread_rwlock_destroy(&open_file->lock);
+		free(open_file);
+	}
+
+	// Free teh node! ...And write back the cache, leaving the journal empty, and close the .disk file
+	flush_cache();
+	if (journal_ring > 0)
+	{
+		pthread_mutex_lock(&cache_lock);
+		journal_checkpoint();
+		pthread_mutex_unlock(&cache_lock);
+	}
+	free(journal_set);
+	journal_set = NULL;
 	free(root);
-	fclose(f);
+	free(bitmap);
+	free(bitmap_dirty);
+	bitmap = NULL;
+	bitmap_dirty = NULL;
+	free(cache[0].data);
+	free(cache);
+	free(cache_buckets);
+	cache = NULL;
+	cache_buckets = NULL;
+	dcache_clear();
+	for (size_t i = 0; i < DIR_LOCKS; i++)
+	{
+		pthread_rwlock_destroy(&dir_locks[i]);
+	}
+	close(fd);
+	fd = -1;
 }
 
 /*
@@ -718,11 +950,15 @@ static struct fuse_operations cs1550_oper = {
 	.rmdir		= cs1550_rmdir,
 	.read		= cs1550_read,
 	.write		= cs1550_write,
+	.read_buf	= cs1550_read_buf,
+	.write_buf	= cs1550_write_buf,
 	.mknod		= cs1550_mknod,
 	.unlink		= cs1550_unlink,
 	.truncate	= cs1550_truncate,
 	.flush		= cs1550_flush,
+	.fsync		= cs1550_fsync,
 	.open		= cs1550_open,
+	.release	= cs1550_release,
 	.init		= cs1550_init,
 	.destroy	= cs1550_destroy,
 };
@@ -755,39 +991,346 @@ static int get_start_block(char dir_name[])
 	return 0;
 }
 
-// Loop root block and return dir entry match
-static struct cs1550_directory_entry * find_dir_entry(char dir_name[])
+// Loop and return a the matching file if exists
+static struct cs1550_file_entry * find_file(struct cs1550_directory_entry *dir, char file_name[], char extension[])
 {
-	for (size_t i = 0; i < root->num_directories; i++)
+	for (size_t i = 0; i < dir->num_files; i++)
 	{
-		if (strcmp(dir_name, root->directories[i].dname) == 0)
+		if((strcmp(file_name, dir->files[i].fname) == 0) && (strcmp(extension, dir->files[i].fext) == 0))
 		{
-			int start = root->directories[i].n_start_block;
-			
-			struct cs1550_directory_entry *dir = malloc(sizeof(struct cs1550_directory_entry));
-			
-			fseek(f, start * BLOCK_SIZE, SEEK_SET);
-			fread(dir, BLOCK_SIZE, 1, f);
-			return dir;
+			return &(dir->files[i]);
 		}
 	}
 	
 	return NULL;
 }
 
+// FNV-1a hash of a path, for the dentry cache
+static size_t hash_path(const char *path)
+{
+	size_t hash = 2166136261u;
+	for (; *path != '\0'; path++)
+	{
+		hash = (hash ^ (unsigned char) *path) * 16777619u;
+	}
+	return hash;
+}
+
+// Resolve path to its directory and file, from the dentry cache if it's there.
+// The path must have passed check_path, and root_lock must be held. For a file
+// in a directory that exists, the directory is left locked, for writing if
+// exclusive is set, until unlock_dentry()
+static void lookup(const char *path, struct cs1550_dentry *dentry, int exclusive)
+{
+	char directory[MAX_FILENAME + 1];
+	char filename[MAX_FILENAME + 1];
+	char extension[MAX_EXTENSION + 1] = "";
 
-// Loop and return a the matching file if exists
-static struct cs1550_file_entry * find_file(struct cs1550_directory_entry *dir, char file_name[], char extension[])
+	// The directory a path leads to only changes with root_lock held for writing
+	int cached = dcache_get(path, dentry);
+	if (!cached)
+	{
+		memset(dentry, 0, sizeof(struct cs1550_dentry));
+		dentry->res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
+		if (dentry->res == 1 || dentry->res == 2 || dentry->res == 3)
+		{
+			dentry->n_dir_block = get_start_block(directory);
+			dentry->exists = (dentry->n_dir_block != 0);
+		}
+	}
+
+	// A directory, or a file in a directory that doesn't exist, needs nothing more.
+	// The latter isn't kept, as mkdir only forgets the directory's path
+	if ((dentry->res != 2 && dentry->res != 3) || dentry->n_dir_block == 0)
+	{
+		if (!cached && dentry->res == 1)
+		{
+			dcache_put(path, dentry);
+		}
+		return;
+	}
+
+	// The file only changes with its directory locked for writing, so what the
+	// cache has for it can only be trusted once the directory is locked
+	if (exclusive)
+	{
+		pthread_rwlock_wrlock(dir_lock(dentry->n_dir_block));
+	}
+	else
+	{
+		pthread_rwlock_rdlock(dir_lock(dentry->n_dir_block));
+	}
+	if (cached && dcache_get(path, dentry))
+	{
+		return;
+	}
+
+	// Look for the file in the directory
+	size_t n_dir_block = dentry->n_dir_block;
+	memset(dentry, 0, sizeof(struct cs1550_dentry));
+	dentry->res = sscanf(path, "/%[^/]/%[^.].%s", directory, filename, extension);
+	dentry->n_dir_block = n_dir_block;
+
+	size_t dir_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_entry *dir = (struct cs1550_directory_entry *) dir_buf;
+	dentry->hash = hash_name(filename, extension);
+	dentry->n_leaf_block = find_leaf(dentry->n_dir_block, dentry->hash);
+	read_block(dentry->n_leaf_block, dir);
+	struct cs1550_file_entry *file = find_file(dir, filename, extension);
+	dentry->exists = (file != NULL);
+	if (file != NULL)
+	{
+		dentry->n_file = file - dir->files;
+		dentry->n_index_block = file->n_index_block;
+	}
+	dcache_put(path, dentry);
+}
+
+// Unlock the directory lookup() left locked, if it did
+static void unlock_dentry(struct cs1550_dentry *dentry)
+{
+	if ((dentry->res == 2 || dentry->res == 3) && dentry->n_dir_block != 0)
+	{
+		pthread_rwlock_unlock(dir_lock(dentry->n_dir_block));
+	}
+}
+
+// The lock of the directory in block n_dir_block
+static pthread_rwlock_t * dir_lock(size_t n_dir_block)
+{
+	return &dir_locks[n_dir_block % DIR_LOCKS];
+}
+
+// Find the file read or write is called for, and keep it open until
+// drop_file(): the handle open left in fi, or else the path, which is opened
+// for the call. Called with root_lock held. Returns 0 or the error for the operation
+static int hold_file(const char *path, struct fuse_file_info *fi, struct open_file **open_file)
+{
+	if (fi != NULL && fi->fh != 0)
+	{
+		*open_file = (struct open_file *)(uintptr_t) fi->fh;
+		return 0;
+	}
+
+	// Check if the path is valid
+	if (check_path(path) == 0)
+	{
+		return -ENAMETOOLONG;
+	}
+
+	struct cs1550_dentry dentry;
+	lookup(path, &dentry, 0);
+	int ret = 0;
+	if (dentry.res != 2 && dentry.res != 3)
+	{
+		ret = -EISDIR;
+	}
+	else if (!dentry.exists)
+	{
+		ret = -ENOENT;
+	}
+	else
+	{
+		*open_file = get_open_file(&dentry);
+	}
+	unlock_dentry(&dentry);
+	return ret;
+}
+
+// Let go of the file hold_file found
+static void drop_file(struct fuse_file_info *fi, struct open_file *open_file)
+{
+	if (fi == NULL || fi->fh == 0)
+	{
+		put_open_file(open_file);
+	}
+}
+
+// Drop path from the dentry cache
+static void dcache_forget(const char *path)
+{
+	struct dcache_entry *entry = &dcache[hash_path(path) & (DCACHE_ENTRIES - 1)];
+	pthread_mutex_lock(&dcache_lock);
+	if (entry->valid && strcmp(entry->path, path) == 0)
+	{
+		entry->valid = 0;
+	}
+	pthread_mutex_unlock(&dcache_lock);
+}
+
+// Drop every path from the dentry cache
+static void dcache_clear(void)
+{
+	pthread_mutex_lock(&dcache_lock);
+	memset(dcache, 0, sizeof(dcache));
+	pthread_mutex_unlock(&dcache_lock);
+}
+
+// Copy the dentry cached for path, if it's there. Returns whether it was
+static int dcache_get(const char *path, struct cs1550_dentry *dentry)
+{
+	struct dcache_entry *entry = &dcache[hash_path(path) & (DCACHE_ENTRIES - 1)];
+	pthread_mutex_lock(&dcache_lock);
+	int found = entry->valid && strcmp(entry->path, path) == 0;
+	if (found)
+	{
+		*dentry = entry->dentry;
+	}
+	pthread_mutex_unlock(&dcache_lock);
+	return found;
+}
+
+// Keep the dentry for path, unless path is too long to fit
+static void dcache_put(const char *path, struct cs1550_dentry *dentry)
+{
+	struct dcache_entry *entry = &dcache[hash_path(path) & (DCACHE_ENTRIES - 1)];
+	if (strlen(path) > MAX_PATH)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dcache_lock);
+	entry->valid = 1;
+	strcpy(entry->path, path);
+	entry->dentry = *dentry;
+	pthread_mutex_unlock(&dcache_lock);
+}
+
+// Find the open file with this index block, or NULL if it isn't open.
+// open_files_lock must be held
+static struct open_file * find_open_file(size_t n_index_block)
+{
+	struct open_file *open_file = open_files;
+	while (open_file != NULL && open_file->n_index_block != n_index_block)
+	{
+		open_file = open_file->next;
+	}
+	return open_file;
+}
+
+// Open the file dentry found, sharing the open file if it's open already.
+// The file's directory must be locked, so the file can't be unlinked meanwhile
+static struct open_file * get_open_file(struct cs1550_dentry *dentry)
+{
+	pthread_mutex_lock(&open_files_lock);
+	struct open_file *open_file = find_open_file(dentry->n_index_block);
+	if (open_file == NULL)
+	{
+		open_file = malloc(sizeof(struct open_file));
+		open_file->n_dir_block = dentry->n_dir_block;
+		open_file->hash = dentry->hash;
+		open_file->n_index_block = dentry->n_index_block;
+		open_file->n_opens = 0;
+		open_file->unlinked = 0;
+		open_file->next_read = 0;
+		open_file->readahead = 0;
+		pthread_rwlock_init(&open_file->lock, NULL);
+		open_file->next = open_files;
+		open_files = open_file;
+	}
+	open_file->n_opens++;
+	pthread_mutex_unlock(&open_files_lock);
+	return open_file;
+}
+
+// Close an open file. The last close frees the blocks of a file that was
+// unlinked, and forgets it
+static void put_open_file(struct open_file *open_file)
+{
+	pthread_mutex_lock(&open_files_lock);
+	if (--open_file->n_opens > 0)
+	{
+		pthread_mutex_unlock(&open_files_lock);
+		return;
+	}
+	struct open_file **link = &open_files;
+	while (*link != open_file)
+	{
+		link = &(*link)->next;
+	}
+	*link = open_file->next;
+	pthread_mutex_unlock(&open_files_lock);
+
+	if (open_file->unlinked)
+	{
+		free_file_blocks(open_file->n_index_block);
+	}
+	pthread_rwlock_destroy(&open_file->lock);
+	free(open_file);
+}
+
+// Create a file in the directory dentry leads to, which is locked for writing.
+// Returns 0 or -ENOSPC
+static int add_file(struct cs1550_dentry *dentry, char filename[], char extension[])
+{
+	// Check to make sure there's enough space in the block the file goes in,
+	// splitting it while it's full if the directory can be hashed
+	size_t dir_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_entry *dir = (struct cs1550_directory_entry *) dir_buf;
+	size_t hash = hash_name(filename, extension);
+	size_t n_leaf_block = find_leaf(dentry->n_dir_block, hash);
+	read_block(n_leaf_block, dir);
+	while (dir->num_files >= max_files_in_dir)
+	{
+		if (!hashed_dirs || split_leaf(dentry->n_dir_block, hash) != 0)
+		{
+			return -ENOSPC;
+		}
+		n_leaf_block = find_leaf(dentry->n_dir_block, hash);
+		read_block(n_leaf_block, dir);
+	}
+
+	// Allocate the index block after the last block allocated, and the first data block of the file right after it
+	size_t index_block = alloc_block(0);
+	if (index_block == 0)
+	{
+		return -ENOSPC;
+	}
+	size_t data_block = alloc_block(index_block + 1);
+	if (data_block == 0)
+	{
+		// Nothing points to the index block yet, so it's free again at once
+		reset_bit(index_block);
+		return -ENOSPC;
+	}
+
+	// Copy file data into the next free file, with an empty extension if there's none
+	struct cs1550_file_entry *new_file = &dir->files[dir->num_files];
+	strncpy(new_file->fname, filename, (MAX_FILENAME + 1));
+	strncpy(new_file->fext, extension, (MAX_EXTENSION + 1));
+	new_file->fsize = 0;
+	new_file->n_index_block = index_block;
+	dir->num_files++;
+
+	// Start the index block with one extent for the first data block, and the data block empty
+	size_t index_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *index = (struct cs1550_extent_block *) index_buf;
+	memset(index, 0, block_size);
+	index->magic = EXTENT_MAGIC;
+	index->num_extents = 1;
+	index->extents[0].n_start_block = data_block;
+	index->extents[0].num_blocks = 1;
+	char data[block_size];
+	memset(data, 0, block_size);
+
+	// Write changes to dir, root, index and data back to disk
+	write_meta_block(n_leaf_block, dir);
+	store_root();
+	write_meta_block(index_block, index);
+	write_block(data_block, data);
+	return 0;
+}
+
+// Return the slot of the file with this index block, or -1 if it's not in the directory
+static int find_file_by_index(struct cs1550_directory_entry *dir, size_t n_index_block)
 {
 	for (size_t i = 0; i < dir->num_files; i++)
 	{
-		if((strcmp(file_name, dir->files[i].fname) == 0) && (strcmp(extension, dir->files[i].fext) == 0))
+		if (dir->files[i].n_index_block == n_index_block)
 		{
-			return &(dir->files[i]);
+			return i;
 		}
 	}
-	
-	return NULL;
+	return -1;
 }
 
 // Loop through path to check length of argz
@@ -848,4 +1391,1612 @@ static int check_path(const char *path)
 
 	return 0;
 
-}
\ No newline at end of file
+}
+
+// Set up an empty cache for blocks of block_size
+static void init_cache(void)
+{
+	cache_blocks = CACHE_SIZE / block_size;
+	cache = calloc(cache_blocks, sizeof(struct cache_block));
+	char *data = malloc(cache_blocks * block_size);
+	for (size_t i = 0; i < cache_blocks; i++)
+	{
+		cache[i].data = data + i * block_size;
+	}
+
+	size_t n_buckets = 1;
+	while (n_buckets < 2 * cache_blocks)
+	{
+		n_buckets *= 2;
+	}
+	cache_buckets = calloc(n_buckets, sizeof(struct cache_block *));
+	cache_buckets_mask = n_buckets - 1;
+	clock_hand = 0;
+}
+
+// Find a block in the cache, or NULL if it isn't there. If the block is being
+// read in, wait until it is. cache_lock must be held
+static struct cache_block * cache_lookup(size_t n_block)
+{
+	for (;;)
+	{
+		struct cache_block *b = cache_buckets[n_block & cache_buckets_mask];
+		while (b != NULL && b->n_block != n_block)
+		{
+			b = b->next_in_bucket;
+		}
+		if (b == NULL || !b->loading)
+		{
+			return b;
+		}
+		pthread_cond_wait(&cache_loaded, &cache_lock);
+	}
+}
+
+// Write a cached block back to .disk if it has changed. A journaled block's
+// transaction has to be on .disk before the block is
+static void cache_write_back(struct cache_block *b)
+{
+	if (b->dirty)
+	{
+		if (b->journaled && journal_unsynced)
+		{
+			fdatasync(fd);
+			journal_unsynced = 0;
+		}
+		else if (!b->journaled)
+		{
+			data_unsynced = 1;
+		}
+		if (pwrite(fd, b->data, block_size, b->n_block * block_size) != (ssize_t) block_size)
+		{
+			perror(".disk");
+		}
+		b->dirty = 0;
+		b->journaled = 0;
+	}
+	if (b->pinned)
+	{
+		b->pinned = 0;
+		pinned_blocks--;
+	}
+}
+
+// Make room for block n_block: sweep the clock hand round to a block that
+// hasn't been used since it last went past, write that block back and move
+// it to n_block's bucket. Blocks being read in are passed over; there are
+// never as many of them as there are threads. So are pinned blocks, unless
+// the cache is full of them, which commit_if_due() keeps from happening.
+// cache_lock must be held
+static struct cache_block * cache_evict(size_t n_block)
+{
+	struct cache_block *b;
+	for (size_t i = 0; ; i++)
+	{
+		b = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % cache_blocks;
+		if (b->loading || (b->pinned && i < 2 * cache_blocks))
+		{
+			continue;
+		}
+		if (!b->valid || !b->referenced)
+		{
+			break;
+		}
+		b->referenced = 0;
+	}
+
+	if (b->valid)
+	{
+		cache_write_back(b);
+		struct cache_block **link = &cache_buckets[b->n_block & cache_buckets_mask];
+		while (*link != b)
+		{
+			link = &(*link)->next_in_bucket;
+		}
+		*link = b->next_in_bucket;
+	}
+
+	struct cache_block **bucket = &cache_buckets[n_block & cache_buckets_mask];
+	b->n_block = n_block;
+	b->valid = 1;
+	b->dirty = 0;
+	b->next_in_bucket = *bucket;
+	*bucket = b;
+	return b;
+}
+
+// Read block n_block into buf, from the cache if it's there
+static void read_block(size_t n_block, void *buf)
+{
+	pthread_mutex_lock(&cache_lock);
+	struct cache_block *b = cache_lookup(n_block);
+	if (b == NULL)
+	{
+		// Read the block in without holding the lock. Other threads that want
+		// it meanwhile wait in cache_lookup
+		b = cache_evict(n_block);
+		b->loading = 1;
+		pthread_mutex_unlock(&cache_lock);
+
+		// Blocks past the end of .disk read as zeroes
+		ssize_t n = pread(fd, b->data, block_size, n_block * block_size);
+		if (n < 0)
+		{
+			n = 0;
+		}
+		memset(b->data + n, 0, block_size - n);
+
+		pthread_mutex_lock(&cache_lock);
+		b->loading = 0;
+		pthread_cond_broadcast(&cache_loaded);
+	}
+	b->referenced = 1;
+	memcpy(buf, b->data, block_size);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+// Read size bytes, from offset bytes into the run of blocks starting at
+// n_block, into buf. Blocks that are cached are copied from the cache, as they
+// may have changed, and each stretch of blocks that aren't is read with one
+// pread straight into buf. Those aren't cached, so reading a large file doesn't
+// push the metadata out of the cache. With bufv, the cached blocks are copied
+// into buffers added to it, and each stretch is added as a part of .disk, read
+// once FUSE copies the buffers out after the file is unlocked. A write racing
+// with that may or may not be seen, as with reads on a local filesystem
+static void read_blocks(size_t n_block, size_t offset, size_t size, char *buf, struct fuse_bufvec **bufv)
+{
+	size_t done = 0;
+	while (done < size)
+	{
+		size_t first = (offset + done) / block_size;
+		size_t curr_offset = (offset + done) % block_size;
+
+		pthread_mutex_lock(&cache_lock);
+		struct cache_block *b = cache_lookup(n_block + first);
+		if (b != NULL)
+		{
+			size_t curr_size = block_size - curr_offset;
+			if (curr_size > size - done)
+			{
+				curr_size = size - done;
+			}
+			b->referenced = 1;
+			if (bufv != NULL)
+			{
+				char *mem = malloc(curr_size);
+				memcpy(mem, b->data + curr_offset, curr_size);
+				add_buf(bufv, mem, curr_size, -1, 0);
+			}
+			else
+			{
+				memcpy(buf + done, b->data + curr_offset, curr_size);
+			}
+			pthread_mutex_unlock(&cache_lock);
+			done += curr_size;
+			continue;
+		}
+
+		// The file is locked, so none of its blocks can be cached meanwhile,
+		// other than by readers
+		size_t last = first + 1;
+		while (last * block_size < offset + size && cache_lookup(n_block + last) == NULL)
+		{
+			last++;
+		}
+		pthread_mutex_unlock(&cache_lock);
+
+		// Blocks past the end of .disk read as zeroes
+		size_t curr_size = ((last * block_size < offset + size) ? last * block_size : offset + size) - (offset + done);
+		if (bufv != NULL)
+		{
+			add_buf(bufv, NULL, curr_size, fd, n_block * block_size + offset + done);
+			done += curr_size;
+			continue;
+		}
+		ssize_t n = pread(fd, buf + done, curr_size, n_block * block_size + offset + done);
+		if (n < 0)
+		{
+			n = 0;
+		}
+		memset(buf + done + n, 0, curr_size - n);
+		done += curr_size;
+	}
+}
+
+// Write buf to the cached block n_block. A block with a copy in the journal
+// goes through the journal, even if it's data now, until the next checkpoint,
+// as replay would put the old copy back over it
+static void cache_store(size_t n_block, const void *buf, int meta)
+{
+	pthread_mutex_lock(&cache_lock);
+	struct cache_block *b = cache_lookup(n_block);
+	if (b == NULL)
+	{
+		b = cache_evict(n_block);
+	}
+	b->referenced = 1;
+	b->dirty = 1;
+	if (journal_ring > 0 && (meta || b->pinned || journal_has(n_block)))
+	{
+		b->journaled = 1;
+		if (!b->pinned)
+		{
+			b->pinned = 1;
+			pinned_blocks++;
+		}
+	}
+	memcpy(b->data, buf, block_size);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+// Write buf to block n_block. It only reaches .disk once the block is evicted
+// or the cache is flushed
+static void write_block(size_t n_block, const void *buf)
+{
+	cache_store(n_block, buf, 0);
+}
+
+// Write buf to block n_block, which holds metadata. With a journal, it only
+// reaches its place in .disk after it has been committed to the journal
+static void write_meta_block(size_t n_block, const void *buf)
+{
+	cache_store(n_block, buf, 1);
+}
+
+static int compare_blocks(const void *a, const void *b)
+{
+	size_t n_a = (*(struct cache_block * const *)a)->n_block;
+	size_t n_b = (*(struct cache_block * const *)b)->n_block;
+	return (n_a > n_b) - (n_a < n_b);
+}
+
+// Write the changed blocks of a kind back to .disk, in block order so the
+// writes are as sequential as they can be. cache_lock must be held
+static void write_back_blocks(int journaled)
+{
+	size_t n_dirty = 0;
+
+	struct cache_block **dirty = malloc(cache_blocks * sizeof(struct cache_block *));
+	for (size_t i = 0; i < cache_blocks; i++)
+	{
+		if (cache[i].valid && cache[i].dirty && cache[i].journaled == journaled && !cache[i].pinned)
+		{
+			dirty[n_dirty++] = &cache[i];
+		}
+	}
+	qsort(dirty, n_dirty, sizeof(dirty[0]), compare_blocks);
+	for (size_t i = 0; i < n_dirty; i++)
+	{
+		cache_write_back(dirty[i]);
+	}
+	free(dirty);
+}
+
+// Write every changed block, and the bitmap, back to .disk. With a journal,
+// the data blocks are written in place, then the metadata is committed to the
+// journal in one transaction, and is only written in place by a checkpoint.
+// Every operation is kept out meanwhile, so a transaction holds whole
+// operations: the ones of every thread since the last commit
+static void flush_cache(void)
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	pthread_rwlock_wrlock(&root_lock);
+	store_bitmap();
+
+	pthread_mutex_lock(&cache_lock);
+	write_back_blocks(0);
+	if (journal_ring > 0)
+	{
+		journal_commit();
+		release_freed_blocks();
+	}
+	pthread_mutex_unlock(&cache_lock);
+	pthread_rwlock_unlock(&root_lock);
+}
+
+// Commit the metadata waiting for the journal once there is a quarter of the
+// ring's or the cache's worth of it. Called at the end of operations that change
+// metadata, with no lock held
+static void commit_if_due(void)
+{
+	if (journal_ring == 0)
+	{
+		return;
+	}
+
+	size_t due = (journal_ring < cache_blocks ? journal_ring : cache_blocks) / 4;
+	pthread_mutex_lock(&cache_lock);
+	int commit = pinned_blocks >= due;
+	pthread_mutex_unlock(&cache_lock);
+	if (commit)
+	{
+		flush_cache();
+	}
+}
+
+// Commit now if blocks were freed since the last commit, so they can be
+// allocated again. Returns whether there were any, so an operation that ran
+// out of space can try again. Called with no lock held
+static int commit_freed_blocks(void)
+{
+	if (__atomic_load_n(&freed_blocks, __ATOMIC_RELAXED) == 0)
+	{
+		return 0;
+	}
+	flush_cache();
+	return 1;
+}
+
+// Read the layout of .disk from its superblock. A .disk without one has the
+// original layout: BLOCK_SIZE blocks, the root in block 0 and the bitmap at the end
+static void load_superblock(void)
+{
+	struct cs1550_superblock superblock;
+	struct stat st;
+	memset(&superblock, 0, sizeof(struct cs1550_superblock));
+	if (pread(fd, &superblock, sizeof(struct cs1550_superblock), 0) != sizeof(struct cs1550_superblock) ||
+	    superblock.magic != SUPERBLOCK_MAGIC)
+	{
+		fstat(fd, &st);
+		journal_start = 0;
+		journal_ring = 0;
+		hashed_dirs = 0;
+		block_size = BLOCK_SIZE;
+		n_root_block = 0;
+		n_disk_blocks = st.st_size / BLOCK_SIZE;
+		bitmap_blocks = BITMAP_BLOCKS(n_disk_blocks, BLOCK_SIZE);
+		bitmap_start = n_disk_blocks - bitmap_blocks;
+	}
+	else
+	{
+		// Don't guess at a layout this version doesn't know
+		if (superblock.version > CS1550_VERSION || superblock.block_size < MIN_BLOCK_SIZE ||
+		    superblock.block_size > MAX_BLOCK_SIZE || (superblock.block_size & (superblock.block_size - 1)) != 0)
+		{
+			fprintf(stderr, ".disk: version %zu with %zu byte blocks isn't supported\n",
+				superblock.version, superblock.block_size);
+			exit(1);
+		}
+		journal_start = 0;
+		journal_ring = 0;
+		hashed_dirs = (superblock.version >= 3);
+		block_size = superblock.block_size;
+		n_root_block = superblock.n_root_block;
+		n_disk_blocks = superblock.num_blocks;
+		bitmap_start = superblock.n_bitmap_block;
+		bitmap_blocks = superblock.num_bitmap_blocks;
+		if (superblock.version >= 2 && superblock.num_journal_blocks > 1)
+		{
+			journal_start = superblock.n_journal_block;
+			journal_ring = superblock.num_journal_blocks - 1;
+		}
+	}
+
+	max_files_in_dir = MAX_FILES_IN_DIR(block_size);
+	max_dirs_in_root = MAX_DIRS_IN_ROOT(block_size);
+	max_extents_in_block = MAX_EXTENTS_IN_BLOCK(block_size);
+	for (max_leaves_in_index = 1; 2 * max_leaves_in_index <= MAX_LEAVES_IN_INDEX(block_size); max_leaves_in_index *= 2)
+	{
+	}
+}
+
+// Write the root back to its block, with where allocation got to
+static void store_root(void)
+{
+	size_t root_buf[block_size / sizeof(size_t)];
+	struct cs1550_root_directory *copy = (struct cs1550_root_directory *) root_buf;
+	memcpy(copy, root, block_size);
+	copy->last_allocated_block = __atomic_load_n(&last_allocated, __ATOMIC_RELAXED);
+	write_meta_block(n_root_block, copy);
+}
+
+/**************
+*             *
+*	BITMAP    *
+*             *
+**************/
+
+// Bits are read and changed with atomic operations, so threads can allocate
+// and free blocks without a lock. A changed bitmap block is only written to the
+// cache by store_bitmap()
+static int check_bit(size_t bit_num)
+{
+	return (__atomic_load_n(&bitmap[bit_num / 8], __ATOMIC_RELAXED) >> (bit_num % 8)) & 1;
+}
+
+// Set a bit. Returns the bit as it was, so only one thread gets to set it
+static int set_bit(size_t bit_num)
+{
+	unsigned char mask = 1 << (bit_num % 8);
+	unsigned char old = __atomic_fetch_or(&bitmap[bit_num / 8], mask, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&bitmap_dirty[bit_num / 8 / block_size], 1, __ATOMIC_RELEASE);
+	return (old & mask) != 0;
+}
+
+static void reset_bit(size_t bit_num)
+{
+	__atomic_fetch_and(&bitmap[bit_num / 8], ~(1 << (bit_num % 8)), __ATOMIC_ACQ_REL);
+	__atomic_store_n(&bitmap_dirty[bit_num / 8 / block_size], 1, __ATOMIC_RELEASE);
+}
+
+// Write the bitmap blocks that changed to the cache. A bit that changes while
+// its block is copied marks the block again, for the next time
+static void store_bitmap(void)
+{
+	char block[block_size];
+	for (size_t i = 0; i < bitmap_blocks; i++)
+	{
+		if (!__atomic_exchange_n(&bitmap_dirty[i], 0, __ATOMIC_ACQ_REL))
+		{
+			continue;
+		}
+		for (size_t j = 0; j < block_size; j++)
+		{
+			block[j] = __atomic_load_n(&bitmap[i * block_size + j], __ATOMIC_RELAXED) &
+			           ~__atomic_load_n(&bitmap_freed[i * block_size + j], __ATOMIC_RELAXED);
+		}
+		write_meta_block(bitmap_start + i, block);
+	}
+}
+
+// Read the bitmap. A new .disk, or one written before there was a bitmap,
+// gets one built from the blocks the root, directories and index blocks use
+static void load_bitmap(void)
+{
+	bitmap = malloc(bitmap_blocks * block_size);
+	bitmap_dirty = calloc(bitmap_blocks, 1);
+	bitmap_freed = calloc(bitmap_blocks, block_size);
+	for (size_t i = 0; i < bitmap_blocks; i++)
+	{
+		read_block(bitmap_start + i, bitmap + i * block_size);
+	}
+	if (check_bit(0))
+	{
+		return;
+	}
+
+	memset(bitmap, 0, bitmap_blocks * block_size);
+	bitmap[0] = 1;
+	bitmap[n_root_block / 8] |= 1 << (n_root_block % 8);
+	for (size_t n = bitmap_start; n < bitmap_start + bitmap_blocks; n++)
+	{
+		bitmap[n / 8] |= 1 << (n % 8);
+	}
+	for (size_t n = journal_start; journal_ring > 0 && n <= journal_start + journal_ring; n++)
+	{
+		bitmap[n / 8] |= 1 << (n % 8);
+	}
+	size_t leaves[max_leaves_in_index];
+	size_t dir_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_entry *dir = (struct cs1550_directory_entry *) dir_buf;
+	for (size_t i = 0; i < root->num_directories; i++)
+	{
+		size_t n_dir_block = root->directories[i].n_start_block;
+		bitmap[n_dir_block / 8] |= 1 << (n_dir_block % 8);
+		size_t num_leaves = dir_leaves(n_dir_block, leaves);
+		for (size_t l = 0; l < num_leaves; l++)
+		{
+			bitmap[leaves[l] / 8] |= 1 << (leaves[l] % 8);
+			read_block(leaves[l], dir);
+			for (size_t j = 0; j < dir->num_files; j++)
+			{
+				struct file_map map;
+				load_map(dir->files[j].n_index_block, &map);
+				for (size_t k = 0; k < map.chain_length; k++)
+				{
+					bitmap[map.chain[k] / 8] |= 1 << (map.chain[k] % 8);
+				}
+				for (size_t k = 0; k < map.num_extents; k++)
+				{
+					struct cs1550_extent *extent = &map.extents[k];
+					for (size_t n = extent->n_start_block; n != 0 && n < extent->n_start_block + extent->num_blocks; n++)
+					{
+						bitmap[n / 8] |= 1 << (n % 8);
+					}
+				}
+				free_map(&map);
+			}
+		}
+	}
+	for (size_t i = 0; i < bitmap_blocks; i++)
+	{
+		write_meta_block(bitmap_start + i, bitmap + i * block_size);
+	}
+}
+
+// Allocate the first free block at or after goal, or after the last block
+// allocated if goal is 0, going round to the start of .disk if need be, so
+// that blocks allocated one after the other end up next to each other.
+// Returns 0 if .disk is full
+static size_t alloc_block(size_t goal)
+{
+	if (goal == 0)
+	{
+		goal = __atomic_load_n(&last_allocated, __ATOMIC_RELAXED) + 1;
+	}
+	if (goal >= n_disk_blocks)
+	{
+		goal = 1;
+	}
+
+	size_t n_block = goal;
+	for (size_t i = 0; i < n_disk_blocks; i++)
+	{
+		// Skip 8 used blocks at a time
+		if (n_block % 8 == 0 && __atomic_load_n(&bitmap[n_block / 8], __ATOMIC_RELAXED) == 0xFF &&
+		    n_block + 8 <= n_disk_blocks)
+		{
+			n_block += 7;
+			i += 7;
+		}
+		else if (!check_bit(n_block) && !set_bit(n_block))
+		{
+			__atomic_store_n(&last_allocated, n_block, __ATOMIC_RELAXED);
+			return n_block;
+		}
+
+		n_block++;
+		if (n_block >= n_disk_blocks)
+		{
+			n_block = 1;
+		}
+	}
+	return 0;
+}
+
+// Free block n_block. With a journal, it can only be allocated again once the
+// transaction that frees it has been committed
+static void free_block(size_t n_block)
+{
+	if (journal_ring == 0)
+	{
+		reset_bit(n_block);
+		return;
+	}
+	__atomic_fetch_or(&bitmap_freed[n_block / 8], 1 << (n_block % 8), __ATOMIC_ACQ_REL);
+	__atomic_store_n(&bitmap_dirty[n_block / 8 / block_size], 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&freed_blocks, 1, __ATOMIC_RELAXED);
+}
+
+// Free a file's index and extent blocks, and every data block they point to
+static void free_file_blocks(size_t n_index_block)
+{
+	struct file_map map;
+	load_map(n_index_block, &map);
+	for (size_t i = 0; i < map.num_extents; i++)
+	{
+		struct cs1550_extent *extent = &map.extents[i];
+		for (size_t n = extent->n_start_block; n != 0 && n < extent->n_start_block + extent->num_blocks; n++)
+		{
+			free_block(n);
+		}
+	}
+	for (size_t i = 0; i < map.chain_length; i++)
+	{
+		free_block(map.chain[i]);
+	}
+	free_map(&map);
+}
+
+/**************
+*             *
+*	EXTENTS   *
+*             *
+**************/
+
+// Add blocks to the end of a map, merging them into the last extent if they follow on from it
+static void map_append(struct file_map *map, size_t n_start_block, size_t num_blocks)
+{
+	if (num_blocks == 0)
+	{
+		return;
+	}
+	if (map->num_extents > 0)
+	{
+		struct cs1550_extent *last = &map->extents[map->num_extents - 1];
+		if ((last->n_start_block == 0 && n_start_block == 0) ||
+		    (last->n_start_block != 0 && last->n_start_block + last->num_blocks == n_start_block))
+		{
+			last->num_blocks += num_blocks;
+			return;
+		}
+	}
+	if (map->num_extents == map->max_extents)
+	{
+		map->max_extents = map->max_extents ? map->max_extents * 2 : max_extents_in_block;
+		map->extents = realloc(map->extents, map->max_extents * sizeof(struct cs1550_extent));
+	}
+	map->extents[map->num_extents].n_start_block = n_start_block;
+	map->extents[map->num_extents].num_blocks = num_blocks;
+	map->num_extents++;
+}
+
+static void map_add_chain(struct file_map *map, size_t n_block)
+{
+	map->chain = realloc(map->chain, (map->chain_length + 1) * sizeof(size_t));
+	map->chain[map->chain_length++] = n_block;
+}
+
+// Read the map of the file with this index block. An index block of the
+// original format, with one entry per block, is turned into extents here and
+// is rewritten as extents the first time the map changes
+static void load_map(size_t n_index_block, struct file_map *map)
+{
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *block = (struct cs1550_extent_block *) block_buf;
+	memset(map, 0, sizeof(struct file_map));
+	read_block(n_index_block, block);
+	map_add_chain(map, n_index_block);
+
+	if (block->magic != EXTENT_MAGIC)
+	{
+		struct cs1550_index_block *index = (struct cs1550_index_block *) block;
+		for (size_t i = 0; i < MAX_ENTRIES_IN_INDEX_BLOCK; i++)
+		{
+			map_append(map, index->entries[i], 1);
+		}
+		// Trailing empty entries aren't part of the file
+		if (map->num_extents > 0 && map->extents[map->num_extents - 1].n_start_block == 0)
+		{
+			map->num_extents--;
+		}
+		return;
+	}
+
+	for (;;)
+	{
+		for (size_t i = 0; i < block->num_extents; i++)
+		{
+			map_append(map, block->extents[i].n_start_block, block->extents[i].num_blocks);
+		}
+		if (block->n_next_block == 0)
+		{
+			break;
+		}
+		map_add_chain(map, block->n_next_block);
+		read_block(block->n_next_block, block);
+	}
+}
+
+// Return the block of .disk that holds block n_file_block of the file, or 0 if it isn't mapped
+static size_t map_lookup(struct file_map *map, size_t n_file_block)
+{
+	size_t num_blocks;
+	return map_lookup_run(map, n_file_block, &num_blocks);
+}
+
+// Same as map_lookup, and also give the number of blocks from n_file_block to
+// the end of its extent, which follow each other in .disk, or are all a hole.
+// Past the end of the map, that's every block left
+static size_t map_lookup_run(struct file_map *map, size_t n_file_block, size_t *num_blocks)
+{
+	for (size_t i = 0; i < map->num_extents; i++)
+	{
+		struct cs1550_extent *extent = &map->extents[i];
+		if (n_file_block < extent->num_blocks)
+		{
+			*num_blocks = extent->num_blocks - n_file_block;
+			return extent->n_start_block ? extent->n_start_block + n_file_block : 0;
+		}
+		n_file_block -= extent->num_blocks;
+	}
+	*num_blocks = SIZE_MAX / MAX_BLOCK_SIZE;
+	return 0;
+}
+
+// Map block n_file_block of the file, which isn't mapped yet, to block n_block of .disk
+static void map_set(struct file_map *map, size_t n_file_block, size_t n_block)
+{
+	map->changed = 1;
+
+	// Find the hole it's in, if it's not past the end
+	size_t i = 0;
+	for (; i < map->num_extents; i++)
+	{
+		if (n_file_block < map->extents[i].num_blocks)
+		{
+			break;
+		}
+		n_file_block -= map->extents[i].num_blocks;
+	}
+	if (i == map->num_extents)
+	{
+		map_append(map, 0, n_file_block);
+		map_append(map, n_block, 1);
+		return;
+	}
+
+	// Split the hole around the block and merge the pieces back with their neighbours
+	struct cs1550_extent hole = map->extents[i];
+	size_t num_after = map->num_extents - i - 1;
+	struct cs1550_extent *after = malloc((num_after + 1) * sizeof(struct cs1550_extent));
+	memcpy(after, &map->extents[i + 1], num_after * sizeof(struct cs1550_extent));
+	map->num_extents = i;
+	map_append(map, 0, n_file_block);
+	map_append(map, n_block, 1);
+	map_append(map, 0, hole.num_blocks - n_file_block - 1);
+	for (size_t j = 0; j < num_after; j++)
+	{
+		map_append(map, after[j].n_start_block, after[j].num_blocks);
+	}
+	free(after);
+}
+
+// Write a map that changed back to its index block, and to as many extent
+// blocks chained to it as it needs. Returns 0, or -ENOSPC if there's no
+// block left for the chain
+static int store_map(struct file_map *map)
+{
+	size_t needed = (map->num_extents + max_extents_in_block - 1) / max_extents_in_block;
+	if (needed == 0)
+	{
+		needed = 1;
+	}
+	while (map->chain_length < needed)
+	{
+		size_t n_block = alloc_block(map->chain[map->chain_length - 1] + 1);
+		if (n_block == 0)
+		{
+			return -ENOSPC;
+		}
+		map_add_chain(map, n_block);
+	}
+	while (map->chain_length > needed)
+	{
+		free_block(map->chain[--map->chain_length]);
+	}
+
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *block = (struct cs1550_extent_block *) block_buf;
+	for (size_t i = 0; i < map->chain_length; i++)
+	{
+		size_t first = i * max_extents_in_block;
+		memset(block, 0, block_size);
+		block->magic = EXTENT_MAGIC;
+		block->num_extents = map->num_extents - first;
+		if (block->num_extents > max_extents_in_block)
+		{
+			block->num_extents = max_extents_in_block;
+		}
+		block->n_next_block = (i + 1 < map->chain_length) ? map->chain[i + 1] : 0;
+		memcpy(block->extents, &map->extents[first], block->num_extents * sizeof(struct cs1550_extent));
+		write_meta_block(map->chain[i], block);
+	}
+	map->changed = 0;
+	return 0;
+}
+
+static void free_map(struct file_map *map)
+{
+	free(map->extents);
+	free(map->chain);
+}
+
+/**************
+*             *
+*	JOURNAL   *
+*             *
+**************/
+
+// FNV-1a hash of a block, carried on from sum
+static size_t checksum_block(size_t sum, const void *buf)
+{
+	const unsigned char *bytes = buf;
+	for (size_t i = 0; i < block_size; i++)
+	{
+		sum = (sum ^ bytes[i]) * 1099511628211u;
+	}
+	return sum;
+}
+
+// Read or write the block at a position of the ring
+static int journal_read(size_t pos, void *buf)
+{
+	size_t n_block = journal_start + 1 + pos % journal_ring;
+	return pread(fd, buf, block_size, n_block * block_size) == (ssize_t) block_size;
+}
+
+static void journal_write(size_t pos, const void *buf)
+{
+	size_t n_block = journal_start + 1 + pos % journal_ring;
+	if (pwrite(fd, buf, block_size, n_block * block_size) != (ssize_t) block_size)
+	{
+		perror(".disk");
+	}
+}
+
+// Write the header, with the tail where it is now
+static void journal_write_header(void)
+{
+	size_t header_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_header *header = (struct cs1550_journal_header *) header_buf;
+	memset(header, 0, block_size);
+	header->magic = JOURNAL_MAGIC;
+	header->tail = journal_tail;
+	header->sequence = journal_sequence;
+	if (pwrite(fd, header, block_size, journal_start * block_size) != (ssize_t) block_size)
+	{
+		perror(".disk");
+	}
+}
+
+// Check the transaction at pos. Returns the position after it, or pos if
+// there's no whole transaction with this sequence number there
+static size_t journal_check(size_t pos, size_t sequence)
+{
+	size_t desc_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_descriptor *desc = (struct cs1550_journal_descriptor *) desc_buf;
+	size_t max_blocks = MAX_BLOCKS_IN_DESCRIPTOR(block_size);
+	size_t sum = 14695981039346656037u;
+	size_t end = pos;
+
+	for (;;)
+	{
+		if (end - pos >= journal_ring || !journal_read(end, desc) || desc->sequence != sequence)
+		{
+			return pos;
+		}
+		if (desc->magic == JOURNAL_COMMIT_MAGIC)
+		{
+			struct cs1550_journal_commit *commit = (struct cs1550_journal_commit *) desc;
+			return (end > pos && commit->checksum == sum) ? end + 1 : pos;
+		}
+		if (desc->magic != JOURNAL_DESCRIPTOR_MAGIC || desc->num_blocks > max_blocks ||
+		    end - pos + 1 + desc->num_blocks >= journal_ring)
+		{
+			return pos;
+		}
+		sum = checksum_block(sum, desc);
+		end++;
+
+		char block[block_size];
+		for (size_t i = 0; i < desc->num_blocks; i++, end++)
+		{
+			if (!journal_read(end, block))
+			{
+				return pos;
+			}
+			sum = checksum_block(sum, block);
+		}
+	}
+}
+
+// Write the blocks of the checked transaction from pos to end in place
+static void journal_apply(size_t pos, size_t end)
+{
+	size_t desc_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_descriptor *desc = (struct cs1550_journal_descriptor *) desc_buf;
+	char block[block_size];
+
+	// The last block is the commit block
+	while (pos + 1 < end)
+	{
+		journal_read(pos++, desc);
+		for (size_t i = 0; i < desc->num_blocks; i++)
+		{
+			journal_read(pos++, block);
+			if (pwrite(fd, block, block_size, desc->blocks[i] * block_size) != (ssize_t) block_size)
+			{
+				perror(".disk");
+			}
+		}
+	}
+}
+
+// Write the transactions committed since the last checkpoint in place, in
+// order, and start the journal empty after them. One that wasn't committed in
+// full is left out, as are the ones after it
+static void replay_journal(void)
+{
+	if (journal_ring == 0)
+	{
+		return;
+	}
+
+	size_t set_size = 1;
+	while (set_size < 2 * journal_ring)
+	{
+		set_size *= 2;
+	}
+	journal_set = calloc(set_size, sizeof(size_t));
+	journal_set_mask = set_size - 1;
+
+	size_t header_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_header *header = (struct cs1550_journal_header *) header_buf;
+	if (pread(fd, header, block_size, journal_start * block_size) != (ssize_t) block_size ||
+	    header->magic != JOURNAL_MAGIC)
+	{
+		header->tail = 0;
+		header->sequence = 1;
+	}
+	journal_tail = header->tail;
+	journal_sequence = header->sequence;
+
+	size_t pos = journal_tail;
+	for (;;)
+	{
+		size_t end = journal_check(pos, journal_sequence);
+		if (end == pos)
+		{
+			break;
+		}
+		journal_apply(pos, end);
+		pos = end;
+		journal_sequence++;
+	}
+
+	// Make what was put back stick before the journal forgets it
+	fdatasync(fd);
+	journal_head = journal_tail = pos;
+	journal_unsynced = 0;
+	journal_write_header();
+	fdatasync(fd);
+}
+
+// Whether n_block has a copy in the journal after the tail. cache_lock must be held
+static int journal_has(size_t n_block)
+{
+	for (size_t i = n_block & journal_set_mask; journal_set[i] != 0; i = (i + 1) & journal_set_mask)
+	{
+		if (journal_set[i] == n_block + 1)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void journal_set_add(size_t n_block)
+{
+	size_t i = n_block & journal_set_mask;
+	while (journal_set[i] != 0 && journal_set[i] != n_block + 1)
+	{
+		i = (i + 1) & journal_set_mask;
+	}
+	journal_set[i] = n_block + 1;
+}
+
+// Append the pinned blocks to the journal as one transaction, and unpin them.
+// They stay dirty until they are evicted or checkpointed. Called with root_lock
+// held for writing and cache_lock held
+static void journal_commit(void)
+{
+	size_t n_pinned = 0;
+	struct cache_block **pinned = malloc(cache_blocks * sizeof(struct cache_block *));
+	for (size_t i = 0; i < cache_blocks; i++)
+	{
+		if (cache[i].valid && cache[i].pinned)
+		{
+			pinned[n_pinned++] = &cache[i];
+		}
+	}
+	if (n_pinned == 0)
+	{
+		free(pinned);
+		return;
+	}
+
+	// A transaction too big for the ring can only be written in place, once
+	// no older copy of its blocks is left to replay over them
+	size_t max_blocks = MAX_BLOCKS_IN_DESCRIPTOR(block_size);
+	size_t length = n_pinned + (n_pinned + max_blocks - 1) / max_blocks + 1;
+	if (length > journal_ring)
+	{
+		journal_checkpoint();
+		qsort(pinned, n_pinned, sizeof(pinned[0]), compare_blocks);
+		for (size_t i = 0; i < n_pinned; i++)
+		{
+			pinned[i]->journaled = 0;
+			cache_write_back(pinned[i]);
+		}
+		free(pinned);
+		return;
+	}
+	if (journal_head + length > journal_tail + journal_ring)
+	{
+		journal_checkpoint();
+	}
+
+	size_t desc_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_descriptor *desc = (struct cs1550_journal_descriptor *) desc_buf;
+	size_t sum = 14695981039346656037u;
+	for (size_t i = 0; i < n_pinned; i += max_blocks)
+	{
+		memset(desc, 0, block_size);
+		desc->magic = JOURNAL_DESCRIPTOR_MAGIC;
+		desc->sequence = journal_sequence;
+		desc->num_blocks = (n_pinned - i < max_blocks) ? n_pinned - i : max_blocks;
+		for (size_t j = 0; j < desc->num_blocks; j++)
+		{
+			desc->blocks[j] = pinned[i + j]->n_block;
+		}
+		sum = checksum_block(sum, desc);
+		journal_write(journal_head++, desc);
+		for (size_t j = 0; j < desc->num_blocks; j++)
+		{
+			sum = checksum_block(sum, pinned[i + j]->data);
+			journal_write(journal_head++, pinned[i + j]->data);
+		}
+	}
+
+	// The data blocks written in place have to be on .disk before a commit
+	// that points to them
+	if (data_unsynced)
+	{
+		fdatasync(fd);
+		data_unsynced = 0;
+		journal_unsynced = 0;
+	}
+
+	struct cs1550_journal_commit *commit = (struct cs1550_journal_commit *) desc;
+	memset(desc, 0, block_size);
+	commit->magic = JOURNAL_COMMIT_MAGIC;
+	commit->sequence = journal_sequence;
+	commit->checksum = sum;
+	journal_write(journal_head++, commit);
+	journal_sequence++;
+	journal_unsynced = 1;
+
+	for (size_t i = 0; i < n_pinned; i++)
+	{
+		pinned[i]->pinned = 0;
+		journal_set_add(pinned[i]->n_block);
+	}
+	pinned_blocks -= n_pinned;
+	free(pinned);
+}
+
+// Write every committed block in place and empty the journal, syncing .disk
+// before and after so no block is in place before its transaction is on
+// .disk, and the journal is only emptied once they all are. cache_lock must
+// be held
+static void journal_checkpoint(void)
+{
+	fdatasync(fd);
+	journal_unsynced = 0;
+	data_unsynced = 0;
+	write_back_blocks(1);
+	fdatasync(fd);
+
+	journal_tail = journal_head;
+	journal_write_header();
+	fdatasync(fd);
+	memset(journal_set, 0, (journal_set_mask + 1) * sizeof(size_t));
+}
+
+// Let the blocks freed before the last commit be allocated again. .disk is
+// synced first, so the commit is there before they can be written over.
+// Called with root_lock held for writing and cache_lock held
+static void release_freed_blocks(void)
+{
+	if (__atomic_load_n(&freed_blocks, __ATOMIC_RELAXED) == 0)
+	{
+		return;
+	}
+	fdatasync(fd);
+	journal_unsynced = 0;
+	data_unsynced = 0;
+	for (size_t i = 0; i < bitmap_blocks * block_size; i++)
+	{
+		unsigned char freed = __atomic_exchange_n(&bitmap_freed[i], 0, __ATOMIC_ACQ_REL);
+		if (freed != 0)
+		{
+			__atomic_fetch_and(&bitmap[i], ~freed, __ATOMIC_ACQ_REL);
+		}
+	}
+	__atomic_store_n(&freed_blocks, 0, __ATOMIC_RELAXED);
+}
+
+/**************
+*             *
+*  READAHEAD  *
+*             *
+**************/
+
+// Called after a read of size bytes at offset. When the read starts where the
+// last one ended, ask for the blocks after it, twice as many as last time up to
+// READAHEAD_MAX, so they are read in while the reader uses these. Reading at
+// any other offset stops it
+static void read_ahead(struct open_file *open_file, struct file_map *map, size_t offset, size_t size)
+{
+	size_t readahead = 0;
+	if (offset != 0 && offset == __atomic_load_n(&open_file->next_read, __ATOMIC_RELAXED))
+	{
+		readahead = 2 * __atomic_load_n(&open_file->readahead, __ATOMIC_RELAXED);
+		if (readahead < size)
+		{
+			readahead = size;
+		}
+		if (readahead > READAHEAD_MAX)
+		{
+			readahead = READAHEAD_MAX;
+		}
+	}
+	__atomic_store_n(&open_file->next_read, offset + size, __ATOMIC_RELAXED);
+	__atomic_store_n(&open_file->readahead, readahead, __ATOMIC_RELAXED);
+
+	// The kernel reads the runs of blocks that are mapped in the background
+	size_t n_file_block = (offset + size + block_size - 1) / block_size;
+	size_t end = (offset + size + readahead + block_size - 1) / block_size;
+	while (n_file_block < end)
+	{
+		size_t run_blocks;
+		size_t n_block = map_lookup_run(map, n_file_block, &run_blocks);
+		if (run_blocks > end - n_file_block)
+		{
+			run_blocks = end - n_file_block;
+		}
+		if (n_block != 0)
+		{
+			posix_fadvise(fd, n_block * block_size, run_blocks * block_size, POSIX_FADV_WILLNEED);
+		}
+		n_file_block += run_blocks;
+	}
+}
+
+/**************
+*             *
+*  FILE DATA  *
+*             *
+**************/
+
+// Read size bytes of a file, starting from offset, into buf, or else into buffers
+// added to *bufv
+static int read_file(const char *path, char *buf, struct fuse_bufvec **bufv, size_t size,
+		     off_t offset, struct fuse_file_info *fi)
+{
+	// Find the file, through the handle from open if there is one
+	pthread_rwlock_rdlock(&root_lock);
+	struct open_file *open_file;
+	int ret = hold_file(path, fi, &open_file);
+	if(ret != 0)
+	{
+		pthread_rwlock_unlock(&root_lock);
+		return ret;
+	}
+
+	//Read the file's map, then the data blocks, with no write to the file going on
+	pthread_rwlock_rdlock(&open_file->lock);
+	struct file_map map;
+	load_map(open_file->n_index_block, &map);
+
+	size_t temp_size = 0;
+	while(temp_size != size)
+	{
+		
+		// Determine the block of the file (offset / block size) and the run of
+		// blocks next to it in .disk. Then calc curr offset and num of bytes to
+		// read, up to the end of the run
+		size_t curr_index = (offset + temp_size) / block_size;
+		size_t curr_offset = (offset + temp_size) % block_size;
+		size_t run_blocks;
+		size_t n_block = map_lookup_run(&map, curr_index, &run_blocks);
+		size_t curr_size = size - temp_size;
+
+		if(run_blocks < (curr_offset + curr_size + block_size - 1) / block_size)
+		{
+			curr_size = run_blocks * block_size - curr_offset;
+		}
+
+		// Holes and blocks past the end of the map read as zeroes
+		if(n_block == 0 && bufv != NULL)
+		{
+			add_buf(bufv, calloc(1, curr_size), curr_size, -1, 0);
+			temp_size += curr_size;
+			continue;
+		}
+		if(n_block == 0)
+		{
+			memset(buf + temp_size, 0, curr_size);
+			temp_size += curr_size;
+			continue;
+		}
+
+		// Read the run in at once, increment bytes copied
+		read_blocks(n_block, curr_offset, curr_size, bufv ? NULL : buf + temp_size, bufv);
+		temp_size += curr_size;
+
+	}
+	
+	read_ahead(open_file, &map, offset, size);
+	free_map(&map);
+	pthread_rwlock_unlock(&open_file->lock);
+	drop_file(fi, open_file);
+	pthread_rwlock_unlock(&root_lock);
+	return bufv ? 0 : (int) size;
+}
+
+// Write size bytes to a file, starting from offset, from buf, or else from bufv
+static int write_file(const char *path, const char *buf, struct fuse_bufvec *bufv, size_t size,
+		      off_t offset, struct fuse_file_info *fi)
+{
+	// Find the file, through the handle from open if there is one
+	pthread_rwlock_rdlock(&root_lock);
+	struct open_file *open_file;
+	int ret = hold_file(path, fi, &open_file);
+	if(ret != 0)
+	{
+		pthread_rwlock_unlock(&root_lock);
+		return ret;
+	}
+
+	//Read the file's map, with the file locked until its size is written
+	pthread_rwlock_wrlock(&open_file->lock);
+	struct file_map map;
+	load_map(open_file->n_index_block, &map);
+
+	char data[block_size];
+
+	// Whole blocks from bufv that go straight to .disk, waiting to be written
+	// together while they follow each other
+	size_t direct_start = 0;
+	size_t direct_blocks = 0;
+
+	size_t temp_size = 0;
+	while(temp_size != size)
+	{
+		// Use the offset to determine the index
+		// Calc offset for curr data block and amount of bytes to write, up to the end of the block
+		size_t curr_index = (offset + temp_size) / block_size;
+		size_t curr_offset = (offset + temp_size) % block_size;
+		size_t curr_size = block_size - curr_offset;
+		if((size - temp_size) < curr_size)
+		{
+			curr_size = size - temp_size;
+		}
+
+		// If the block isn't mapped yet, allocate a new block if there's space, right after
+		// the file's previous block so the file stays contiguous
+		size_t n_block = map_lookup(&map, curr_index);
+		int new_block = (n_block == 0);
+		if(new_block)
+		{
+			size_t goal = open_file->n_index_block + 1;
+			if(curr_index > 0 && map_lookup(&map, curr_index - 1) != 0)
+			{
+				goal = map_lookup(&map, curr_index - 1) + 1;
+			}
+			n_block = alloc_block(goal);
+			if(n_block == 0)
+			{
+				ret = -ENOSPC;
+				break;
+			}
+			map_set(&map, curr_index, n_block);
+		}
+
+		// A whole block from bufv goes straight to .disk if it can, together
+		// with the ones before it if it follows them
+		int direct = (bufv != NULL && curr_size == block_size && can_write_direct(n_block));
+		if(direct_blocks > 0 && !(direct && n_block == direct_start + direct_blocks))
+		{
+			ret = write_direct(bufv, direct_start, direct_blocks);
+			if(ret != 0)
+			{
+				temp_size -= direct_blocks * block_size;
+				direct_blocks = 0;
+				break;
+			}
+			direct_blocks = 0;
+		}
+		if(direct)
+		{
+			if(direct_blocks == 0)
+			{
+				direct_start = n_block;
+			}
+			direct_blocks++;
+			temp_size += curr_size;
+			continue;
+		}
+
+		// Read in the current data block, unless it's new or all of it is written
+		if(new_block || curr_size == block_size)
+		{
+			memset(data, 0, block_size);
+		}
+		else
+		{
+			read_block(n_block, data);
+		}
+
+		// Copy contents. Write change back
+		if(bufv != NULL)
+		{
+			struct fuse_bufvec dst = FUSE_BUFVEC_INIT(curr_size);
+			dst.buf[0].mem = data + curr_offset;
+			if(fuse_buf_copy(&dst, bufv, 0) != (ssize_t) curr_size)
+			{
+				ret = -EIO;
+				break;
+			}
+		}
+		else
+		{
+			memcpy(data + curr_offset, buf + temp_size, curr_size);
+		}
+		write_block(n_block, data);
+		temp_size += curr_size;
+
+	}
+	if(direct_blocks > 0)
+	{
+		ret = write_direct(bufv, direct_start, direct_blocks);
+		if(ret != 0)
+		{
+			temp_size -= direct_blocks * block_size;
+		}
+	}
+
+	// Write the map and root back to disk if blocks were allocated
+	if(map.changed)
+	{
+		int err = store_map(&map);
+		if(err != 0)
+		{
+			temp_size = 0;
+			ret = err;
+		}
+		store_root();
+	}
+	free_map(&map);
+	
+	// Report a full disk only if nothing could be written
+	int full = (temp_size == 0 && ret != 0);
+
+	// Increment file size and write changes. The file has no slot if it was
+	// unlinked while open, and its directory may be gone since
+	pthread_rwlock_wrlock(dir_lock(open_file->n_dir_block));
+	if(!full && !open_file->unlinked)
+	{
+		size_t dir_buf[block_size / sizeof(size_t)];
+		struct cs1550_directory_entry *matching_directory = (struct cs1550_directory_entry *) dir_buf;
+		size_t n_leaf_block = find_leaf(open_file->n_dir_block, open_file->hash);
+		read_block(n_leaf_block, matching_directory);
+		int n_file = find_file_by_index(matching_directory, open_file->n_index_block);
+		if(n_file >= 0)
+		{
+			struct cs1550_file_entry *matching_file = &matching_directory->files[n_file];
+			if(offset == 0)
+				matching_file->fsize = temp_size;
+
+			else
+				matching_file->fsize += temp_size;
+
+			write_meta_block(n_leaf_block, matching_directory);
+		}
+	}
+	pthread_rwlock_unlock(dir_lock(open_file->n_dir_block));
+	pthread_rwlock_unlock(&open_file->lock);
+	drop_file(fi, open_file);
+	pthread_rwlock_unlock(&root_lock);
+	commit_if_due();
+
+	// Try again once the blocks freed since the last commit can be allocated,
+	// unless some of bufv was already taken
+	if(full && ret == -ENOSPC && (bufv == NULL || (bufv->idx == 0 && bufv->off == 0)) &&
+	   commit_freed_blocks())
+	{
+		return write_file(path, buf, bufv, size, offset, fi);
+	}
+	return full ? ret : (int) temp_size;
+}
+
+// Add a buffer to the end of *bufv: size bytes at mem, which FUSE frees, or
+// else at pos in buf_fd. Room for buffers is doubled whenever the count
+// reaches a power of 2
+static void add_buf(struct fuse_bufvec **bufv, void *mem, size_t size, int buf_fd, off_t pos)
+{
+	size_t count = (*bufv)->count;
+	if (count > 0 && (count & (count - 1)) == 0)
+	{
+		*bufv = realloc(*bufv, sizeof(struct fuse_bufvec) + (2 * count - 1) * sizeof(struct fuse_buf));
+	}
+
+	struct fuse_buf *buf = &(*bufv)->buf[count];
+	buf->size = size;
+	buf->flags = (buf_fd < 0) ? 0 : (FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+	buf->mem = mem;
+	buf->fd = buf_fd;
+	buf->pos = pos;
+	(*bufv)->count++;
+}
+
+// Whether block n_block can be written straight to .disk: it isn't cached, so
+// no stale copy of it is left behind, and it has no copy in the journal, which
+// replay would put back over it. The file's lock keeps it from being cached
+// meanwhile
+static int can_write_direct(size_t n_block)
+{
+	pthread_mutex_lock(&cache_lock);
+	int direct = cache_lookup(n_block) == NULL && (journal_ring == 0 || !journal_has(n_block));
+	pthread_mutex_unlock(&cache_lock);
+	return direct;
+}
+
+// Copy num_blocks blocks' worth of bufv to .disk, from block n_block on.
+// Returns 0, or -EIO if bufv ran short or .disk couldn't be written
+static int write_direct(struct fuse_bufvec *bufv, size_t n_block, size_t num_blocks)
+{
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(num_blocks * block_size);
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = fd;
+	dst.buf[0].pos = n_block * block_size;
+	ssize_t copied = fuse_buf_copy(&dst, bufv, 0);
+
+	pthread_mutex_lock(&cache_lock);
+	data_unsynced = 1;
+	pthread_mutex_unlock(&cache_lock);
+	return copied == (ssize_t) (num_blocks * block_size) ? 0 : -EIO;
+}
+
+/**************
+*             *
+* DIRECTORIES *
+*             *
+**************/
+
+// FNV-1a hash of a file's name as it's written in a path, which picks its
+// leaf in a hashed directory
+static size_t hash_name(const char *filename, const char *extension)
+{
+	size_t hash = 14695981039346656037u;
+	for (const char *c = filename; *c != '\0'; c++)
+	{
+		hash = (hash ^ (unsigned char) *c) * 1099511628211u;
+	}
+	if (extension[0] != '\0')
+	{
+		hash = (hash ^ '.') * 1099511628211u;
+		for (const char *c = extension; *c != '\0'; c++)
+		{
+			hash = (hash ^ (unsigned char) *c) * 1099511628211u;
+		}
+	}
+	return hash;
+}
+
+// Return the block that holds the directory's files with this hash: the
+// directory's own block, unless it's hashed. The directory must be locked
+static size_t find_leaf(size_t n_dir_block, size_t hash)
+{
+	size_t index_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_index *index = (struct cs1550_directory_index *) index_buf;
+	read_block(n_dir_block, index);
+	if (index->magic != DIRECTORY_INDEX_MAGIC)
+	{
+		return n_dir_block;
+	}
+	return index->leaves[hash & (((size_t) 1 << index->depth) - 1)];
+}
+
+// List every block that holds the directory's files once, in leaves, which
+// has room for max_leaves_in_index. Returns how many there are. The directory
+// must be locked
+static size_t dir_leaves(size_t n_dir_block, size_t *leaves)
+{
+	size_t index_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_index *index = (struct cs1550_directory_index *) index_buf;
+	read_block(n_dir_block, index);
+	if (index->magic != DIRECTORY_INDEX_MAGIC)
+	{
+		leaves[0] = n_dir_block;
+		return 1;
+	}
+
+	// A leaf is picked by the slots that match it up to its depth, so a slot
+	// picks a leaf already listed when the slot without its top bit picks it too
+	size_t num_leaves = 0;
+	for (size_t i = 0; i < ((size_t) 1 << index->depth); i++)
+	{
+		size_t top = i;
+		while ((top & (top - 1)) != 0)
+		{
+			top &= top - 1;
+		}
+		if (i == 0 || index->leaves[i] != index->leaves[i - top])
+		{
+			leaves[num_leaves++] = index->leaves[i];
+		}
+	}
+	return num_leaves;
+}
+
+// Split the leaf the hash picks in a hashed directory, or else hash the
+// directory, its files moving to a leaf which is then split. The files of the
+// leaf whose hash has the next bit set move to a new leaf, along with the
+// slots that pick them, the index doubling first if the leaf has one slot.
+// The directory must be locked for writing. Returns 0, or -ENOSPC if the
+// index can't grow or there's no block left
+static int split_leaf(size_t n_dir_block, size_t hash)
+{
+	size_t index_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_index *index = (struct cs1550_directory_index *) index_buf;
+	read_block(n_dir_block, index);
+	int hashed = (index->magic == DIRECTORY_INDEX_MAGIC);
+	size_t depth = hashed ? index->depth : 0;
+	size_t n_old_block = hashed ? index->leaves[hash & (((size_t) 1 << depth) - 1)] : n_dir_block;
+
+	// The leaf's own depth, from how many slots pick it
+	size_t leaf_depth = depth;
+	size_t picked = 0;
+	for (size_t i = 0; hashed && i < ((size_t) 1 << depth); i++)
+	{
+		picked += (index->leaves[i] == n_old_block);
+	}
+	for (; picked > 1; picked /= 2)
+	{
+		leaf_depth--;
+	}
+	if (leaf_depth == depth && ((size_t) 2 << depth) > max_leaves_in_index)
+	{
+		return -ENOSPC;
+	}
+
+	// Allocate the new leaf, and the leaf the files of a directory of one block move to
+	size_t n_new_block = alloc_block(n_dir_block + 1);
+	size_t n_moved_block = (!hashed && n_new_block != 0) ? alloc_block(n_new_block + 1) : 0;
+	if (n_new_block == 0 || (!hashed && n_moved_block == 0))
+	{
+		if (n_new_block != 0)
+		{
+			reset_bit(n_new_block);
+		}
+		return -ENOSPC;
+	}
+
+	size_t old_buf[block_size / sizeof(size_t)];
+	size_t new_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_entry *old_leaf = (struct cs1550_directory_entry *) old_buf;
+	struct cs1550_directory_entry *new_leaf = (struct cs1550_directory_entry *) new_buf;
+	read_block(n_old_block, old_leaf);
+	memset(new_leaf, 0, block_size);
+	if (!hashed)
+	{
+		memset(index, 0, block_size);
+		index->magic = DIRECTORY_INDEX_MAGIC;
+		index->depth = 0;
+		index->leaves[0] = n_moved_block;
+		n_old_block = n_moved_block;
+	}
+	if (leaf_depth == index->depth)
+	{
+		memcpy(&index->leaves[(size_t) 1 << index->depth], index->leaves, ((size_t) 1 << index->depth) * sizeof(size_t));
+		index->depth++;
+	}
+
+	// Move the files, filling each gap with the last file
+	size_t bit = (size_t) 1 << leaf_depth;
+	for (size_t i = 0; i < old_leaf->num_files; )
+	{
+		struct cs1550_file_entry *file = &old_leaf->files[i];
+		if ((hash_name(file->fname, file->fext) & bit) == 0)
+		{
+			i++;
+			continue;
+		}
+		new_leaf->files[new_leaf->num_files++] = *file;
+		old_leaf->num_files--;
+		*file = old_leaf->files[old_leaf->num_files];
+		memset(&old_leaf->files[old_leaf->num_files], 0, sizeof(struct cs1550_file_entry));
+	}
+	for (size_t i = 0; i < ((size_t) 1 << index->depth); i++)
+	{
+		if (index->leaves[i] == n_old_block && (i & bit) != 0)
+		{
+			index->leaves[i] = n_new_block;
+		}
+	}
+
+	write_meta_block(n_old_block, old_leaf);
+	write_meta_block(n_new_block, new_leaf);
+	write_meta_block(n_dir_block, index);
+
+	// Files moved to other blocks, so forget where every path led
+	dcache_clear();
+	return 0;
+}
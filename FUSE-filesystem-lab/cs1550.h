@@ -4,9 +4,13 @@
 #include <assert.h>
 #include <stdlib.h>
 
-/* Size of a disk block */
+/* Size of a disk block in a `.disk` file without a superblock */
 #define BLOCK_SIZE	512
 
+/* Block sizes a superblock may give */
+#define MIN_BLOCK_SIZE	512
+#define MAX_BLOCK_SIZE	65536
+
 /* We'll use 8.3 filenames */
 #define MAX_FILENAME	8
 #define MAX_EXTENSION	3
@@ -15,12 +19,61 @@
 #define PACKED		__attribute__((packed))
 
 
+/*
+ * The superblock.
+ *
+ * A `.disk` file made by mkfs.cs1550 starts with a superblock that gives its
+ * block size and where the root directory, the free-space bitmap and the
+ * journal are. Every other structure is one block large, and how many entries
+ * it holds follows from the block size. A `.disk` file without a superblock
+ * has BLOCK_SIZE blocks, the root directory in block 0, the bitmap in its last
+ * blocks and no journal.
+ */
+
+#define SUPERBLOCK_MAGIC	0x4b4c425330353531ULL
+#define CS1550_VERSION		3
+
+struct cs1550_superblock {
+	/* Always SUPERBLOCK_MAGIC, which is never a block number, so a root
+	 * directory in block 0 can be told apart */
+	size_t magic;
+
+	/* Version of the format. Disks of a later version aren't mounted.
+	 * Directories only grow past one block from version 3 on. */
+	size_t version;
+
+	/* Size of a block in bytes, a power of 2 from MIN_BLOCK_SIZE to
+	 * MAX_BLOCK_SIZE */
+	size_t block_size;
+
+	/* Number of blocks in the `.disk` file */
+	size_t num_blocks;
+
+	/* Block number of the root directory */
+	size_t n_root_block;
+
+	/* Block number of the first block of the free-space bitmap, and the
+	 * number of blocks it takes */
+	size_t n_bitmap_block;
+	size_t num_bitmap_blocks;
+
+	/* Block number of the journal's header block, and the number of blocks
+	 * the journal takes, or 0 for none. Version 1 disks have no journal. */
+	size_t n_journal_block;
+	size_t num_journal_blocks;
+};
+
+
+
 /*
  * Regular files and subdirectories.
+ *
+ * A subdirectory starts as one block of files. Once it is full it becomes a
+ * hashed directory: its first block is then an index of leaf blocks, each one
+ * a block of files like the first was.
  */
 
-#define MAX_FILES_IN_DIR ((BLOCK_SIZE - sizeof(size_t)) / sizeof(struct cs1550_file_entry))
-#define DIRECTORY_PADDING (BLOCK_SIZE - sizeof(size_t) - MAX_FILES_IN_DIR*sizeof(struct cs1550_file_entry))
+#define MAX_FILES_IN_DIR(block_size) (((block_size) - sizeof(size_t)) / sizeof(struct cs1550_file_entry))
 
 struct PACKED cs1550_file_entry {
 	/* File name, plus extra space for the null terminator */
@@ -40,11 +93,37 @@ struct cs1550_directory_entry {
 	/* Number of files in directory. Must be less than MAX_FILES_IN_DIR */
 	size_t num_files;
 
-	/* The actual files */
-	struct cs1550_file_entry files[MAX_FILES_IN_DIR];
+	/* The actual files, as many as fit in the rest of the block */
+	struct cs1550_file_entry files[];
+};
 
-	/* Padding so the entry is one block large. Don't use this field. */
-	char __padding[DIRECTORY_PADDING];
+
+
+/*
+ * Hashed directories.
+ *
+ * The index of a hashed directory starts with DIRECTORY_INDEX_MAGIC, which is
+ * never a number of files, so a directory of one block can be told apart. A
+ * file goes in the leaf that the low `depth` bits of its hash pick, the hash
+ * being the 64-bit FNV-1a hash of its name as written in a path (`name` or
+ * `name.ext`). A leaf can be picked by several slots: those whose low bits
+ * match up to the leaf's own depth. When a leaf is full it is split on the
+ * next bit of the hash, the index doubling first if the leaf was picked by one
+ * slot only, up to as many slots as fit in the block that are a power of 2.
+ */
+
+#define DIRECTORY_INDEX_MAGIC	0x5844444930353531ULL
+#define MAX_LEAVES_IN_INDEX(block_size) (((block_size) - 2*sizeof(size_t)) / sizeof(size_t))
+
+struct cs1550_directory_index {
+	/* Always DIRECTORY_INDEX_MAGIC */
+	size_t magic;
+
+	/* The index has 2^depth slots */
+	size_t depth;
+
+	/* Block number of the leaf each slot picks */
+	size_t leaves[];
 };
 
 
@@ -53,8 +132,7 @@ struct cs1550_directory_entry {
  * The root directory and all of its subdirectories.
  */
 
-#define MAX_DIRS_IN_ROOT ((BLOCK_SIZE - 2*sizeof(size_t)) / sizeof(struct cs1550_directory))
-#define ROOT_PADDING (BLOCK_SIZE - 2*sizeof(size_t) - MAX_DIRS_IN_ROOT*sizeof(struct cs1550_directory))
+#define MAX_DIRS_IN_ROOT(block_size) (((block_size) - 2*sizeof(size_t)) / sizeof(struct cs1550_directory))
 
 struct PACKED cs1550_directory {
 	/* Directory name, plus extra space for the null terminator */
@@ -71,30 +149,129 @@ struct cs1550_root_directory {
 	/* Number of subdirectories under the root */
 	size_t num_directories;
 
-	/* All subdirectories of the root */
-	struct cs1550_directory directories[MAX_DIRS_IN_ROOT];
-
-	/* Padding so the entry is one block large. Don't use this field. */
-	char __padding[ROOT_PADDING];
+	/* All subdirectories of the root, as many as fit in the rest of the
+	 * block */
+	struct cs1550_directory directories[];
 };
 
 
 
 /*
  * Index and file data blocks.
+ *
+ * Index blocks of the original format, with one entry per data block, are
+ * only found in `.disk` files without a superblock, so they are always
+ * BLOCK_SIZE large. Data blocks are a whole block of file data.
  */
 
 #define MAX_ENTRIES_IN_INDEX_BLOCK	(BLOCK_SIZE / sizeof(size_t))
-#define MAX_DATA_IN_BLOCK		BLOCK_SIZE
 
 struct cs1550_index_block {
 	/* Block numbers for each data block. */
 	size_t entries[MAX_ENTRIES_IN_INDEX_BLOCK];
 };
 
-struct cs1550_data_block {
-	/* All space in the block can be used to store file data. */
-	char data[MAX_DATA_IN_BLOCK];
+
+
+/*
+ * Extent index blocks.
+ *
+ * Files map their blocks with extents, runs of blocks that are next to each
+ * other in the `.disk` file, instead of one entry per block. Such an index
+ * block starts with EXTENT_MAGIC, which is never a block number, so index
+ * blocks of the original format can still be told apart. When a file has
+ * more extents than fit in its index block, more extent blocks are chained
+ * to it.
+ */
+
+#define EXTENT_MAGIC	0x4e45545830353531ULL
+#define MAX_EXTENTS_IN_BLOCK(block_size) (((block_size) - 3*sizeof(size_t)) / sizeof(struct cs1550_extent))
+
+struct PACKED cs1550_extent {
+	/* Block number of the first block in the `.disk` file, or 0 for a hole */
+	size_t n_start_block;
+
+	/* Number of blocks in the extent */
+	size_t num_blocks;
+};
+
+struct cs1550_extent_block {
+	/* Always EXTENT_MAGIC */
+	size_t magic;
+
+	/* Number of extents in this block */
+	size_t num_extents;
+
+	/* Block number of the next extent block of the file, or 0 */
+	size_t n_next_block;
+
+	/* The file's extents, in file order, following the previous block's */
+	struct cs1550_extent extents[];
+};
+
+
+
+/*
+ * Free-space bitmap.
+ *
+ * One bit per block, set while the block is in use. Without a superblock,
+ * it is kept in the last blocks of the `.disk` file.
+ */
+
+#define BITMAP_BLOCKS(num_blocks, block_size) (((num_blocks) + (block_size)*8 - 1) / ((block_size)*8))
+
+
+
+/*
+ * Metadata journal.
+ *
+ * Changes to the root, directory, index and bitmap blocks are appended to the
+ * journal as transactions before they are written in place. The journal is a
+ * header block followed by a ring of blocks. A transaction is one or more
+ * descriptor blocks, each followed by copies of the blocks it lists, then a
+ * commit block with a checksum of them all. Transactions whose blocks may not
+ * all be in place yet start at position `tail` of the ring, and are written in
+ * place again when the `.disk` is next mounted. A position counts blocks
+ * written to the ring since it was made, so it is taken modulo the length of
+ * the ring.
+ */
+
+#define JOURNAL_MAGIC			0x4c4e524a30353531ULL
+#define JOURNAL_DESCRIPTOR_MAGIC	0x4353444a30353531ULL
+#define JOURNAL_COMMIT_MAGIC		0x544d434a30353531ULL
+#define MAX_BLOCKS_IN_DESCRIPTOR(block_size) (((block_size) - 3*sizeof(size_t)) / sizeof(size_t))
+
+struct cs1550_journal_header {
+	/* Always JOURNAL_MAGIC */
+	size_t magic;
+
+	/* Position of the first transaction to write in place on mount, and
+	 * its sequence number. Each transaction's is one more than the last */
+	size_t tail;
+	size_t sequence;
+};
+
+struct cs1550_journal_descriptor {
+	/* Always JOURNAL_DESCRIPTOR_MAGIC */
+	size_t magic;
+
+	/* Sequence number of the transaction */
+	size_t sequence;
+
+	/* Number of blocks that follow, and their block numbers in the `.disk` file */
+	size_t num_blocks;
+	size_t blocks[];
+};
+
+struct cs1550_journal_commit {
+	/* Always JOURNAL_COMMIT_MAGIC */
+	size_t magic;
+
+	/* Sequence number of the transaction */
+	size_t sequence;
+
+	/* Checksum of the transaction's descriptor blocks and block copies */
+	size_t checksum;
 };
 
 
@@ -103,9 +280,12 @@ struct cs1550_data_block {
  * Ensure everything is sized exactly as it should be.
  */
 
-static_assert(sizeof(struct cs1550_directory_entry) == BLOCK_SIZE, "wrong size");
-static_assert(sizeof(struct cs1550_root_directory)  == BLOCK_SIZE, "wrong size");
+static_assert(sizeof(struct cs1550_superblock)      <= MIN_BLOCK_SIZE, "wrong size");
+static_assert(sizeof(struct cs1550_directory_entry) == sizeof(size_t), "wrong size");
+static_assert(sizeof(struct cs1550_directory_index) == 2*sizeof(size_t), "wrong size");
+static_assert(sizeof(struct cs1550_root_directory)  == 2*sizeof(size_t), "wrong size");
 static_assert(sizeof(struct cs1550_index_block)     == BLOCK_SIZE, "wrong size");
-static_assert(sizeof(struct cs1550_data_block)      == BLOCK_SIZE, "wrong size");
+static_assert(sizeof(struct cs1550_extent_block)    == 3*sizeof(size_t), "wrong size");
+static_assert(sizeof(struct cs1550_journal_descriptor) == 3*sizeof(size_t), "wrong size");
 
 #endif // CS1550_H
@@ -0,0 +1,580 @@
+/*
+ * Creates an empty `.disk` file with a superblock and a metadata journal, or
+ * upgrades an existing one in place: every file is mapped with extent index
+ * blocks, and a `.disk` without a superblock gets one, its root directory
+ * moving out of block 0. A `.disk` without a journal gets one if there is a
+ * run of free blocks long enough for it.
+ *
+ *   ./mkfs.cs1550 -s 64 -b 4096 .disk   (a new 64 MB disk of 4 KB blocks)
+ *   ./mkfs.cs1550 -u .disk              (upgrade an old disk)
+ *
+ * The filesystem reads `.disk` files without a superblock and index blocks
+ * of either format, and rewrites a file's index block as extents the first
+ * time the file's blocks change. Upgrading only gets the rest up to date at
+ * once. The block size of an existing `.disk` can't be changed, and one whose
+ * journal still has transactions to replay has to be mounted first.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cs1550.h"
+
+// Smallest journal -j takes, and the journal size given when there's no -j
+#define MIN_JOURNAL_BLOCKS	16
+#define DEFAULT_JOURNAL		((size_t) -1)
+
+// .disk file
+static FILE *f;
+// Layout of .disk
+static size_t block_size;
+static size_t num_blocks;
+static size_t n_root_block;
+static size_t bitmap_start;
+static size_t bitmap_blocks;
+static size_t journal_start;
+static size_t journal_blocks;
+static unsigned char *bitmap;
+
+static void read_block(size_t n_block, void *buf)
+{
+	fseek(f, n_block * block_size, SEEK_SET);
+	if (fread(buf, block_size, 1, f) != 1)
+	{
+		memset(buf, 0, block_size);
+	}
+}
+
+static void write_block(size_t n_block, const void *buf)
+{
+	fseek(f, n_block * block_size, SEEK_SET);
+	fwrite(buf, block_size, 1, f);
+}
+
+static void mark_used(size_t n_block)
+{
+	bitmap[n_block / 8] |= 1 << (n_block % 8);
+}
+
+// Start a bitmap with only block 0, the root, the journal and the bitmap's
+// own blocks in use. The bitmap takes the last blocks of .disk
+static void new_bitmap(void)
+{
+	bitmap_blocks = BITMAP_BLOCKS(num_blocks, block_size);
+	bitmap_start = num_blocks - bitmap_blocks;
+	bitmap = calloc(bitmap_blocks, block_size);
+	mark_used(0);
+	mark_used(n_root_block);
+	for (size_t n = journal_start; n < journal_start + journal_blocks; n++)
+	{
+		mark_used(n);
+	}
+	for (size_t n = bitmap_start; n < num_blocks; n++)
+	{
+		mark_used(n);
+	}
+}
+
+static void write_bitmap(void)
+{
+	for (size_t i = 0; i < bitmap_blocks; i++)
+	{
+		write_block(bitmap_start + i, bitmap + i * block_size);
+	}
+}
+
+// Write the superblock of the current layout to block 0
+static void write_superblock(void)
+{
+	char *block = calloc(1, block_size);
+	struct cs1550_superblock *superblock = (struct cs1550_superblock *) block;
+	superblock->magic = SUPERBLOCK_MAGIC;
+	superblock->version = CS1550_VERSION;
+	superblock->block_size = block_size;
+	superblock->num_blocks = num_blocks;
+	superblock->n_root_block = n_root_block;
+	superblock->n_bitmap_block = bitmap_start;
+	superblock->num_bitmap_blocks = bitmap_blocks;
+	superblock->n_journal_block = journal_start;
+	superblock->num_journal_blocks = journal_blocks;
+	write_block(0, block);
+	free(block);
+}
+
+// Write an empty journal's header block
+static void write_journal_header(void)
+{
+	char *block = calloc(1, block_size);
+	struct cs1550_journal_header *header = (struct cs1550_journal_header *) block;
+	header->magic = JOURNAL_MAGIC;
+	header->tail = 0;
+	header->sequence = 1;
+	write_block(journal_start, block);
+	free(block);
+}
+
+// Whether the journal holds a transaction that hasn't been replayed. Only
+// the first block after the tail needs checking: the filesystem empties the
+// journal when it's unmounted, and the blocks after an empty journal's tail
+// are of older transactions
+static int journal_pending(void)
+{
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_journal_header *header = (struct cs1550_journal_header *) block_buf;
+	read_block(journal_start, header);
+	if (header->magic != JOURNAL_MAGIC)
+	{
+		return 0;
+	}
+
+	size_t sequence = header->sequence;
+	struct cs1550_journal_descriptor *desc = (struct cs1550_journal_descriptor *) block_buf;
+	read_block(journal_start + 1 + header->tail % (journal_blocks - 1), desc);
+	return desc->magic == JOURNAL_DESCRIPTOR_MAGIC && desc->sequence == sequence;
+}
+
+// Size of the journal to make: 1/32 of .disk unless -j gave one
+static size_t new_journal_size(void)
+{
+	if (journal_blocks != DEFAULT_JOURNAL)
+	{
+		return journal_blocks;
+	}
+	return (num_blocks / 32 < MIN_JOURNAL_BLOCKS) ? MIN_JOURNAL_BLOCKS : num_blocks / 32;
+}
+
+// Find a run of length free blocks. Returns its first block, or 0 if there is none
+static size_t find_free_run(size_t length)
+{
+	size_t run = 0;
+	for (size_t n = 1; n < num_blocks; n++)
+	{
+		run = (bitmap[n / 8] & (1 << (n % 8))) ? 0 : run + 1;
+		if (run == length)
+		{
+			return n + 1 - length;
+		}
+	}
+	return 0;
+}
+
+// Allocate the first free block at or after goal. Returns 0 if .disk is full
+static size_t alloc_block(size_t goal)
+{
+	for (size_t i = 0, n = goal; i < num_blocks; i++, n++)
+	{
+		if (n >= num_blocks)
+		{
+			n = 1;
+		}
+		if (!(bitmap[n / 8] & (1 << (n % 8))))
+		{
+			mark_used(n);
+			return n;
+		}
+	}
+	return 0;
+}
+
+// Mark a file's index block, extent blocks and data blocks in use
+static void mark_file(size_t n_index_block)
+{
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *block = (struct cs1550_extent_block *) block_buf;
+	read_block(n_index_block, block);
+	mark_used(n_index_block);
+
+	if (block->magic != EXTENT_MAGIC)
+	{
+		struct cs1550_index_block *index = (struct cs1550_index_block *) block;
+		for (size_t i = 0; i < MAX_ENTRIES_IN_INDEX_BLOCK; i++)
+		{
+			if (index->entries[i] != 0)
+			{
+				mark_used(index->entries[i]);
+			}
+		}
+		return;
+	}
+
+	for (;;)
+	{
+		for (size_t i = 0; i < block->num_extents; i++)
+		{
+			struct cs1550_extent *extent = &block->extents[i];
+			for (size_t n = 0; extent->n_start_block != 0 && n < extent->num_blocks; n++)
+			{
+				mark_used(extent->n_start_block + n);
+			}
+		}
+		if (block->n_next_block == 0)
+		{
+			break;
+		}
+		mark_used(block->n_next_block);
+		read_block(block->n_next_block, block);
+	}
+}
+
+// List the blocks that hold a directory's files, each once: its own block,
+// or the leaves of its index. Returns how many there are
+static size_t dir_leaves(size_t n_dir_block, size_t *leaves)
+{
+	size_t index_buf[block_size / sizeof(size_t)];
+	struct cs1550_directory_index *index = (struct cs1550_directory_index *) index_buf;
+	read_block(n_dir_block, index);
+	if (index->magic != DIRECTORY_INDEX_MAGIC)
+	{
+		leaves[0] = n_dir_block;
+		return 1;
+	}
+
+	// A slot picks a leaf already listed when the slot without its top bit does
+	size_t num_leaves = 0;
+	for (size_t i = 0; i < ((size_t) 1 << index->depth); i++)
+	{
+		size_t top = i;
+		while ((top & (top - 1)) != 0)
+		{
+			top &= top - 1;
+		}
+		if (i == 0 || index->leaves[i] != index->leaves[i - top])
+		{
+			leaves[num_leaves++] = index->leaves[i];
+		}
+	}
+	return num_leaves;
+}
+
+// Rewrite an index block of the original format as extents. Returns 0, or 1
+// if there was no block left for the extents that don't fit in it
+static int convert_file(size_t n_index_block)
+{
+	struct cs1550_index_block index;
+	struct cs1550_extent extents[MAX_ENTRIES_IN_INDEX_BLOCK];
+	size_t num_extents = 0;
+
+	// Merge runs of blocks, and of empty entries, into extents
+	read_block(n_index_block, &index);
+	for (size_t i = 0; i < MAX_ENTRIES_IN_INDEX_BLOCK; i++)
+	{
+		size_t n_block = index.entries[i];
+		struct cs1550_extent *last = num_extents ? &extents[num_extents - 1] : NULL;
+		if (last != NULL && ((last->n_start_block == 0 && n_block == 0) ||
+		    (last->n_start_block != 0 && last->n_start_block + last->num_blocks == n_block)))
+		{
+			last->num_blocks++;
+		}
+		else
+		{
+			extents[num_extents].n_start_block = n_block;
+			extents[num_extents].num_blocks = 1;
+			num_extents++;
+		}
+	}
+	// Trailing empty entries aren't part of the file
+	if (num_extents > 0 && extents[num_extents - 1].n_start_block == 0)
+	{
+		num_extents--;
+	}
+
+	// Chain as many extent blocks as needed after the index block
+	size_t chain[MAX_ENTRIES_IN_INDEX_BLOCK];
+	size_t chain_length = 1;
+	chain[0] = n_index_block;
+	size_t max_extents = MAX_EXTENTS_IN_BLOCK(block_size);
+	while (chain_length * max_extents < num_extents)
+	{
+		chain[chain_length] = alloc_block(chain[chain_length - 1] + 1);
+		if (chain[chain_length] == 0)
+		{
+			return 1;
+		}
+		chain_length++;
+	}
+
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *block = (struct cs1550_extent_block *) block_buf;
+	for (size_t i = 0; i < chain_length; i++)
+	{
+		size_t first = i * max_extents;
+		memset(block, 0, block_size);
+		block->magic = EXTENT_MAGIC;
+		block->num_extents = num_extents - first;
+		if (block->num_extents > max_extents)
+		{
+			block->num_extents = max_extents;
+		}
+		block->n_next_block = (i + 1 < chain_length) ? chain[i + 1] : 0;
+		memcpy(block->extents, &extents[first], block->num_extents * sizeof(struct cs1550_extent));
+		write_block(chain[i], block);
+	}
+	return 0;
+}
+
+static int format(const char *disk, size_t size_mb)
+{
+	// The superblock, the root, the journal after it and the bitmap, with a
+	// block to spare
+	num_blocks = size_mb * 1024 * 1024 / block_size;
+	n_root_block = 1;
+	journal_blocks = new_journal_size();
+	journal_start = journal_blocks ? 2 : 0;
+	if (num_blocks < 3 + journal_blocks + BITMAP_BLOCKS(num_blocks, block_size))
+	{
+		fprintf(stderr, "%s: %zu MB is too small for %zu byte blocks\n", disk, size_mb, block_size);
+		return 1;
+	}
+
+	f = fopen(disk, "wb");
+	if (f == NULL)
+	{
+		perror(disk);
+		return 1;
+	}
+	new_bitmap();
+
+	char *zero = calloc(1, block_size);
+	for (size_t n = 0; n < bitmap_start; n++)
+	{
+		write_block(n, zero);
+	}
+	free(zero);
+	write_superblock();
+	if (journal_blocks)
+	{
+		write_journal_header();
+	}
+	write_bitmap();
+	fclose(f);
+
+	printf("+ %s : %zu blocks of %zu bytes, %zu of them for the journal\n", disk,
+		num_blocks, block_size, journal_blocks);
+	printf("+ Files per directory block : %zu, directories : %zu\n",
+		MAX_FILES_IN_DIR(block_size), MAX_DIRS_IN_ROOT(block_size));
+	return 0;
+}
+
+static int convert(const char *disk)
+{
+	f = fopen(disk, "rb+");
+	if (f == NULL)
+	{
+		perror(disk);
+		return 1;
+	}
+
+	// Take the layout from the superblock, or else the original layout
+	struct cs1550_superblock superblock;
+	fseek(f, 0, SEEK_END);
+	size_t disk_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	int has_superblock = fread(&superblock, sizeof(struct cs1550_superblock), 1, f) == 1 &&
+		superblock.magic == SUPERBLOCK_MAGIC;
+	if (has_superblock)
+	{
+		if (superblock.version > CS1550_VERSION)
+		{
+			fprintf(stderr, "%s: version %zu isn't supported\n", disk, superblock.version);
+			fclose(f);
+			return 1;
+		}
+		block_size = superblock.block_size;
+		num_blocks = superblock.num_blocks;
+		n_root_block = superblock.n_root_block;
+	}
+	else
+	{
+		block_size = BLOCK_SIZE;
+		num_blocks = disk_size / BLOCK_SIZE;
+		n_root_block = 0;
+	}
+
+	// Keep the journal there is, once it has been replayed
+	size_t new_journal_blocks = new_journal_size();
+	journal_start = 0;
+	journal_blocks = 0;
+	if (has_superblock && superblock.version >= 2 && superblock.num_journal_blocks > 1)
+	{
+		journal_start = superblock.n_journal_block;
+		journal_blocks = superblock.num_journal_blocks;
+		if (journal_pending())
+		{
+			fprintf(stderr, "%s: the journal has to be replayed, mount it first\n", disk);
+			fclose(f);
+			return 1;
+		}
+	}
+	new_bitmap();
+
+	// Find every block in use first, so the blocks added go in free ones
+	size_t root_buf[block_size / sizeof(size_t)];
+	size_t dir_buf[block_size / sizeof(size_t)];
+	struct cs1550_root_directory *root = (struct cs1550_root_directory *) root_buf;
+	struct cs1550_directory_entry *dir = (struct cs1550_directory_entry *) dir_buf;
+	size_t leaves[MAX_LEAVES_IN_INDEX(block_size)];
+	read_block(n_root_block, root);
+	for (size_t i = 0; i < root->num_directories; i++)
+	{
+		size_t n_dir_block = root->directories[i].n_start_block;
+		mark_used(n_dir_block);
+		size_t num_leaves = dir_leaves(n_dir_block, leaves);
+		for (size_t l = 0; l < num_leaves; l++)
+		{
+			mark_used(leaves[l]);
+			read_block(leaves[l], dir);
+			for (size_t j = 0; j < dir->num_files; j++)
+			{
+				mark_file(dir->files[j].n_index_block);
+			}
+		}
+	}
+
+	int ret = 0;
+	size_t converted = 0;
+	size_t block_buf[block_size / sizeof(size_t)];
+	struct cs1550_extent_block *block = (struct cs1550_extent_block *) block_buf;
+	for (size_t i = 0; i < root->num_directories && ret == 0; i++)
+	{
+		size_t num_leaves = dir_leaves(root->directories[i].n_start_block, leaves);
+		for (size_t l = 0; l < num_leaves && ret == 0; l++)
+		{
+			read_block(leaves[l], dir);
+			for (size_t j = 0; j < dir->num_files && ret == 0; j++)
+			{
+				read_block(dir->files[j].n_index_block, block);
+				if (block->magic == EXTENT_MAGIC)
+				{
+					continue;
+				}
+				ret = convert_file(dir->files[j].n_index_block);
+				if (ret != 0)
+				{
+					fprintf(stderr, "%s: no space left to convert /%s/%s\n", disk,
+						root->directories[i].dname, dir->files[j].fname);
+				}
+				else
+				{
+					converted++;
+				}
+			}
+		}
+	}
+
+	// Move the root out of block 0 to make room for a superblock
+	int moved_root = 0;
+	if (!has_superblock && ret == 0)
+	{
+		size_t n_block = alloc_block(1);
+		if (n_block == 0)
+		{
+			fprintf(stderr, "%s: no space left for the superblock\n", disk);
+			ret = 1;
+		}
+		else
+		{
+			write_block(n_block, root);
+			n_root_block = n_block;
+			moved_root = 1;
+		}
+	}
+
+	// Add a journal where there's room for it. Without one, the disk is
+	// still used, only without the journal's protection
+	int added_journal = 0;
+	if ((has_superblock || moved_root) && ret == 0 && journal_blocks == 0 && new_journal_blocks > 0)
+	{
+		journal_start = find_free_run(new_journal_blocks);
+		if (journal_start != 0)
+		{
+			journal_blocks = new_journal_blocks;
+			for (size_t n = journal_start; n < journal_start + journal_blocks; n++)
+			{
+				mark_used(n);
+			}
+			write_journal_header();
+			added_journal = 1;
+		}
+		else
+		{
+			fprintf(stderr, "%s: no run of %zu free blocks for the journal\n", disk, new_journal_blocks);
+		}
+	}
+	if ((has_superblock && superblock.version < CS1550_VERSION) || moved_root || added_journal)
+	{
+		write_superblock();
+	}
+
+	// The bitmap is written even if a file couldn't be converted, as the
+	// files converted before it may use blocks that were free
+	write_bitmap();
+	fclose(f);
+
+	printf("+ %s : converted %zu files%s%s\n", disk, converted,
+		moved_root ? ", added a superblock" : "", added_journal ? ", added a journal" : "");
+	return ret;
+}
+
+static void print_usage_info(void)
+{
+	printf("USAGE: mkfs.cs1550 [OPTIONS] [disk]\n");
+	printf("Creates a cs1550 disk file (default: .disk).\n\n");
+	printf("  -h           this help screen.\n");
+	printf("  -s size      size of the disk in MB (default: 5).\n");
+	printf("  -b size      size of a block in bytes, a power of 2 from %d to %d (default: 4096).\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+	printf("  -j blocks    size of the metadata journal in blocks, or 0 for none (default: 1/32 of the\n");
+	printf("               disk, at least %d blocks).\n", MIN_JOURNAL_BLOCKS);
+	printf("  -u           upgrades an existing disk instead: converts its files to extent index blocks,\n");
+	printf("               and adds a superblock and a journal if it has none.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size_mb = 5;
+	int upgrade = 0;
+	int c;
+
+	block_size = 4096;
+	journal_blocks = DEFAULT_JOURNAL;
+	while ((c = getopt(argc, argv, "hs:b:j:u")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage_info();
+				return 0;
+			case 's':
+				size_mb = strtoul(optarg, NULL, 10);
+				break;
+			case 'b':
+				block_size = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				journal_blocks = strtoul(optarg, NULL, 10);
+				break;
+			case 'u':
+				upgrade = 1;
+				break;
+			default:
+				print_usage_info();
+				return 1;
+		}
+	}
+
+	const char *disk = (optind < argc) ? argv[optind] : ".disk";
+	if (size_mb == 0 || block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    (block_size & (block_size - 1)) != 0)
+	{
+		print_usage_info();
+		return 1;
+	}
+
+	// The header block and a ring of at least a few transactions
+	if (journal_blocks != 0 && journal_blocks < MIN_JOURNAL_BLOCKS)
+	{
+		print_usage_info();
+		return 1;
+	}
+	return upgrade ? convert(disk) : format(disk, size_mb);
+}
@@ -0,0 +1,217 @@
+#!/bin/bash
+
+#UPGRADE, JOURNAL AND HASHED DIRECTORIES
+
+# Function called whenever a test is passed. Increments num_tests_passed
+pass() {
+  echo PASS
+}
+
+# Function called whenever a test is failed.
+fail() {
+  echo FAIL
+  unmount_disk
+  rm -rf ${DATA}
+  exit 1
+}
+
+MOUNT=testmount
+
+if [ ! -f "./cs1550" ] || [ ! -f "./mkfs.cs1550" ]; then echo "Compilation Errors"; exit 0; fi
+
+# This script mounts .disk itself, as it makes new ones and remounts them
+killall -s 9 cs1550 >& /dev/null
+fusermount -uz ${MOUNT} >& /dev/null
+mkdir -p ${MOUNT}
+DATA=$(mktemp -d)
+
+mount_disk() {
+  echo "./cs1550 -f ${MOUNT} &"
+  ./cs1550 -f ${MOUNT} &
+  PID=$!
+  sleep 3
+}
+
+unmount_disk() {
+  echo "fusermount -u ${MOUNT}"
+  fusermount -u ${MOUNT}
+  wait $PID
+}
+
+crash_disk() {
+  echo "kill -9 cs1550"
+  kill -9 $PID
+  wait $PID 2>/dev/null
+  fusermount -uz ${MOUNT}
+}
+
+check_err() {
+  echo $err
+  if [[ $err == *"abort"* ]] || [[ $err == *"not connected"* ]]
+  then
+    echo "Program crashed";
+    exit 1;
+  fi
+}
+
+# Checksums of every file under the mount point, by path
+listing() {
+  (cd ${MOUNT} && find . -type f | sort | xargs -r md5sum)
+}
+
+# Writes a size_t into .disk at a byte offset, little-endian
+put_size() {
+  printf "$(printf '%016x' $2 | sed -E 's/(..)(..)(..)(..)(..)(..)(..)(..)/\\x\8\\x\7\\x\6\\x\5\\x\4\\x\3\\x\2\\x\1/')" |
+    dd of=.disk bs=1 seek=$1 conv=notrunc 2>/dev/null
+}
+
+# Writes a string into .disk at a byte offset
+put_name() {
+  printf "%s" "$2" | dd of=.disk bs=1 seek=$1 conv=notrunc 2>/dev/null
+}
+
+
+echo "mkfs.cs1550 -u keeps the files of a disk in the original format..."
+rm -f .disk
+dd bs=1K count=5K if=/dev/zero of=.disk 2>/dev/null
+
+# Write directory old in block 1 as the original format has it: 512-byte
+# blocks, and an index block with one entry per data block. The files' data
+# blocks are handed out two at a time in turn, so each file has runs of
+# blocks with gaps between them.
+echo "Writing /old in the original format"
+SIZES=(700 5000 12345 32768)
+put_name 16 "old"
+put_size 25 1
+put_size 8 1
+put_size 512 ${#SIZES[@]}
+declare -i next=2
+declare -a left index
+for j in ${!SIZES[@]}; do
+  head -c ${SIZES[$j]} /dev/urandom > ${DATA}/old$j.dat
+  entry=$((512 + 8 + j * 29))
+  put_name $entry "old$j"
+  put_name $((entry + 9)) "dat"
+  put_size $((entry + 13)) ${SIZES[$j]}
+  put_size $((entry + 21)) $next
+  index[$j]=$next
+  left[$j]=$(((SIZES[$j] + 511) / 512))
+  next=next+1
+done
+while true; do
+  moved=0
+  for j in ${!SIZES[@]}; do
+    for k in 0 1; do
+      if [ ${left[$j]} -eq 0 ]; then break; fi
+      i=$(((SIZES[$j] + 511) / 512 - left[$j]))
+      put_size $((index[$j] * 512 + i * 8)) $next
+      dd if=${DATA}/old$j.dat of=.disk bs=512 skip=$i seek=$next count=1 conv=notrunc 2>/dev/null
+      left[$j]=$((left[$j] - 1))
+      next=next+1
+      moved=1
+    done
+  done
+  if [ $moved -eq 0 ]; then break; fi
+done
+put_size 0 $((next - 1))
+
+mount_disk
+for j in ${!SIZES[@]}; do
+  if ! cmp -s ${DATA}/old$j.dat ${MOUNT}/old/old$j.dat; then echo "old$j.dat"; fail; fi
+done
+for d in {0..2}; do
+  err=$((mkdir ${MOUNT}/dir$d) 2>&1)
+  check_err
+  for i in {0..9}; do
+    head -c $(((d * 10 + i) * 1000 + 1)) /dev/urandom > ${DATA}/new.dat
+    err=$((cp ${DATA}/new.dat ${MOUNT}/dir$d/file$i.dat) 2>&1)
+    check_err
+  done
+done
+listing > ${DATA}/before.txt
+unmount_disk
+
+echo "./mkfs.cs1550 -u .disk"
+./mkfs.cs1550 -u .disk || fail
+mount_disk
+listing > ${DATA}/after.txt
+if cmp -s ${DATA}/before.txt ${DATA}/after.txt; then echo "PASS 0"; else fail; fi
+for j in ${!SIZES[@]}; do
+  if ! cmp -s ${DATA}/old$j.dat ${MOUNT}/old/old$j.dat; then echo "old$j.dat"; fail; fi
+done
+echo "PASS 1"
+
+echo "Adding files past one block to an upgraded directory..."
+for i in {10..39}; do
+  err=$((echo "$i" > ${MOUNT}/dir0/file$i.dat) 2>&1)
+  if [ ! -f "${MOUNT}/dir0/file$i.dat" ]; then echo "file$i.dat: $err"; fail; fi
+done
+unmount_disk
+mount_disk
+if [ $(ls ${MOUNT}/dir0 | wc -l) -eq 40 ] && [ "$(cat ${MOUNT}/dir0/file39.dat)" == "39" ]; then echo "PASS 2"; else fail; fi
+unmount_disk
+
+
+echo "Crashing during writes keeps the files written before..."
+rm -f .disk
+./mkfs.cs1550 -s 16 .disk || fail
+mount_disk
+
+err=$((mkdir ${MOUNT}/dir0) 2>&1)
+check_err
+for i in {0..9}; do
+  head -c $((i * 5000 + 100)) /dev/urandom > ${DATA}/file$i.dat
+  echo "cp file$i.dat ${MOUNT}/dir0/file$i.dat"
+  err=$((cp ${DATA}/file$i.dat ${MOUNT}/dir0/file$i.dat) 2>&1)
+  check_err
+done
+listing > ${DATA}/before.txt
+
+head -c 300000 /dev/urandom > ${DATA}/big.dat
+(while true; do cat ${DATA}/big.dat > ${MOUNT}/dir0/big.dat 2>/dev/null || break; done) &
+WRITER=$!
+sleep 2
+crash_disk
+kill $WRITER >& /dev/null
+wait $WRITER 2>/dev/null
+
+mount_disk
+listing | grep -v "big.dat" > ${DATA}/after.txt
+if cmp -s ${DATA}/before.txt ${DATA}/after.txt; then echo "PASS 3"; else fail; fi
+
+echo "cat ${MOUNT}/dir0/big.dat"
+if [ -f "${MOUNT}/dir0/big.dat" ]; then
+  err=$((cat ${MOUNT}/dir0/big.dat > /dev/null) 2>&1)
+  check_err
+fi
+for i in {0..9}; do
+  if ! cmp -s ${DATA}/file$i.dat ${MOUNT}/dir0/file$i.dat; then fail; fi
+done
+echo "PASS 4"
+
+
+echo "A directory grows past one block on a disk made by mkfs.cs1550..."
+err=$((mkdir ${MOUNT}/dir1) 2>&1)
+check_err
+for i in {0..399}; do
+  err=$((echo "$i" > ${MOUNT}/dir1/f$i.txt) 2>&1)
+  if [[ $err == *"abort"* ]] || [[ $err == *"not connected"* ]]; then check_err; fi
+  if [ ! -f "${MOUNT}/dir1/f$i.txt" ]; then echo "f$i.txt: $err"; fail; fi
+done
+if [ $(ls ${MOUNT}/dir1 | wc -l) -eq 400 ]; then echo "PASS 5"; else fail; fi
+
+unmount_disk
+mount_disk
+if [ $(ls ${MOUNT}/dir1 | wc -l) -ne 400 ]; then fail; fi
+for i in {0..399}; do
+  if [ "$(cat ${MOUNT}/dir1/f$i.txt)" != "$i" ]; then fail; fi
+done
+echo "PASS 6"
+
+echo "rm ${MOUNT}/dir1/*; rmdir ${MOUNT}/dir1"
+err=$((rm ${MOUNT}/dir1/* && rmdir ${MOUNT}/dir1) 2>&1)
+check_err
+if [ -d "${MOUNT}/dir1" ]; then fail; else echo "PASS 7"; fi
+unmount_disk
+
+rm -rf ${DATA}